@@ -0,0 +1,436 @@
+/**
+
+Micro-benchmarks for the container primitives (hash.c, array.c, list.c, utf8.c).
+
+Measures the time per operation for inserts, lookups, removes and iteration at
+different sizes and with integer and string keys. Resizes are measured by growing
+from the default capacity vs. inserting into a presized container. The memory
+overhead is the heap usage (mallinfo2()) per element.
+
+Every result is checked against a threshold in ns/op. If one of them is exceeded
+the benchmark fails (exit code 1). The thresholds are generous values for a debug
+build (-g, no optimization) on a modest machine. Use the first argument to scale
+them (e.g. 0.5 for optimized builds):
+
+	benchmarks/containers_bench [threshold factor]
+
+*/
+
+// For clock_gettime() and mallinfo2()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "../hash.h"
+#include "../array.h"
+#include "../list.h"
+#include "../pool.h"
+#include "../utf8.h"
+
+
+double threshold_factor = 1.0;
+size_t exceeded_thresholds = 0;
+// Results are summed up here so the compiler can't optimize the measured loops away
+volatile uint64_t sink = 0;
+
+
+static uint64_t time_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Large blocks are mmap()ed by malloc() and not part of uordblks
+static size_t heap_used() {
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+// Memory is measured with enough copies of small containers that reused free blocks
+// of the other benchmarks don't hide their allocations
+static size_t copies_for(size_t n) {
+	return (n < 65536) ? 65536 / n : 1;
+}
+
+// Removes can degrade to a resize per call, stop them after this much time (summed over
+// all repetitions) and report the time of the removes done so far
+#define REMOVE_BUDGET_NS 2000000000ULL
+
+// Repeats a benchmark until about 1M operations have been done so small sizes
+// don't just measure the timer
+static size_t repetitions_for(size_t n) {
+	return (n < 1000000) ? 1000000 / n : 1;
+}
+
+/**
+ * Prints one result line and checks it against the threshold. `ns` is the total
+ * time for `ops` operations. Larger sizes no longer fit into the caches, so the
+ * threshold is raised for them.
+ */
+static void report(const char* name, size_t n, uint64_t ns, size_t ops, double threshold_ns_per_op) {
+	double ns_per_op = (double)ns / ops;
+	if (n > 65536)
+		threshold_ns_per_op *= 4;
+	else if (n > 1024)
+		threshold_ns_per_op *= 2;
+	bool exceeded = ns_per_op > threshold_ns_per_op * threshold_factor;
+	printf("%-28s n=%-8zu %9.2lf ns/op  (threshold %.0lf)%s\n", name, n, ns_per_op,
+		threshold_ns_per_op * threshold_factor, exceeded ? "  EXCEEDED" : "");
+	if (exceeded)
+		exceeded_thresholds++;
+}
+
+static void report_memory(const char* name, size_t n, size_t bytes, size_t payload_per_elem) {
+	printf("%-28s n=%-8zu %9.2lf bytes/elem (payload %zu)\n", name, n, (double)bytes / n, payload_per_elem);
+}
+
+
+//
+// Hash and dict
+//
+
+static void bench_hash(size_t n) {
+	size_t reps = repetitions_for(n);
+	uint64_t insert_ns = 0, presized_ns = 0, hit_ns = 0, miss_ns = 0, iterate_ns = 0, remove_ns = 0;
+	size_t removes = 0;
+	
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		hash_p hash = hash_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			hash_put(hash, i * 7919, int64_t, i);
+		insert_ns += time_ns() - start;
+		
+		start = time_ns();
+		hash_p presized = hash_with(n * 2, int64_t);
+		for(size_t i = 0; i < n; i++)
+			hash_put(presized, i * 7919, int64_t, i);
+		presized_ns += time_ns() - start;
+		hash_destroy(presized);
+		
+		start = time_ns();
+		uint64_t sum = 0;
+		for(size_t i = 0; i < n; i++)
+			sum += hash_get(hash, i * 7919, int64_t);
+		hit_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(size_t i = 0; i < n; i++)
+			sum += hash_contains(hash, i * 7919 + 1);
+		miss_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(hash_elem_t e = hash_start(hash); e != NULL; e = hash_next(hash, e))
+			sum += hash_value(e, int64_t);
+		iterate_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(size_t i = 0; i < n && remove_ns < REMOVE_BUDGET_NS; i++) {
+			hash_remove(hash, i * 7919);
+			removes++;
+			if (i % 64 == 63)
+				remove_ns += time_ns() - start, start = time_ns();
+		}
+		remove_ns += time_ns() - start;
+		
+		sink += sum;
+		hash_destroy(hash);
+	}
+	
+	report("hash int insert",         n, insert_ns,   reps * n, 600);
+	report("hash int insert presized", n, presized_ns, reps * n, 400);
+	report("hash int lookup hit",     n, hit_ns,      reps * n, 300);
+	report("hash int lookup miss",    n, miss_ns,     reps * n, 400);
+	report("hash int iterate",        n, iterate_ns,  reps * n, 100);
+	report("hash int remove",         n, remove_ns,   removes,  600);
+	
+	size_t copies = copies_for(n), heap_before = heap_used();
+	hash_p* hashes = malloc(copies * sizeof(hash_p));
+	for(size_t c = 0; c < copies; c++) {
+		hashes[c] = hash_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			hash_put(hashes[c], i * 7919, int64_t, i);
+	}
+	report_memory("hash int memory",  n, (heap_used() - heap_before - copies * sizeof(hash_p)) / copies, sizeof(hash_key_t) + sizeof(int64_t));
+	for(size_t c = 0; c < copies; c++)
+		hash_destroy(hashes[c]);
+	free(hashes);
+}
+
+static void bench_dict(size_t n) {
+	// Keys are created up front, the dict only stores the pointers
+	char** keys = malloc(n * sizeof(char*));
+	char** missing_keys = malloc(n * sizeof(char*));
+	for(size_t i = 0; i < n; i++) {
+		asprintf(&keys[i], "glyph-%zu", i * 7919);
+		asprintf(&missing_keys[i], "glyph-%zu", i * 7919 + 1);
+	}
+	
+	size_t reps = repetitions_for(n);
+	uint64_t insert_ns = 0, hit_ns = 0, miss_ns = 0, iterate_ns = 0, remove_ns = 0;
+	size_t removes = 0;
+	
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		dict_p dict = dict_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			dict_put(dict, keys[i], int64_t, i);
+		insert_ns += time_ns() - start;
+		
+		start = time_ns();
+		uint64_t sum = 0;
+		for(size_t i = 0; i < n; i++)
+			sum += dict_get(dict, keys[i], int64_t);
+		hit_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(size_t i = 0; i < n; i++)
+			sum += dict_contains(dict, missing_keys[i]);
+		miss_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(dict_elem_t e = dict_start(dict); e != NULL; e = dict_next(dict, e))
+			sum += dict_value(e, int64_t);
+		iterate_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(size_t i = 0; i < n && remove_ns < REMOVE_BUDGET_NS; i++) {
+			dict_remove(dict, keys[i]);
+			removes++;
+			if (i % 64 == 63)
+				remove_ns += time_ns() - start, start = time_ns();
+		}
+		remove_ns += time_ns() - start;
+		
+		sink += sum;
+		dict_destroy(dict);
+	}
+	
+	report("dict str insert",      n, insert_ns,  reps * n, 800);
+	report("dict str lookup hit",  n, hit_ns,     reps * n, 500);
+	report("dict str lookup miss", n, miss_ns,    reps * n, 500);
+	report("dict str iterate",     n, iterate_ns, reps * n, 100);
+	report("dict str remove",      n, remove_ns,  removes,  800);
+	
+	size_t copies = copies_for(n), heap_before = heap_used();
+	dict_p* dicts = malloc(copies * sizeof(dict_p));
+	for(size_t c = 0; c < copies; c++) {
+		dicts[c] = dict_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			dict_put(dicts[c], keys[i], int64_t, i);
+	}
+	report_memory("dict str memory", n, (heap_used() - heap_before - copies * sizeof(dict_p)) / copies, sizeof(char*) + sizeof(int64_t));
+	for(size_t c = 0; c < copies; c++)
+		dict_destroy(dicts[c]);
+	free(dicts);
+	
+	for(size_t i = 0; i < n; i++) {
+		free(keys[i]);
+		free(missing_keys[i]);
+	}
+	free(keys);
+	free(missing_keys);
+}
+
+
+//
+// Array and list
+//
+
+static void bench_array(size_t n) {
+	size_t reps = repetitions_for(n);
+	uint64_t append_ns = 0, iterate_ns = 0, remove_ns = 0;
+	
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		array_p array = array_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			array_append(array, int64_t, i);
+		append_ns += time_ns() - start;
+		
+		start = time_ns();
+		uint64_t sum = 0;
+		for(size_t i = 0; i < array->length; i++)
+			sum += array_elem(array, int64_t, i);
+		iterate_ns += time_ns() - start;
+		
+		// Removing from the front moves all other elements, so only remove a few
+		size_t removes = (n < 64) ? n : 64;
+		start = time_ns();
+		for(size_t i = 0; i < removes; i++)
+			array_remove(array, 0);
+		remove_ns += (time_ns() - start) * n / removes;
+		
+		sink += sum;
+		array_destroy(array);
+	}
+	
+	report("array append",       n, append_ns,  reps * n, 100);
+	report("array iterate",      n, iterate_ns, reps * n, 20);
+	report("array remove front", n, remove_ns,  reps * n, 50 + n);
+	
+	size_t copies = copies_for(n), heap_before = heap_used();
+	array_p* arrays = malloc(copies * sizeof(array_p));
+	for(size_t c = 0; c < copies; c++) {
+		arrays[c] = array_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			array_append(arrays[c], int64_t, i);
+	}
+	report_memory("array memory", n, (heap_used() - heap_before - copies * sizeof(array_p)) / copies, sizeof(int64_t));
+	for(size_t c = 0; c < copies; c++)
+		array_destroy(arrays[c]);
+	free(arrays);
+}
+
+static void bench_list(size_t n) {
+	size_t reps = repetitions_for(n);
+	uint64_t append_ns = 0, iterate_ns = 0, count_ns = 0, remove_ns = 0;
+	
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		list_p list = list_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			list_append(list, int64_t, i);
+		append_ns += time_ns() - start;
+		
+		start = time_ns();
+		uint64_t sum = 0;
+		for(list_node_p node = list->first; node != NULL; node = node->next)
+			sum += list_value(node, int64_t);
+		iterate_ns += time_ns() - start;
+		
+		start = time_ns();
+		sum += list_count(list);
+		count_ns += time_ns() - start;
+		
+		start = time_ns();
+		for(size_t i = 0; i < n; i++)
+			list_remove_first(list);
+		remove_ns += time_ns() - start;
+		
+		sink += sum;
+		list_destroy(list);
+	}
+	
+	report("list append",       n, append_ns,  reps * n, 250);
+	report("list iterate",      n, iterate_ns, reps * n, 40);
+	report("list count",        n, count_ns,   reps * n, 40);
+	report("list remove first", n, remove_ns,  reps * n, 200);
+	
+	// Pooled list, the pool keeps its nodes over all repetitions like in server.c
+	pool_p pool = pool_new(list_node_size(sizeof(int64_t)), 64);
+	uint64_t pooled_ns = 0;
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		list_p list = list_of_pooled(int64_t, pool);
+		for(size_t i = 0; i < n; i++)
+			list_append(list, int64_t, i);
+		for(size_t i = 0; i < n; i++)
+			list_remove_first(list);
+		list_destroy(list);
+		pooled_ns += time_ns() - start;
+	}
+	pool_destroy(pool);
+	report("list pooled append+remove", n, pooled_ns, reps * n, 100);
+	
+	size_t copies = copies_for(n), heap_before = heap_used();
+	list_p* lists = malloc(copies * sizeof(list_p));
+	for(size_t c = 0; c < copies; c++) {
+		lists[c] = list_of(int64_t);
+		for(size_t i = 0; i < n; i++)
+			list_append(lists[c], int64_t, i);
+	}
+	report_memory("list memory", n, (heap_used() - heap_before - copies * sizeof(list_p)) / copies, sizeof(int64_t));
+	for(size_t c = 0; c < copies; c++)
+		list_destroy(lists[c]);
+	free(lists);
+}
+
+
+//
+// UTF-8 iteration
+//
+
+static void bench_utf8(const char* name, const char* pattern, size_t size) {
+	// Repeat the pattern until the buffer is full
+	char* text = malloc(size + 1);
+	size_t pattern_length = strlen(pattern);
+	size_t used = 0;
+	while (used + pattern_length <= size) {
+		memcpy(text + used, pattern, pattern_length);
+		used += pattern_length;
+	}
+	text[used] = '\0';
+	
+	size_t reps = repetitions_for(used);
+	uint64_t ns = 0;
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		uint64_t sum = 0;
+		for(utf8_iterator_t it = utf8_first_size(text, used); it.code_point != 0; it = utf8_next(it))
+			sum += it.code_point;
+		ns += time_ns() - start;
+		sink += sum;
+	}
+	
+	// Per byte, so ASCII and multibyte text are comparable
+	report(name, used, ns, reps * used, 60);
+	free(text);
+}
+
+static void bench_utf8_decode(const char* name, const char* pattern, size_t size, double threshold_ns_per_byte) {
+	char* text = malloc(size + 1);
+	size_t pattern_length = strlen(pattern);
+	size_t used = 0;
+	while (used + pattern_length <= size) {
+		memcpy(text + used, pattern, pattern_length);
+		used += pattern_length;
+	}
+	text[used] = '\0';
+	uint32_t* code_points = malloc(used * sizeof(uint32_t));
+	
+	size_t reps = repetitions_for(used);
+	uint64_t ns = 0;
+	for(size_t r = 0; r < reps; r++) {
+		uint64_t start = time_ns();
+		size_t count = utf8_decode(text, used, code_points, NULL);
+		ns += time_ns() - start;
+		sink += count + code_points[count / 2];
+	}
+	
+	report(name, used, ns, reps * used, threshold_ns_per_byte);
+	free(code_points);
+	free(text);
+}
+
+
+int main(int argc, char** argv) {
+	if (argc > 1)
+		threshold_factor = strtod(argv[1], NULL);
+	
+	size_t sizes[] = { 16, 1024, 65536, 1048576 };
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_hash(sizes[i]);
+		bench_dict(sizes[i]);
+		bench_array(sizes[i]);
+		bench_list(sizes[i]);
+		printf("\n");
+	}
+	
+	bench_utf8("utf8 ascii",     "The quick brown fox jumps over the lazy dog. ", 1024 * 1024);
+	bench_utf8("utf8 multibyte", "Öffentliche Bühne, 5 € für Größe ✓ — 日本語. ", 1024 * 1024);
+	bench_utf8_decode("utf8 decode ascii",     "The quick brown fox jumps over the lazy dog. ", 1024 * 1024, 5);
+	bench_utf8_decode("utf8 decode multibyte", "Öffentliche Bühne, 5 € für Größe ✓ — 日本語. ", 1024 * 1024, 60);
+	
+	if (exceeded_thresholds > 0) {
+		printf("\n%zu results exceeded their threshold\n", exceeded_thresholds);
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Runs hdswitch headless with synthetic inputs and reports frames/s, stage latencies
+# and the bytes/s delivered to N dummy stream clients.
+#
+# Usage: benchmarks/run.sh [clients] [seconds]
+#
+# Uses Mesas software renderer in a virtual X server (xvfb-run) if there is no
+# display. Run from the project directory (hdswitch loads its shaders from there).
+
+CLIENTS=${1:-4}
+DURATION=${2:-10}
+
+if [ -z "$DISPLAY" ]; then
+	exec xvfb-run -a -s "-screen 0 1280x720x24" env LIBGL_ALWAYS_SOFTWARE=1 "$0" "$CLIENTS" "$DURATION"
+fi
+
+./hdswitch benchmarks/bench.conf > /dev/null &
+HDSWITCH_PID=$!
+
+benchmarks/stream_clients "$CLIENTS" "$DURATION"
+STATUS=$?
+
+kill -TERM $HDSWITCH_PID
+wait $HDSWITCH_PID
+exit $STATUS
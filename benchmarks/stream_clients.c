@@ -0,0 +1,135 @@
+/**
+
+Connects N dummy clients to the hdswitch stream socket, reads everything they get
+for T seconds and reports the bytes/s each client received. Afterwards the metrics
+of hdswitch (frames/s, stage latencies) are fetched from the metrics socket and
+printed as JSON.
+
+Usage: stream_clients [clients] [seconds] [stream socket] [metrics socket]
+
+Defaults are 4 clients, 10 seconds, hdswitch.sock and hdswitch-metrics.sock. Meant to
+be run by benchmarks/run.sh against a headless hdswitch with synthetic inputs.
+
+*/
+
+// For usleep() and clock_gettime()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../timer.h"
+
+
+static int connect_to(const char* path);
+
+
+int main(int argc, char** argv) {
+	size_t client_count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4;
+	double duration_s   = (argc > 2) ? strtod(argv[2], NULL) : 10;
+	const char* stream_path  = (argc > 3) ? argv[3] : "hdswitch.sock";
+	const char* metrics_path = (argc > 4) ? argv[4] : "hdswitch-metrics.sock";
+	
+	if (client_count == 0 || duration_s <= 0)
+		return fprintf(stderr, "usage: %s [clients] [seconds] [stream socket] [metrics socket]\n", argv[0]), 1;
+	
+	// hdswitch needs a moment to open its sockets, retry for 10 seconds
+	struct pollfd* clients = calloc(client_count, sizeof(struct pollfd));
+	uint64_t* bytes_read = calloc(client_count, sizeof(uint64_t));
+	for(size_t i = 0; i < client_count; i++) {
+		int fd = -1;
+		for(size_t tries = 0; fd == -1 && tries < 100; tries++) {
+			fd = connect_to(stream_path);
+			if (fd == -1)
+				usleep(100000);
+		}
+		if (fd == -1)
+			return perror("connect() to stream socket"), 1;
+		
+		clients[i] = (struct pollfd){ .fd = fd, .events = POLLIN };
+	}
+	
+	
+	// Read everything the clients get until the time is up
+	char buffer[64 * 1024];
+	usec_t start = time_monotonic(), end = start + duration_s * 1000000;
+	size_t open_clients = client_count;
+	while (open_clients > 0) {
+		usec_t now = time_monotonic();
+		if (now >= end)
+			break;
+		
+		int ready = poll(clients, client_count, (end - now) / 1000 + 1);
+		if (ready == -1 && errno != EINTR)
+			return perror("poll"), 1;
+		
+		for(size_t i = 0; i < client_count && ready > 0; i++) {
+			if (clients[i].revents == 0)
+				continue;
+			ready--;
+			
+			ssize_t bytes = read(clients[i].fd, buffer, sizeof(buffer));
+			if (bytes > 0) {
+				bytes_read[i] += bytes;
+			} else {
+				fprintf(stderr, "client %zu: disconnected after %.1lf s\n", i, (time_monotonic() - start) / 1000000.0);
+				close(clients[i].fd);
+				// Negative fds are ignored by poll()
+				clients[i].fd = -1;
+				open_clients--;
+			}
+		}
+	}
+	double elapsed_s = (time_monotonic() - start) / 1000000.0;
+	
+	uint64_t total_bytes = 0;
+	for(size_t i = 0; i < client_count; i++) {
+		printf("client %zu: %.2lf MByte/s\n", i, bytes_read[i] / elapsed_s / 1000000.0);
+		total_bytes += bytes_read[i];
+		if (clients[i].fd != -1)
+			close(clients[i].fd);
+	}
+	printf("total: %.2lf MByte/s to %zu clients in %.1lf s\n", total_bytes / elapsed_s / 1000000.0, client_count, elapsed_s);
+	
+	free(bytes_read);
+	free(clients);
+	
+	
+	// Fetch the metrics of hdswitch (they cover the whole run)
+	int metrics_fd = connect_to(metrics_path);
+	if (metrics_fd == -1)
+		return perror("connect() to metrics socket"), 1;
+	
+	const char* request = "json\n";
+	if ( write(metrics_fd, request, strlen(request)) == -1 )
+		return perror("write() to metrics socket"), 1;
+	
+	ssize_t bytes = 0;
+	while ( (bytes = read(metrics_fd, buffer, sizeof(buffer))) > 0 )
+		fwrite(buffer, bytes, 1, stdout);
+	close(metrics_fd);
+	
+	return 0;
+}
+
+static int connect_to(const char* path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if ( connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ) {
+		close(fd);
+		return -1;
+	}
+	
+	return fd;
+}
@@ -1,3 +1,6 @@
+// For struct timespec used by newer linux/videodev2.h headers (not defined in strict C99 mode)
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -7,12 +10,14 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 
 #include <linux/videodev2.h>
+#include "timer.h"
 #include "cam.h"
 
 
@@ -25,6 +30,7 @@ static bool set_pixel_format_and_resolution(cam_p cam, uint32_t pixel_format, ui
 static bool set_frame_rate(cam_p cam, uint32_t frame_interval_num, uint32_t frame_interval_den);
 static bool map_buffers(cam_p cam, size_t buffer_count);
 static bool unmap_buffers(cam_p cam);
+static void draw_synthetic_frame(cam_p cam, uint8_t* yuyv);
 
 
 /**
@@ -36,17 +42,33 @@ static bool unmap_buffers(cam_p cam);
 cam_p cam_open(const char* camera_file){
 	cam_p cam = malloc(sizeof(cam_t));
 	
-	cam->fd = open(camera_file, O_RDWR);
-	if (cam->fd == -1){
-		perror("camera: open() of video device failed");
-		free(cam);
-		return NULL;
+	cam->synthetic = (strcmp(camera_file, "synthetic") == 0);
+	if (cam->synthetic) {
+		cam->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (cam->fd == -1){
+			perror("camera: timerfd_create() for synthetic cam failed");
+			free(cam);
+			return NULL;
+		}
+	} else {
+		cam->fd = open(camera_file, O_RDWR);
+		if (cam->fd == -1){
+			perror("camera: open() of video device failed");
+			free(cam);
+			return NULL;
+		}
 	}
 	
 	cam->buffer_count = 0;
 	cam->buffers = NULL;
 	cam->dequeued_buffer = -1;
 	
+	cam->width = 0;
+	cam->height = 0;
+	cam->frame_rate_num = 30;
+	cam->frame_rate_den = 1;
+	cam->frame_number = 0;
+	
 	return cam;
 }
 
@@ -63,12 +85,26 @@ void cam_close(cam_p cam){
 
 
 void cam_setup(cam_p cam, uint32_t pixel_format, uint32_t width, uint32_t height, uint32_t frame_rate_num, uint32_t frame_rate_den, cam_control_t controls[]){
+	if (cam->synthetic) {
+		// Synthetic cams only do YUYV, the pixel format is ignored
+		cam->width = width;
+		cam->height = height;
+		cam->frame_rate_num = frame_rate_num;
+		cam->frame_rate_den = frame_rate_den;
+		return;
+	}
+	
 	set_pixel_format_and_resolution(cam, pixel_format, width, height);
 	set_frame_rate(cam, frame_rate_num, frame_rate_den);
 	cam_set_controls(cam, controls);
 }
 
 void cam_print_info(cam_p cam){
+	if (cam->synthetic) {
+		printf("Synthetic cam, YUYV test pattern\n");
+		return;
+	}
+	
 	show_device_capabilities(cam->fd);
 	show_capture_pixel_formats(cam->fd);
 	show_controls(cam->fd);
@@ -76,6 +112,26 @@ void cam_print_info(cam_p cam){
 
 
 bool cam_stream_start(cam_p cam, size_t buffer_count){
+	if (cam->synthetic) {
+		// One buffer is enough, the frame is drawn when it is dequeued
+		cam->buffer_count = 1;
+		cam->buffers = calloc(cam->buffer_count, sizeof(cam_buffer_t));
+		cam->buffers[0].size = cam->width * cam->height * 2;
+		cam->buffers[0].ptr = malloc(cam->buffers[0].size);
+		
+		usec_t interval = 1000000LL * cam->frame_rate_den / cam->frame_rate_num;
+		struct itimerspec timer_spec = {
+			.it_interval = { .tv_sec = interval / 1000000, .tv_nsec = (interval % 1000000) * 1000 },
+			.it_value    = { .tv_sec = interval / 1000000, .tv_nsec = (interval % 1000000) * 1000 }
+		};
+		if ( timerfd_settime(cam->fd, 0, &timer_spec, NULL) == -1 ) {
+			perror("timerfd_settime() for synthetic cam failed");
+			return false;
+		}
+		
+		return true;
+	}
+	
 	if ( ! map_buffers(cam, buffer_count) )
 		return false;
 	
@@ -102,6 +158,18 @@ bool cam_stream_start(cam_p cam, size_t buffer_count){
 }
 
 bool cam_stream_stop(cam_p cam){
+	if (cam->synthetic) {
+		// Disarm the timer
+		struct itimerspec timer_spec = { { 0, 0 }, { 0, 0 } };
+		timerfd_settime(cam->fd, 0, &timer_spec, NULL);
+		
+		free(cam->buffers[0].ptr);
+		free(cam->buffers);
+		cam->buffer_count = 0;
+		cam->buffers = NULL;
+		return true;
+	}
+	
 	// Stop streaming, this also dequeues all buffers
 	int stream_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	if ( ioctl(cam->fd, VIDIOC_STREAMOFF, &stream_type) == -1 ) {
@@ -121,6 +189,20 @@ cam_buffer_t cam_frame_get(cam_p cam){
 		return (cam_buffer_t){ .size = 0, .ptr = NULL };
 	}
 	
+	if (cam->synthetic) {
+		// Consume the timer expirations. Skipped frames just move the pattern further.
+		uint64_t expirations = 0;
+		if ( read(cam->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN ) {
+			perror("read() of synthetic cam timerfd failed");
+			return (cam_buffer_t){ .size = 0, .ptr = NULL };
+		}
+		cam->frame_number += (expirations > 0) ? expirations : 1;
+		
+		draw_synthetic_frame(cam, cam->buffers[0].ptr);
+		cam->dequeued_buffer = 0;
+		return (cam_buffer_t){ .size = cam->buffers[0].size, .ptr = cam->buffers[0].ptr, .timestamp = time_monotonic() };
+	}
+	
 	struct v4l2_buffer buffer = {0};
 	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	buffer.memory = V4L2_MEMORY_MMAP;
@@ -130,8 +212,12 @@ cam_buffer_t cam_frame_get(cam_p cam){
 		return (cam_buffer_t){ .size = 0, .ptr = NULL };
 	}
 	
+	uint64_t timestamp = 0;
+	if ( (buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC )
+		timestamp = buffer.timestamp.tv_sec * 1000000ULL + buffer.timestamp.tv_usec;
+	
 	cam->dequeued_buffer = buffer.index;
-	return (cam_buffer_t){ .size = buffer.bytesused, .ptr = cam->buffers[buffer.index].ptr };
+	return (cam_buffer_t){ .size = buffer.bytesused, .ptr = cam->buffers[buffer.index].ptr, .timestamp = timestamp };
 }
 
 bool cam_frame_release(cam_p cam){
@@ -140,6 +226,11 @@ bool cam_frame_release(cam_p cam){
 		return false;
 	}
 	
+	if (cam->synthetic) {
+		cam->dequeued_buffer = -1;
+		return true;
+	}
+	
 	// Enque the buffer in the video capture queue so the driver can use it again
 	struct v4l2_buffer buffer = {0};
 	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -321,6 +412,13 @@ static void show_controls(int fd){
 }
 
 bool cam_print_frame_rate(cam_p cam) {
+	if (cam->synthetic) {
+		printf("cam set to %u/%u fps, synthetic\n", cam->frame_rate_num, cam->frame_rate_den);
+		printf("  %ux%u, format YUYV, %u bytes per line, %u image size\n",
+			cam->width, cam->height, cam->width * 2, cam->width * cam->height * 2);
+		return true;
+	}
+	
 	struct v4l2_streamparm params = {0};
 	
 	params.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -429,8 +527,8 @@ static bool set_frame_rate(cam_p cam, uint32_t frame_rate_num, uint32_t frame_ra
  * set as an integer.
  */
 bool cam_set_controls(cam_p cam, cam_control_t controls[]){
-	// Do nothing if we get no controls array
-	if (controls == NULL)
+	// Do nothing if we get no controls array or synthetic cams (they have no controls)
+	if (controls == NULL || cam->synthetic)
 		return true;
 	
 	struct v4l2_queryctrl control = {0};
@@ -548,4 +646,34 @@ static bool unmap_buffers(cam_p cam){
 	cam->buffers = NULL;
 	
 	return true;
-}
\ No newline at end of file
+}
+
+/**
+ * Draws the test pattern of synthetic cams: eight vertical color bars with a white bar
+ * that moves 4 pixels to the right with every frame. Every pixel changes in most frames
+ * so the upload has to transfer real data.
+ */
+static void draw_synthetic_frame(cam_p cam, uint8_t* yuyv){
+	// Y, U, V of white, yellow, cyan, green, magenta, red, blue and black
+	const uint8_t bars[8][3] = {
+		{ 235, 128, 128 }, { 210,  16, 146 }, { 170, 166,  16 }, { 145,  54,  34 },
+		{ 106, 202, 222 }, {  81,  90, 240 }, {  41, 240, 110 }, {  16, 128, 128 }
+	};
+	
+	uint32_t bar_width = (cam->width / 8 > 0) ? cam->width / 8 : 1;
+	uint32_t moving_x = (cam->frame_number * 4) % (cam->width > 0 ? cam->width : 1);
+	
+	for(uint32_t y = 0; y < cam->height; y++) {
+		uint8_t* line = yuyv + y * cam->width * 2;
+		for(uint32_t x = 0; x < cam->width; x += 2) {
+			const uint8_t* c = bars[(x / bar_width) % 8];
+			uint8_t luma = (x >= moving_x && x < moving_x + 16) ? 235 : c[0];
+			// Slowly varying noise on the luma so consecutive frames differ everywhere
+			luma += (uint8_t)((x + y + cam->frame_number) & 3);
+			line[x*2 + 0] = luma;
+			line[x*2 + 1] = c[1];
+			line[x*2 + 2] = luma;
+			line[x*2 + 3] = c[2];
+		}
+	}
+}
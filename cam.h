@@ -5,16 +5,26 @@
 #include <stdbool.h>
 
 
+// `timestamp` is the capture time in µs (CLOCK_MONOTONIC) as reported by the driver,
+// 0 if the driver uses another clock. Only set for buffers returned by cam_frame_get().
 typedef struct {
 	size_t size;
 	void*  ptr;
+	uint64_t timestamp;
 } cam_buffer_t, *cam_buffer_p;
 
+// Synthetic cams (opened with the device name "synthetic") have no V4L2 device. `fd` is
+// a timerfd that becomes readable at the frame rate and cam_frame_get() draws a moving
+// YUYV test pattern into one malloc()ed buffer. Used to benchmark without real cams.
 typedef struct {
 	int fd;
 	size_t buffer_count;
 	cam_buffer_p buffers;
 	ssize_t dequeued_buffer;
+	
+	bool synthetic;
+	uint32_t width, height, frame_rate_num, frame_rate_den;
+	uint64_t frame_number;
 } cam_t, *cam_p;
 
 typedef struct {
@@ -0,0 +1,309 @@
+// For strdup()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+
+static void place(char horizontal_anchor, ssize_t* x, char vertical_anchor, ssize_t* y, ssize_t w, ssize_t h, size_t composite_w, size_t composite_h);
+
+/**
+ * Reads the config file at `path`. Only the inputs and the raw view values are
+ * parsed, no OpenGL objects are created. Use config_build_scenes() for that.
+ * 
+ * Returns the config on success or `NULL` on error. Errors are printed to stderr.
+ */
+config_p config_load(const char* path) {
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return perror("[config] fopen"), NULL;
+	
+	config_p config = malloc(sizeof(config_t));
+	config->inputs = array_of(video_input_t);
+	config->scenes = array_of(scene_t);
+	config->tickers = array_of(ticker_lane_t);
+	config->stats_path = NULL;
+	config->latency_probe = false;
+	config->latency_pattern = false;
+	config->headless = false;
+	config->synthetic_audio = false;
+	config->transition_duration = 1000;
+	config->preview_fps = 10;
+	
+	char line[1024];
+	size_t line_number = 0;
+	while ( fgets(line, sizeof(line), f) != NULL ) {
+		line_number++;
+		
+		char command[32] = "";
+		int command_length = 0;
+		if ( sscanf(line, " %31s%n", command, &command_length) < 1 || command[0] == '#' )
+			continue;
+		char* args = line + command_length;
+		
+		if ( strcmp(command, "input") == 0 ) {
+			char device_file[512];
+			size_t w = 0, h = 0;
+			if ( sscanf(args, " %511s %zu %zu", device_file, &w, &h) != 3 || w == 0 || h == 0 )
+				goto syntax_error;
+			
+			video_input_p vi = array_append_ptr(config->inputs);
+			*vi = (video_input_t){ strdup(device_file), w, h, NULL, NULL, NULL, 0, 0, 0 };
+		} else if ( strcmp(command, "scene") == 0 ) {
+			scene_p scene = array_append_ptr(config->scenes);
+			scene->views = array_of(video_view_t);
+			scene->vertices = 0;
+			scene->images = array_of(image_layer_t);
+		} else if ( strcmp(command, "view") == 0 ) {
+			if (config->scenes->length == 0) {
+				fprintf(stderr, "[config] %s:%zu: view outside of a scene\n", path, line_number);
+				goto failed;
+			}
+			
+			video_view_t vv = { 0 };
+			if ( sscanf(args, " %c %zd %c %zd %zu %zd %zd", &vv.horizontal_anchor, &vv.x, &vv.vertical_anchor, &vv.y, &vv.video_idx, &vv.w, &vv.h) != 7 )
+				goto syntax_error;
+			if ( strchr("lrc", vv.horizontal_anchor) == NULL || strchr("tbc", vv.vertical_anchor) == NULL )
+				goto syntax_error;
+			
+			scene_p scene = array_elem_ptr(config->scenes, config->scenes->length - 1);
+			array_append(scene->views, video_view_t, vv);
+		} else if ( strcmp(command, "image") == 0 ) {
+			if (config->scenes->length == 0) {
+				fprintf(stderr, "[config] %s:%zu: image outside of a scene\n", path, line_number);
+				goto failed;
+			}
+			
+			char image_path[512];
+			image_layer_t image = { 0 };
+			if ( sscanf(args, " %511s %c %zd %c %zd %zd %zd", image_path, &image.horizontal_anchor, &image.x, &image.vertical_anchor, &image.y, &image.w, &image.h) != 7 )
+				goto syntax_error;
+			if ( strchr("lrc", image.horizontal_anchor) == NULL || strchr("tbc", image.vertical_anchor) == NULL )
+				goto syntax_error;
+			
+			image.path = strdup(image_path);
+			scene_p scene = array_elem_ptr(config->scenes, config->scenes->length - 1);
+			array_append(scene->images, image_layer_t, image);
+		} else if ( strcmp(command, "stats") == 0 ) {
+			char stats_path[512];
+			if ( sscanf(args, " %511s", stats_path) != 1 )
+				goto syntax_error;
+			
+			free(config->stats_path);
+			config->stats_path = strdup(stats_path);
+		} else if ( strcmp(command, "ticker") == 0 ) {
+			char socket_path[512];
+			ticker_lane_t lane = { 0 };
+			if ( sscanf(args, " %511s %zu %zu %zu %zu %f", socket_path, &lane.x, &lane.y, &lane.width, &lane.height, &lane.speed) != 6 || lane.width == 0 || lane.height == 0 )
+				goto syntax_error;
+			
+			lane.socket_path = strdup(socket_path);
+			array_append(config->tickers, ticker_lane_t, lane);
+		} else if ( strcmp(command, "latency_probe") == 0 ) {
+			char option[32] = "";
+			if ( sscanf(args, " %31s", option) == 1 && strcmp(option, "pattern") != 0 )
+				goto syntax_error;
+			
+			config->latency_probe = true;
+			config->latency_pattern = (option[0] != '\0');
+		} else if ( strcmp(command, "transition_duration") == 0 ) {
+			if ( sscanf(args, " %zu", &config->transition_duration) != 1 || config->transition_duration == 0 )
+				goto syntax_error;
+		} else if ( strcmp(command, "preview_fps") == 0 ) {
+			if ( sscanf(args, " %zu", &config->preview_fps) != 1 || config->preview_fps == 0 )
+				goto syntax_error;
+		} else if ( strcmp(command, "headless") == 0 ) {
+			config->headless = true;
+		} else if ( strcmp(command, "synthetic_audio") == 0 ) {
+			config->synthetic_audio = true;
+		} else {
+			fprintf(stderr, "[config] %s:%zu: unknown command \"%s\"\n", path, line_number, command);
+			goto failed;
+		}
+	}
+	
+	fclose(f);
+	
+	if (config->inputs->length == 0 || config->scenes->length == 0) {
+		fprintf(stderr, "[config] %s: need at least one input and one scene\n", path);
+		config_destroy(config);
+		return NULL;
+	}
+	
+	return config;
+	
+	syntax_error:
+		fprintf(stderr, "[config] %s:%zu: syntax error: %s", path, line_number, line);
+	failed:
+		fclose(f);
+		config_destroy(config);
+	return NULL;
+}
+
+/**
+ * Frees the config including the vertex buffers of the scenes. Cameras and textures
+ * of the inputs are not touched, close them first.
+ */
+void config_destroy(config_p config) {
+	config_destroy_scenes(config);
+	
+	for(size_t i = 0; i < config->inputs->length; i++)
+		free( array_elem(config->inputs, video_input_t, i).device_file );
+	array_destroy(config->inputs);
+	
+	for(size_t i = 0; i < config->scenes->length; i++) {
+		scene_p scene = array_elem_ptr(config->scenes, i);
+		array_destroy(scene->views);
+		for(size_t j = 0; j < scene->images->length; j++)
+			free( array_elem(scene->images, image_layer_t, j).path );
+		array_destroy(scene->images);
+	}
+	array_destroy(config->scenes);
+	
+	for(size_t i = 0; i < config->tickers->length; i++)
+		free( array_elem(config->tickers, ticker_lane_t, i).socket_path );
+	array_destroy(config->tickers);
+	
+	free(config->stats_path);
+	free(config);
+}
+
+/**
+ * Returns `true` if both configs use the same inputs (same devices and sizes in the
+ * same order).
+ */
+bool config_inputs_equal(config_p a, config_p b) {
+	if (a->inputs->length != b->inputs->length)
+		return false;
+	
+	for(size_t i = 0; i < a->inputs->length; i++) {
+		video_input_p ia = array_elem_ptr(a->inputs, i), ib = array_elem_ptr(b->inputs, i);
+		if ( strcmp(ia->device_file, ib->device_file) != 0 || ia->w != ib->w || ia->h != ib->h )
+			return false;
+	}
+	
+	return true;
+}
+
+
+/**
+ * Calculates the pixel positions and sizes of all views and builds the vertex
+ * buffer of each scene. Sizes are calculated based on `inputs`. When hot reloading a config these
+ * are the inputs of the running config, not the ones of the freshly loaded config.
+ * 
+ * Returns `false` if a view references an input that doesn't exist. In that case no
+ * vertex buffers are created.
+ */
+bool config_build_scenes(config_p config, array_p inputs, size_t composite_w, size_t composite_h) {
+	for(size_t i = 0; i < config->scenes->length; i++) {
+		scene_p scene = array_elem_ptr(config->scenes, i);
+		for(size_t j = 0; j < scene->views->length; j++) {
+			video_view_p vv = array_elem_ptr(scene->views, j);
+			if (vv->video_idx >= inputs->length) {
+				fprintf(stderr, "[config] scene %zu, view %zu: there is no input %zu\n", i + 1, j + 1, vv->video_idx);
+				return false;
+			}
+		}
+	}
+	
+	size_t cw = composite_w, ch = composite_h;
+	for(size_t i = 0; i < config->scenes->length; i++) {
+		scene_p scene = array_elem_ptr(config->scenes, i);
+		
+		size_t vertices_size = scene->views->length * 6 * 4 * sizeof(float);
+		float* vertices = malloc(vertices_size);
+		float* p = vertices;
+		
+		for(size_t j = 0; j < scene->views->length; j++) {
+			video_view_p  vv = array_elem_ptr(scene->views, j);
+			video_input_p vi = array_elem_ptr(inputs, vv->video_idx);
+			
+			// percent size to pixel size
+			if (vv->w < 0) vv->w = (ssize_t)vi->w * vv->w / -100;
+			if (vv->h < 0) vv->h = (ssize_t)vi->h * vv->h / -100;
+			
+			// calculate aspect ratio correct height if height is 0
+			if (vv->h == 0) vv->h = vv->w * (ssize_t)vi->h / (ssize_t)vi->w;
+			
+			place(vv->horizontal_anchor, &vv->x, vv->vertical_anchor, &vv->y, vv->w, vv->h, composite_w, composite_h);
+			
+			// Two triangles per view (A B C and C B D). The texture coordinates point
+			// to the area of the input in the shared input texture.
+			// B D
+			// A C
+			float left   =  vv->x          / (cw / 2.0f) - 1, right = (vv->x + vv->w) / (cw / 2.0f) - 1;
+			float bottom = (vv->y + vv->h) / (ch / 2.0f) - 1, top   =  vv->y          / (ch / 2.0f) - 1;
+			float tex_left = vi->tex_x, tex_right  = vi->tex_x + vi->w;
+			float tex_top  = vi->tex_y, tex_bottom = vi->tex_y + vi->h;
+			
+			float a[4] = { left,  bottom, tex_left,  tex_bottom };
+			float b[4] = { left,  top,    tex_left,  tex_top    };
+			float c[4] = { right, bottom, tex_right, tex_bottom };
+			float d[4] = { right, top,    tex_right, tex_top    };
+			
+			float* corners[6] = { a, b, c,   c, b, d };
+			for(size_t k = 0; k < 6; k++) {
+				memcpy(p, corners[k], sizeof(a));
+				p += 4;
+			}
+		}
+		
+		scene->vertices = buffer_new(vertices_size, vertices);
+		free(vertices);
+	}
+	
+	return true;
+}
+
+/**
+ * Destroys the vertex buffers of all scenes. Does nothing for scenes without one.
+ */
+void config_destroy_scenes(config_p config) {
+	for(size_t i = 0; i < config->scenes->length; i++) {
+		scene_p scene = array_elem_ptr(config->scenes, i);
+		if (scene->vertices) {
+			buffer_destroy(scene->vertices);
+			scene->vertices = 0;
+		}
+	}
+}
+
+/**
+ * Calculates where to draw an image of `image_w` x `image_h` pixels. Sizes and anchors
+ * work like for views. `rect` is set to the left, top, right and bottom edge in normalized
+ * device coordinates (top is -1 since the composite is stored top row first).
+ */
+void config_image_rect(image_layer_p image, size_t image_w, size_t image_h, size_t composite_w, size_t composite_h, float rect[4]) {
+	ssize_t x = image->x, y = image->y, w = image->w, h = image->h;
+	if (w < 0) w = (ssize_t)image_w * w / -100;
+	if (h < 0) h = (ssize_t)image_h * h / -100;
+	if (w == 0 && h == 0) w = image_w;
+	if (h == 0) h = w * (ssize_t)image_h / (ssize_t)image_w;
+	if (w == 0) w = h * (ssize_t)image_w / (ssize_t)image_h;
+	
+	place(image->horizontal_anchor, &x, image->vertical_anchor, &y, w, h, composite_w, composite_h);
+	
+	float cw = composite_w, ch = composite_h;
+	rect[0] =  x      / (cw / 2.0f) - 1;
+	rect[1] =  y      / (ch / 2.0f) - 1;
+	rect[2] = (x + w) / (cw / 2.0f) - 1;
+	rect[3] = (y + h) / (ch / 2.0f) - 1;
+}
+
+// Turns the anchored position of a view or image into the position of its top left corner
+static void place(char horizontal_anchor, ssize_t* x, char vertical_anchor, ssize_t* y, ssize_t w, ssize_t h, size_t composite_w, size_t composite_h) {
+	switch (horizontal_anchor) {
+		case 'l': /* nothing to do, x already correct*/      break;
+		case 'r': *x = (ssize_t)composite_w - *x - w;        break;
+		case 'c': *x = ((ssize_t)composite_w - w) / 2 + *x;  break;
+	}
+	
+	switch (vertical_anchor) {
+		case 't': /* nothing to do, y already correct*/      break;
+		case 'b': *y = (ssize_t)composite_h - *y - h;        break;
+		case 'c': *y = ((ssize_t)composite_h - h) / 2 + *y;  break;
+	}
+}
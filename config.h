@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "drawable.h"
+#include "array.h"
+#include "cam.h"
+#include "slides.h"
+#include "media.h"
+
+
+/**
+
+Loads the video inputs and scenes from a config file. The file is line based,
+empty lines and lines starting with # are ignored:
+
+	# input <device file> <width> <height>
+	input /dev/video0 640 480
+	
+	# A directory of PNG or JPEG files (exported slides) is played as a slide deck.
+	# Page down/up (or right/left) change the slides of all decks, each deck also
+	# reads commands from hdswitch-slides<input index>.sock.
+	input talk-slides/ 1280 720
+	
+	# Other files are played as MKV files (uncompressed YUY2 or MJPEG video and 16 bit
+	# PCM audio), starting with hdswitch. P plays them from the start again.
+	input intro.mkv 1280 720
+	
+	# Starts a new scene. All following views belong to that scene.
+	scene
+	
+	# view <horizontal anchor> <x> <vertical anchor> <y> <input index> <width> <height>
+	view l 0 c 0    0 -100 0
+	view r 0 b 0    0  -33 0
+	
+	# image <file> <horizontal anchor> <x> <vertical anchor> <y> <width> <height>
+	image logo.png  r 16 t 16    -50 0
+	
+	# Optional: duration of crossfades and wipes in ms (1000 by default)
+	transition_duration 500
+	
+	# Optional: refresh rate of the preview window (10 by default). It's independent
+	# of the output, use the monitor refresh rate for a smooth preview or a lower rate
+	# to save GPU time.
+	preview_fps 60
+	
+	# Optional: write one line of timing stats per measured frame into this file
+	stats hdswitch.stats
+	
+	# Optional: measure the latency from capture to the last client write. With
+	# "pattern" a frame counter is also drawn into the top left of the stream.
+	latency_probe pattern
+	
+	# Optional: a lane of scrolling text (news ticker, live captions) drawn into the
+	# stream. Text written into the socket is appended, line breaks become gaps.
+	# ticker <socket> <x> <y> <width> <text height> <pixels per second>
+	ticker hdswitch-ticker.sock 0 440 640 32 120
+	
+	# Optional, for benchmarks: "synthetic" inputs draw a moving test pattern
+	# instead of capturing a device, synthetic_audio mixes a sine tone into the
+	# audio and headless hides the window and skips drawing the preview.
+	input synthetic 640 480
+	synthetic_audio
+	headless
+
+Horizontal anchors are l, r and c, vertical anchors t, b and c. Negative sizes are
+a percentage of the input size. A height of 0 keeps the aspect ratio of the input.
+Images work the same way and are drawn over the views of their scene in the order
+they're listed.
+Tickers are only created at startup, reloading the config doesn't change them.
+Reloading does change the transition duration.
+
+Basic API usage:
+
+config_p config = config_load("hdswitch.conf");
+if (!config)
+	exit(1);
+
+// Calculate view positions and build vertex buffers (needs an OpenGL context and
+// the tex_x and tex_y offsets of the inputs)
+config_build_scenes(config, config->inputs, composite_w, composite_h);
+
+for(size_t i = 0; i < config->scenes->length; i++) {
+	scene_p scene = array_elem_ptr(config->scenes, i);
+	...
+}
+
+config_destroy(config);
+
+*/
+
+// All inputs are uploaded into one shared texture (stacked on top of each other, in
+// columns if they don't fit) so all views of a scene can be drawn with one draw call.
+// `tex_x` and `tex_y` are the top left corner of the input within `tex`. Slide decks
+// have `slides` and media files `media` instead of `cam`.
+typedef struct {
+	char* device_file;
+	size_t w, h;
+	cam_p cam;
+	slides_p slides;
+	media_p media;
+	GLuint tex;
+	size_t tex_x, tex_y;
+} video_input_t, *video_input_p;
+
+typedef struct {
+	char    horizontal_anchor;
+	ssize_t x;
+	char    vertical_anchor;
+	ssize_t y;
+	
+	size_t video_idx;
+	ssize_t w, h;
+} video_view_t, *video_view_p;
+
+// The size of an image is only known once it's decoded, so the position of an image
+// is calculated when it's drawn (see config_image_rect()).
+typedef struct {
+	char*   path;
+	char    horizontal_anchor;
+	ssize_t x;
+	char    vertical_anchor;
+	ssize_t y;
+	ssize_t w, h;
+} image_layer_t, *image_layer_p;
+
+// The vertices of all views of a scene are in one vertex buffer (two triangles per
+// view, in the order of the views).
+typedef struct {
+	array_p views;
+	GLuint  vertices;
+	array_p images;
+} scene_t, *scene_p;
+
+typedef struct {
+	char*  socket_path;
+	size_t x, y, width, height;
+	float  speed;
+} ticker_lane_t, *ticker_lane_p;
+
+// `stats_path` is NULL if no stats file was configured
+typedef struct {
+	array_p inputs;
+	array_p scenes;
+	array_p tickers;
+	char*   stats_path;
+	bool    latency_probe, latency_pattern;
+	bool    headless, synthetic_audio;
+	// Of crossfades and wipes, in ms
+	size_t  transition_duration;
+	size_t  preview_fps;
+} config_t, *config_p;
+
+config_p config_load(const char* path);
+void     config_destroy(config_p config);
+bool     config_inputs_equal(config_p a, config_p b);
+
+bool     config_build_scenes(config_p config, array_p inputs, size_t composite_w, size_t composite_h);
+void     config_destroy_scenes(config_p config);
+void     config_image_rect(image_layer_p image, size_t image_w, size_t image_h, size_t composite_w, size_t composite_h, float rect[4]);
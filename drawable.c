@@ -14,12 +14,41 @@ static GLuint load_and_link_program(const char *vertex_shader_filename, const ch
 static void   delete_program_and_shaders(GLuint program);
 static GLuint create_and_compile_shader(GLenum shader_type, const char *filename);
 static bool   gl_ext_present(const char *ext_name);
+static void   lookup_uniform_locations(drawable_p drawable);
+static bool   gl_error_occurred();
+#ifndef NDEBUG
+static void   debug_message_cb(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userdata);
+#endif
+
+// Incremented every time a buffer is destroyed. OpenGL reuses the names of deleted
+// buffers so a drawable can't tell by the name alone if its vertex array object
+// still points to the right buffer.
+static size_t buffer_generation = 0;
+
+// Sizes of all buffers and textures created by buffer_new() and texture_new(). Asking
+// OpenGL for them (glGetBufferParameteriv(), glGetTexLevelParameteriv()) can stall
+// until the driver catched up with the command stream.
+typedef struct {
+	GLint width, height;
+} texture_size_t, *texture_size_p;
+
+static hash_p buffer_sizes = NULL;
+static hash_p texture_sizes = NULL;
+
+#ifndef NDEBUG
+// Set when a KHR_debug callback reports errors, then we don't need to poll glGetError()
+static bool debug_output_enabled = false;
+#endif
 
 
 /**
  * The library requires some OpenGL extentions. This function checks if these are available. If not
  * an error message is printed to stderr for each missing extention.
  * 
+ * In debug builds (NDEBUG not defined) it also installs a KHR_debug message callback if the context
+ * supports it. OpenGL errors are then printed as they happen. Otherwise glGetError() is polled after
+ * each draw. Release builds don't check for errors at all.
+ * 
  * Returns whether the requirements are met or not.
  */
 bool check_required_gl_extentions(){
@@ -28,6 +57,10 @@ bool check_required_gl_extentions(){
 		"GL_ARB_texture_rectangle",
 		"GL_ARB_texture_storage",
 		"GL_ARB_framebuffer_object",
+		"GL_ARB_vertex_array_object",
+		// Used by drawable_new_instanced()
+		"GL_ARB_draw_instanced",
+		"GL_ARB_instanced_arrays",
 		NULL
 	};
 	
@@ -39,22 +72,48 @@ bool check_required_gl_extentions(){
 		}
 	}
 	
+	#ifndef NDEBUG
+	if ( gl_ext_present("GL_KHR_debug") ) {
+		glEnable(GL_DEBUG_OUTPUT);
+		// Report errors within the GL call that caused them so they show up in backtraces
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		glDebugMessageCallback(debug_message_cb, NULL);
+		debug_output_enabled = true;
+	}
+	#endif
+	
 	return requirements_met;
 }
 
 
 /**
- * Creates a new drawable object with the specified shaders loaded.
+ * Creates a new drawable object with the specified shaders loaded. The locations of all
+ * uniforms and of the `pos_and_tex` attribute are looked up right away so drawing doesn't
+ * need to ask the driver for them.
  * 
- * Returns the drawable on success or `NULL` on error (e.g. comiler error).
+ * Returns the drawable on success or `NULL` on error (e.g. comiler error or the program
+ * doesn't have a `pos_and_tex` attribute).
  */
 drawable_p drawable_new(GLenum primitive_type, const char* vertex_shader, const char* fragment_shader){
+	const char* vertex_attrib_name = "pos_and_tex";
+	const char* tex_uniform_name = "tex";
+	
 	drawable_p drawable = malloc(sizeof(drawable_t));
 	*drawable = (drawable_t){
 		.primitive_type = primitive_type,
 		.program = load_and_link_program(vertex_shader, fragment_shader),
 		.vertex_buffer = 0,
-		.texture = 0
+		.texture = 0,
+		.vertex_array = 0,
+		.vertex_array_buffer = 0,
+		.vertex_array_generation = 0,
+		.vertex_attrib = -1,
+		.uniforms = NULL,
+		.instance_attrib = -1,
+		.vertices_per_instance = 0,
+		.instance_count = 0,
+		.first_instance = 0,
+		.vertex_array_first_instance = 0
 	};
 	
 	if (drawable->program == 0){
@@ -62,6 +121,58 @@ drawable_p drawable_new(GLenum primitive_type, const char* vertex_shader, const
 		return NULL;
 	}
 	
+	drawable->vertex_attrib = glGetAttribLocation(drawable->program, vertex_attrib_name);
+	if (drawable->vertex_attrib == -1){
+		fprintf(stderr, "Program of %s and %s doesn't have the \"%s\" attribute!\n", vertex_shader, fragment_shader, vertex_attrib_name);
+		delete_program_and_shaders(drawable->program);
+		free(drawable);
+		return NULL;
+	}
+	
+	glGenVertexArrays(1, &drawable->vertex_array);
+	glBindVertexArray(drawable->vertex_array);
+		glEnableVertexAttribArray(drawable->vertex_attrib);
+	glBindVertexArray(0);
+	
+	lookup_uniform_locations(drawable);
+	
+	// Textures are always bound to slot 0, so set the sampler uniform only once
+	drawable_uniform_1i(drawable, tex_uniform_name, 0);
+	
+	return drawable;
+}
+
+/**
+ * Creates a drawable that draws `vertices_per_instance` vertices for every instance in
+ * its vertex buffer (e.g. 4 with GL_TRIANGLE_STRIP for a quad per instance). Each
+ * instance has 8 floats, passed as `pos_and_tex` and `instance_data` attributes. The
+ * vertex shader usually builds the vertices out of them and gl_VertexID.
+ * 
+ * Returns the drawable on success or `NULL` on error (e.g. the program doesn't have
+ * an `instance_data` attribute).
+ */
+drawable_p drawable_new_instanced(GLenum primitive_type, size_t vertices_per_instance, const char* vertex_shader, const char* fragment_shader){
+	const char* instance_attrib_name = "instance_data";
+	
+	drawable_p drawable = drawable_new(primitive_type, vertex_shader, fragment_shader);
+	if (drawable == NULL)
+		return NULL;
+	
+	drawable->instance_attrib = glGetAttribLocation(drawable->program, instance_attrib_name);
+	if (drawable->instance_attrib == -1){
+		fprintf(stderr, "Program of %s and %s doesn't have the \"%s\" attribute!\n", vertex_shader, fragment_shader, instance_attrib_name);
+		drawable_destroy(drawable);
+		return NULL;
+	}
+	drawable->vertices_per_instance = vertices_per_instance;
+	
+	// Both attributes advance once per instance instead of once per vertex
+	glBindVertexArray(drawable->vertex_array);
+		glEnableVertexAttribArray(drawable->instance_attrib);
+		glVertexAttribDivisor(drawable->vertex_attrib, 1);
+		glVertexAttribDivisor(drawable->instance_attrib, 1);
+	glBindVertexArray(0);
+	
 	return drawable;
 }
 
@@ -70,6 +181,11 @@ drawable_p drawable_new(GLenum primitive_type, const char* vertex_shader, const
  * the vertex buffer or texture set them to 0 first!
  */
 void drawable_destroy(drawable_p drawable){
+	for(dict_elem_t e = dict_start(drawable->uniforms); e != NULL; e = dict_next(drawable->uniforms, e))
+		free((char*)dict_key(e));
+	dict_destroy(drawable->uniforms);
+	
+	glDeleteVertexArrays(1, &drawable->vertex_array);
 	delete_program_and_shaders(drawable->program);
 	if (drawable->vertex_buffer)
 		buffer_destroy(drawable->vertex_buffer);
@@ -120,79 +236,112 @@ void drawable_begin_uniforms(drawable_p drawable){
  * passed to the shader via an attribute named `pos_and_tex`. The texture (if used) is passed via
  * a uniform named `tex`.
  * 
- * Returns `true` on success and `false` on error. In case the vertex attribute or texture uniform
- * is missing an error message is written to stderr. The texture uniform is only checked if a texture
- * is actually used.
+ * The vertex attribute setup is stored in the vertex array object of the drawable and only
+ * done again when a different vertex buffer is used.
+ * 
+ * Returns `true` on success and `false` on error.
  */
 bool drawable_draw(drawable_p drawable){
-	const char* vertex_attrib_name = "pos_and_tex";
-	const char* tex_uniform_name = "tex";
-	
 	glUseProgram(drawable->program);
-	
-	// Setup vertex data association for the draw call
-	GLint vertex_attrib = glGetAttribLocation(drawable->program, vertex_attrib_name);
-	if (vertex_attrib == -1){
-		fprintf(stderr, "Can't draw, program doesn't have the \"%s\" attribute!\n", vertex_attrib_name);
-		goto vertex_attr_failed;
+	glBindVertexArray(drawable->vertex_array);
+	
+	// Point the vertex array to the current vertex buffer if necessary. Instances
+	// have a second attribute right after `pos_and_tex`. Base instances need GL 4.2,
+	// so instances after the first one are drawn by starting the attributes later.
+	size_t vertex_size = (drawable->instance_attrib != -1) ? sizeof(float) * 8 : sizeof(float) * 4;
+	if (drawable->vertex_buffer != drawable->vertex_array_buffer || drawable->vertex_array_generation != buffer_generation || drawable->first_instance != drawable->vertex_array_first_instance) {
+		size_t offset = drawable->first_instance * vertex_size;
+		glBindBuffer(GL_ARRAY_BUFFER, drawable->vertex_buffer);
+		glVertexAttribPointer(drawable->vertex_attrib, 4, GL_FLOAT, GL_FALSE, vertex_size, (void*)offset);
+		if (drawable->instance_attrib != -1)
+			glVertexAttribPointer(drawable->instance_attrib, 4, GL_FLOAT, GL_FALSE, vertex_size, (void*)(offset + sizeof(float) * 4));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		
+		if ( gl_error_occurred() )
+			goto vertex_setup_failed;
+		
+		drawable->vertex_array_buffer = drawable->vertex_buffer;
+		drawable->vertex_array_generation = buffer_generation;
+		drawable->vertex_array_first_instance = drawable->first_instance;
 	}
 	
-	glBindBuffer(GL_ARRAY_BUFFER, drawable->vertex_buffer);
-	
-	size_t vertex_size = sizeof(float) * 4;
-	GLint vertex_buffer_size = 0;
-	glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &vertex_buffer_size);
-	
-	glEnableVertexAttribArray(vertex_attrib);
-	glVertexAttribPointer(vertex_attrib, 4, GL_FLOAT, GL_FALSE, vertex_size, 0);
-	GLenum error = glGetError();
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	if (error != GL_NO_ERROR)
-		goto vertex_setup_failed;
+	size_t vertex_buffer_size = buffer_size(drawable->vertex_buffer);
 	
 	// Bind texture to slot 0
 	if (drawable->texture) {
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_RECTANGLE, drawable->texture);
-		
-		GLint tex_attrib = glGetUniformLocation(drawable->program, tex_uniform_name);
-		if (tex_attrib == -1) {
-			fprintf(stderr, "Can't draw, program doesn't have the \"%s\" uniform (sampler)!\n", tex_uniform_name);
-			goto tex_attr_failed;
-		}
-		
-		glUniform1i(tex_attrib, 0);
 	}
 	
 	// Draw the vertecies
-	glDrawArrays(drawable->primitive_type, 0, vertex_buffer_size / vertex_size);
-	if (glGetError() != GL_NO_ERROR)
+	if (drawable->instance_attrib != -1)
+		glDrawArraysInstanced(drawable->primitive_type, 0, drawable->vertices_per_instance, drawable->instance_count);
+	else
+		glDrawArrays(drawable->primitive_type, 0, vertex_buffer_size / vertex_size);
+	if ( gl_error_occurred() )
 		goto draw_failed;
 	
 	// Cleanup time
 	if (drawable->texture)
 		glBindTexture(GL_TEXTURE_RECTANGLE, 0);
 	
-	glDisableVertexAttribArray(vertex_attrib);
+	glBindVertexArray(0);
 	glUseProgram(0);
 	
 	return true;
 	
 	draw_failed:
-	tex_attr_failed:
 		if (drawable->texture)
 			glBindTexture(GL_TEXTURE_RECTANGLE, 0);
 	vertex_setup_failed:
-		glDisableVertexAttribArray(vertex_attrib);
-	vertex_attr_failed:
+		glBindVertexArray(0);
 		glUseProgram(0);
 	
 	return false;
 }
 
 
+/**
+ * Returns the location of the uniform `name` or -1 if the program has no such uniform.
+ * The location is taken from the table built when the drawable was created, so this
+ * doesn't talk to the driver.
+ */
+GLint drawable_uniform_location(drawable_p drawable, const char* name){
+	GLint* location = dict_get_ptr(drawable->uniforms, name);
+	return (location) ? *location : -1;
+}
+
+/**
+ * Typed uniform setters. Each one activates the program of the drawable and sets the
+ * uniform using the cached location. Uniforms the program doesn't have (e.g. because
+ * the shader compiler optimized them away) are silently ignored.
+ */
+void drawable_uniform_1i(drawable_p drawable, const char* name, GLint value){
+	glUseProgram(drawable->program);
+	glUniform1i(drawable_uniform_location(drawable, name), value);
+}
+
+void drawable_uniform_1f(drawable_p drawable, const char* name, GLfloat value){
+	glUseProgram(drawable->program);
+	glUniform1f(drawable_uniform_location(drawable, name), value);
+}
+
+void drawable_uniform_2f(drawable_p drawable, const char* name, GLfloat x, GLfloat y){
+	glUseProgram(drawable->program);
+	glUniform2f(drawable_uniform_location(drawable, name), x, y);
+}
+
+void drawable_uniform_4f(drawable_p drawable, const char* name, GLfloat x, GLfloat y, GLfloat z, GLfloat w){
+	glUseProgram(drawable->program);
+	glUniform4f(drawable_uniform_location(drawable, name), x, y, z, w);
+}
+
+void drawable_uniform_mat3(drawable_p drawable, const char* name, const GLfloat* matrix){
+	glUseProgram(drawable->program);
+	glUniformMatrix3fv(drawable_uniform_location(drawable, name), 1, true, matrix);
+}
+
+
 /**
  * Creates a new vertex buffer with the specified size and initial data uploaded. The initial data
  * is uploaded with the GL_STATIC_DRAW usage, meant to be used for model data that does not change.
@@ -217,6 +366,10 @@ GLuint buffer_new(size_t size, const void* data){
 
 void buffer_destroy(GLuint buffer){
 	glDeleteBuffers(1, (const GLuint[]){ buffer });
+	buffer_generation++;
+	
+	if (buffer_sizes)
+		hash_remove(buffer_sizes, buffer);
 }
 
 /**
@@ -227,6 +380,29 @@ void buffer_update(GLuint buffer, size_t size, const void* data, GLenum usage){
 	glBindBuffer(GL_ARRAY_BUFFER, buffer);
 	glBufferData(GL_ARRAY_BUFFER, size, data, usage);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	if (buffer_sizes == NULL)
+		buffer_sizes = hash_of(size_t);
+	hash_put(buffer_sizes, buffer, size_t, size);
+}
+
+/**
+ * Overwrites `size` bytes of the buffer at `offset` without reallocating it. The range
+ * has to be within the size set by the last buffer_update().
+ */
+void buffer_update_part(GLuint buffer, size_t offset, size_t size, const void* data){
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * Returns the size of the buffer in bytes as set by the last buffer_update(). Doesn't
+ * talk to the driver. Unknown buffers (e.g. not created by buffer_new()) have a size of 0.
+ */
+size_t buffer_size(GLuint buffer){
+	size_t* size = (buffer_sizes) ? hash_get_ptr(buffer_sizes, buffer) : NULL;
+	return (size) ? *size : 0;
 }
 
 
@@ -246,11 +422,30 @@ GLuint texture_new(size_t width, size_t height, GLenum format){
 	glTexStorage2D(GL_TEXTURE_RECTANGLE, 1, format, width, height);
 	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
 	
+	if (texture_sizes == NULL)
+		texture_sizes = hash_of(texture_size_t);
+	hash_put(texture_sizes, texture, texture_size_t, ((texture_size_t){ width, height }));
+	
 	return texture;
 }
 
 void texture_destroy(GLuint texture){
 	glDeleteTextures(1, (const GLuint[]){ texture });
+	
+	if (texture_sizes)
+		hash_remove(texture_sizes, texture);
+}
+
+/**
+ * Looks up the size of a texture created by texture_new() without asking the driver.
+ * 
+ * Returns `false` if the texture is unknown, `width` and `height` are set to 0 then.
+ */
+bool texture_size(GLuint texture, GLint* width, GLint* height){
+	texture_size_p size = (texture_sizes) ? hash_get_ptr(texture_sizes, texture) : NULL;
+	*width  = (size) ? size->width  : 0;
+	*height = (size) ? size->height : 0;
+	return (size != NULL);
 }
 
 /**
@@ -259,28 +454,25 @@ void texture_destroy(GLuint texture){
  * of components per pixel, e.g. GL_RED or GL_RGBA. See `glTexSubImage2D()` for full format list.
  */
 void texture_update(GLuint texture, GLenum format, const void* data){
-	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
-	
 	GLint width = 0, height = 0;
-	glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_WIDTH, &width);
-	glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_HEIGHT, &height);
+	texture_size(texture, &width, &height);
 	
+	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
 	glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
 	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
 }
 
 void texture_update_part(GLuint texture, GLenum format, const void* data, GLint x, GLint y, GLsizei width, GLsizei height, GLint pitch) {
 	// We leave GL_UNPACK_ALIGNMENT at the default value of 4. This magically fixes up pitches that
-	// don't fall onto pixel borders.
-	GLint row_length = 0;
-	glGetIntegerv(GL_UNPACK_ROW_LENGTH, &row_length);
+	// don't fall onto pixel borders. GL_UNPACK_ROW_LENGTH is reset to its default of 0 afterwards
+	// (instead of asking OpenGL for the previous value).
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
 	
 	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
 	glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
 	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
 	
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
 
@@ -330,6 +522,37 @@ static GLuint load_and_link_program(const char *vertex_shader_filename, const ch
 }
 
 
+/**
+ * Builds the uniform name to location table of the drawable. Uniform arrays are reported
+ * as "name[0]" by OpenGL, they're stored under their plain name.
+ */
+static void lookup_uniform_locations(drawable_p drawable){
+	drawable->uniforms = dict_of(GLint);
+	
+	GLint uniform_count = 0;
+	glGetProgramiv(drawable->program, GL_ACTIVE_UNIFORMS, &uniform_count);
+	
+	for(ssize_t i = 0; i < uniform_count; i++){
+		char name[256];
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(drawable->program, i, sizeof(name), NULL, &size, &type, name);
+		
+		char* array_suffix = strstr(name, "[0]");
+		if (array_suffix)
+			*array_suffix = '\0';
+		
+		GLint location = glGetUniformLocation(drawable->program, name);
+		if (location == -1)
+			continue;
+		
+		size_t name_size = strlen(name) + 1;
+		char* key = malloc(name_size);
+		memcpy(key, name, name_size);
+		dict_put(drawable->uniforms, key, GLint, location);
+	}
+}
+
 /**
  * Destorys the specified program and all shaders attached to it.
  */
@@ -379,6 +602,30 @@ static GLuint create_and_compile_shader(GLenum shader_type, const char *filename
 }
 
 
+/**
+ * Returns `true` if OpenGL reported an error since the last check. Only polls glGetError() in
+ * debug builds without a KHR_debug callback. With the callback errors are already printed by it
+ * and release builds skip the check to avoid the driver round trip.
+ */
+static bool gl_error_occurred(){
+	#ifdef NDEBUG
+		return false;
+	#else
+		return !debug_output_enabled && glGetError() != GL_NO_ERROR;
+	#endif
+}
+
+#ifndef NDEBUG
+static void debug_message_cb(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userdata){
+	// Notifications are mostly driver chatter about buffer placement and such
+	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+		return;
+	
+	fprintf(stderr, "OpenGL %s: %.*s\n", (type == GL_DEBUG_TYPE_ERROR) ? "error" : "debug message", (int)length, message);
+}
+#endif
+
+
 /**
  * Checks if an OpenGL extention is avaialbe.
  */
@@ -406,10 +653,7 @@ fbo_p fbo_new(GLuint target_texture) {
 	glGenFramebuffers(1, &fbo->fbo);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo->fbo);
 	
-	glBindTexture(GL_TEXTURE_RECTANGLE, target_texture);
-		glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_WIDTH, &fbo->width);
-		glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_HEIGHT, &fbo->height);
-	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	texture_size(target_texture, &fbo->width, &fbo->height);
 	
 	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, target_texture, 0);
 	GLenum error = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
@@ -446,4 +690,116 @@ void fbo_read(fbo_p fbo, GLenum format, GLenum type, void* data) {
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo->fbo);
 	glReadPixels(0, 0, fbo->width, fbo->height, format, type, data);
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-}
\ No newline at end of file
+}
+
+//
+// GPU timer
+//
+
+/**
+ * Creates a new GPU timer. Needs the GL_ARB_timer_query extension (part of OpenGL 3.3).
+ * 
+ * Returns `NULL` if the extension isn't available. All other gpu_timer functions accept
+ * a `NULL` timer and do nothing in that case, so profiling is simply off on such drivers.
+ */
+gpu_timer_p gpu_timer_new() {
+	if ( !gl_ext_present("GL_ARB_timer_query") ) {
+		fprintf(stderr, "GL_ARB_timer_query not available, GPU times won't be measured\n");
+		return NULL;
+	}
+	
+	gpu_timer_p timer = calloc(1, sizeof(gpu_timer_t));
+	glGenQueries(GPU_TIMER_FRAMES * (GPU_TIMER_MAX_STAGES + 1), &timer->queries[0][0]);
+	return timer;
+}
+
+void gpu_timer_destroy(gpu_timer_p timer) {
+	if (timer == NULL)
+		return;
+	
+	glDeleteQueries(GPU_TIMER_FRAMES * (GPU_TIMER_MAX_STAGES + 1), &timer->queries[0][0]);
+	free(timer);
+}
+
+/**
+ * Reads back the results of all frames the GPU finished and starts a new frame. Never
+ * waits for the GPU: if the results of the oldest frame aren't available yet they're
+ * left for the next call. When all frames of the ring are still in flight the new frame
+ * isn't measured at all (counted in `skipped_frames`).
+ * 
+ * Returns `true` if the results in the timer were updated.
+ */
+bool gpu_timer_begin_frame(gpu_timer_p timer) {
+	if (timer == NULL)
+		return false;
+	
+	bool new_results = false;
+	while (timer->tail < timer->head) {
+		size_t slot = timer->tail % GPU_TIMER_FRAMES;
+		size_t count = timer->query_count[slot];
+		
+		// The queries of a frame finish in order, so the last one tells us if all are done
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(timer->queries[slot][count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		
+		GLuint64 timestamps[GPU_TIMER_MAX_STAGES + 1];
+		for(size_t i = 0; i < count; i++)
+			glGetQueryObjectui64v(timer->queries[slot][i], GL_QUERY_RESULT, &timestamps[i]);
+		
+		timer->stage_count = count - 1;
+		for(size_t i = 0; i < timer->stage_count; i++) {
+			timer->stage_names[i] = timer->query_names[slot][i];
+			timer->stage_ms[i] = (timestamps[i+1] - timestamps[i]) / 1000000.0;
+		}
+		timer->total_ms = (timestamps[count - 1] - timestamps[0]) / 1000000.0;
+		timer->frames_late = timer->frame - timer->query_frame[slot];
+		
+		timer->tail++;
+		new_results = true;
+	}
+	timer->queue_depth = timer->head - timer->tail;
+	
+	timer->frame++;
+	if (timer->head - timer->tail < GPU_TIMER_FRAMES) {
+		size_t slot = timer->head % GPU_TIMER_FRAMES;
+		glQueryCounter(timer->queries[slot][0], GL_TIMESTAMP);
+		timer->query_count[slot] = 1;
+		timer->query_frame[slot] = timer->frame;
+		timer->in_frame = true;
+	} else {
+		timer->skipped_frames++;
+		timer->in_frame = false;
+	}
+	
+	return new_results;
+}
+
+/**
+ * Marks the end of a stage. The stage starts at the previous mark or the start of the
+ * frame. `stage_name` isn't copied, use string literals.
+ */
+void gpu_timer_mark(gpu_timer_p timer, const char* stage_name) {
+	if (timer == NULL || !timer->in_frame)
+		return;
+	
+	size_t slot = timer->head % GPU_TIMER_FRAMES;
+	size_t count = timer->query_count[slot];
+	if (count > GPU_TIMER_MAX_STAGES)
+		return;
+	
+	glQueryCounter(timer->queries[slot][count], GL_TIMESTAMP);
+	timer->query_names[slot][count - 1] = stage_name;
+	timer->query_count[slot]++;
+}
+
+void gpu_timer_end_frame(gpu_timer_p timer) {
+	if (timer == NULL || !timer->in_frame)
+		return;
+	
+	// Frames without any stage have nothing to report
+	if (timer->query_count[timer->head % GPU_TIMER_FRAMES] > 1)
+		timer->head++;
+	timer->in_frame = false;
+}
@@ -1,15 +1,36 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 
+#include "hash.h"
+
 
 typedef struct {
 	GLenum primitive_type;
 	GLuint program;
 	GLuint vertex_buffer;
 	GLuint texture;
+	
+	// Internal state setup by drawable_new(). The vertex array object remembers the
+	// vertex attribute setup so it's only done again when the vertex buffer changes.
+	GLuint vertex_array;
+	GLuint vertex_array_buffer;
+	size_t vertex_array_generation;
+	GLint  vertex_attrib;
+	// Maps uniform names to their locations, filled right after linking
+	dict_p uniforms;
+	
+	// Only used by drawables created with drawable_new_instanced(). The vertex buffer
+	// contains `pos_and_tex` and `instance_data` (4 floats each) per instance and
+	// `vertices_per_instance` vertices are drawn for `instance_count` instances starting
+	// at `first_instance` (0 unless set, e.g. to draw a part of a ring buffer).
+	GLint  instance_attrib;
+	size_t vertices_per_instance, instance_count, first_instance;
+	size_t vertex_array_first_instance;
 } drawable_t, *drawable_p;
 
 typedef struct {
@@ -17,6 +38,35 @@ typedef struct {
 	GLint width, height;
 } fbo_t, *fbo_p;
 
+// Measures how long the GPU takes for the stages of a frame. A timestamp query is put
+// into the command stream at the start of a frame and after each stage. The results
+// are read back later without waiting for the GPU, so they're a few frames old.
+#define GPU_TIMER_MAX_STAGES 8
+#define GPU_TIMER_FRAMES     4
+
+typedef struct {
+	// Ring of frames in flight. Frames are started at `head` and read back at `tail`,
+	// both only count up.
+	GLuint      queries[GPU_TIMER_FRAMES][GPU_TIMER_MAX_STAGES + 1];
+	const char* query_names[GPU_TIMER_FRAMES][GPU_TIMER_MAX_STAGES];
+	size_t      query_count[GPU_TIMER_FRAMES];
+	uint64_t    query_frame[GPU_TIMER_FRAMES];
+	size_t      head, tail;
+	bool        in_frame;
+	uint64_t    frame;
+	
+	// Results of the last frame the GPU finished
+	const char* stage_names[GPU_TIMER_MAX_STAGES];
+	double      stage_ms[GPU_TIMER_MAX_STAGES];
+	size_t      stage_count;
+	double      total_ms;
+	// How many frames ago the results were submitted and how many frames were still
+	// queued up in the GPU when they were read
+	size_t      frames_late, queue_depth;
+	// Frames that weren't measured because all queries were still in flight
+	size_t      skipped_frames;
+} gpu_timer_t, *gpu_timer_p;
+
 
 /**
 
@@ -32,8 +82,8 @@ d->vertex_buffer = buffer_new(...);
 d->texture = texture_new(...);
 texture_update(d->texture, ...);
 
-drawable_begin_uniforms(d);
-// do uniforms...
+drawable_uniform_1f(d, "alpha", 0.5);
+drawable_uniform_mat3(d, "transform", matrix);
 drawable_draw(d);
 
 
@@ -44,18 +94,30 @@ drawable_destroy(d);
 bool        check_required_gl_extentions();
 
 drawable_p  drawable_new(GLenum primitive_type, const char* vertex_shader, const char* fragment_shader);
+drawable_p  drawable_new_instanced(GLenum primitive_type, size_t vertices_per_instance, const char* vertex_shader, const char* fragment_shader);
 void        drawable_destroy(drawable_p drawable);
 void        drawable_begin_uniforms(drawable_p drawable);
 bool        drawable_draw(drawable_p drawable);
 
+GLint       drawable_uniform_location(drawable_p drawable, const char* name);
+void        drawable_uniform_1i(drawable_p drawable, const char* name, GLint value);
+void        drawable_uniform_1f(drawable_p drawable, const char* name, GLfloat value);
+void        drawable_uniform_2f(drawable_p drawable, const char* name, GLfloat x, GLfloat y);
+void        drawable_uniform_4f(drawable_p drawable, const char* name, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+// The matrix is expected in row major order (like you would write it down in C)
+void        drawable_uniform_mat3(drawable_p drawable, const char* name, const GLfloat* matrix);
+
 void        drawable_program_inspect(GLuint program);
 
 GLuint      buffer_new(size_t size, const void* data);
 void        buffer_destroy(GLuint buffer);
 void        buffer_update(GLuint buffer, size_t size, const void* data, GLenum usage);
+void        buffer_update_part(GLuint buffer, size_t offset, size_t size, const void* data);
+size_t      buffer_size(GLuint buffer);
 
 GLuint      texture_new(size_t width, size_t height, GLenum format);
 void        texture_destroy(GLuint texture);
+bool        texture_size(GLuint texture, GLint* width, GLint* height);
 void        texture_update(GLuint texture, GLenum format, const void* data);
 void        texture_update_part(GLuint texture, GLenum format, const void* data, GLint x, GLint y, GLsizei width, GLsizei height, GLint pitch);
 
@@ -63,4 +125,11 @@ fbo_p       fbo_new(GLuint target_texture);
 void        fbo_destroy(fbo_p fbo);
 // Pass NULL to unbind FBO
 void        fbo_bind(fbo_p fbo);
-void        fbo_read(fbo_p fbo, GLenum format, GLenum type, void* data);
\ No newline at end of file
+void        fbo_read(fbo_p fbo, GLenum format, GLenum type, void* data);
+
+gpu_timer_p gpu_timer_new();
+void        gpu_timer_destroy(gpu_timer_p timer);
+// Returns true if results of a new frame are available
+bool        gpu_timer_begin_frame(gpu_timer_p timer);
+void        gpu_timer_mark(gpu_timer_p timer, const char* stage_name);
+void        gpu_timer_end_frame(gpu_timer_p timer);
\ No newline at end of file
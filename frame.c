@@ -0,0 +1,73 @@
+#include <stdlib.h>
+
+#include "frame.h"
+
+
+// The frame struct is stored at the start of the pooled block, the data follows
+// aligned to 16 bytes
+#define FRAME_HEADER_SIZE  ( (sizeof(frame_t) + 15) & ~(size_t)15 )
+
+
+frame_pool_p frame_pool_new() {
+	frame_pool_p pool = malloc(sizeof(frame_pool_t));
+	if (pool == NULL)
+		return NULL;
+	
+	pool->buffers = buffer_pool_new();
+	if (pool->buffers == NULL)
+		return free(pool), NULL;
+	
+	pthread_mutex_init(&pool->lock, NULL);
+	
+	return pool;
+}
+
+/**
+ * Frees all frames of the pool, including frames that are still referenced.
+ */
+void frame_pool_destroy(frame_pool_p pool) {
+	buffer_pool_destroy(pool->buffers);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/**
+ * Returns a new frame with `size` bytes of uninitialized data and a refcount of 1.
+ * Returns `NULL` if the allocation failed.
+ */
+frame_p frame_new(frame_pool_p pool, frame_format_t format, size_t size) {
+	pthread_mutex_lock(&pool->lock);
+		frame_p frame = buffer_pool_alloc(pool->buffers, FRAME_HEADER_SIZE + size);
+	pthread_mutex_unlock(&pool->lock);
+	if (frame == NULL)
+		return NULL;
+	
+	*frame = (frame_t){
+		.ptr      = (uint8_t*)frame + FRAME_HEADER_SIZE,
+		.size     = size,
+		.format   = format,
+		.refcount = 1,
+		.pool     = pool
+	};
+	
+	return frame;
+}
+
+frame_p frame_ref(frame_p frame) {
+	__atomic_add_fetch(&frame->refcount, 1, __ATOMIC_RELAXED);
+	return frame;
+}
+
+void frame_unref(frame_p frame) {
+	if (frame == NULL)
+		return;
+	
+	// Acquire makes sure all accesses of other threads are done before we reuse the frame
+	if ( __atomic_sub_fetch(&frame->refcount, 1, __ATOMIC_ACQ_REL) != 0 )
+		return;
+	
+	frame_pool_p pool = frame->pool;
+	pthread_mutex_lock(&pool->lock);
+		buffer_pool_free(pool->buffers, frame);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/**
+
+# Refcounted frames
+
+A frame is a block of video or audio data together with its metadata. Frames are
+taken from a frame pool and handed between subsystems by reference instead of
+copying the data. Whoever wants to keep a frame around takes a reference with
+frame_ref() and drops it with frame_unref() when done. The frame goes back to its
+pool when the last reference is dropped.
+
+frame_pool_p pool = frame_pool_new();
+
+frame_p frame = frame_new(pool, FRAME_FORMAT_YUY2, 640*480*2);
+frame->width = 640;
+frame->height = 480;
+frame->timestamp = timecode;
+// ... fill frame->ptr
+
+server_enqueue_frame(1, frame);  // Server takes its own reference
+frame_unref(frame);              // Frame stays alive until the server is done with it
+
+frame_pool_destroy(pool);
+
+
+The refcount is atomic so frames can be passed between threads. The pool itself
+is protected by a mutex.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+
+typedef enum {
+	FRAME_FORMAT_NONE = 0,
+	// Packed 4:2:2 YUV, 2 bytes per pixel
+	FRAME_FORMAT_YUY2,
+	// Interleaved signed 16 bit little endian samples
+	FRAME_FORMAT_PCM_S16LE
+} frame_format_t;
+
+typedef struct frame_pool_s frame_pool_t, *frame_pool_p;
+
+typedef struct {
+	void*    ptr;
+	size_t   size;
+	
+	frame_format_t format;
+	// Only set for video frames
+	uint16_t width, height;
+	// Timecode of the stream in µs
+	uint64_t timestamp;
+	// CLOCK_MONOTONIC time (µs) the frame was captured, 0 if unknown
+	uint64_t capture_time;
+	
+	uint32_t refcount;
+	frame_pool_p pool;
+} frame_t, *frame_p;
+
+struct frame_pool_s {
+	buffer_pool_p buffers;
+	pthread_mutex_t lock;
+};
+
+
+frame_pool_p frame_pool_new();
+void         frame_pool_destroy(frame_pool_p pool);
+
+frame_p      frame_new(frame_pool_p pool, frame_format_t format, size_t size);
+frame_p      frame_ref(frame_p frame);
+void         frame_unref(frame_p frame);
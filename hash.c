@@ -5,15 +5,31 @@
 #include <stdio.h>
 #include "hash.h"
 
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
 /**
- * The hash table consists of slots. Each slot can be empty, deleted or occupied.
- * Occupied slots are "elements", the things users insert into the hash table and
- * work with.
+ * The hash table consists of slots and a control byte for each slot. Each slot can
+ * be empty, deleted or occupied. Occupied slots are "elements", the things users
+ * insert into the hash table and work with.
+ * 
+ * The control bytes are in their own array in front of the slots:
+ * 
+ *   | 0x80       |  Empty slot
+ *   | 0xFE       |  Deleted slot (tombstone)
+ *   | 0b0hhhhhhh |  Occupied slot, the lower 7 bits are the lower 7 bits of the hash (h2)
+ * 
+ * The capacity is a power of two (at least 16) and the control bytes are grouped into
+ * groups of 16 bytes. A lookup starts at the group selected by the upper bits of the
+ * hash (h1) and compares all 16 control bytes of a group with h2 at once (SSE2). Only
+ * slots with a matching control byte are looked at. If a group contains an empty slot
+ * the key isn't in the table, otherwise the next group is probed (triangular probing
+ * over the groups, visits every group once).
  * 
  * Each slot has the following layout:
  * 
- *   | unified_hash_hash_t              |  The 32 or 64 bit hash for this slots value (0 == empty, UINT??_MAX == deleted)
- *   | hash_num_key_t or const char *   |  The original key for this slot
+ *   | hash_key_t or const char *       |  The original key for this slot
  *   | hash->value_size number of bytes |  Value bytes of the slot (size differs per hashmap)
  * 
  * Since the layout and field types depend on the hash there is no C struct representing
@@ -24,67 +40,60 @@
  * to track the key size since it doesn't differ between integer and string keys. This
  * allows that we can get the key out of a slot without having to look at the hashmap
  * itself.
+ * 
+ * Deleted slots only become tombstones if their group is full. If a group has an empty
+ * slot no lookup ever probed past it, so the slot can just be marked as empty again.
+ * Removing never moves elements or shrinks the table, so elements can be removed while
+ * iterating. Call hash_resize() to shrink a table after removing many elements.
  */
 
-// Define platform dependend types and functions
-#if defined(__x86_64__) || defined(__ppc64__) || defined(_WIN64)
-	#define UNIFIED_HASH_64BIT
-	typedef uint64_t unified_hash_hash_t;
-	
-	static uint64_t int64_hash64(int64_t key);
-	static uint64_t string_hash64(const char* key);
-	
-	#define int_hash(key)     int64_hash64(key)
-	#define string_hash(key)  string_hash64(key)
-#else
-	typedef uint32_t unified_hash_hash_t;
-	
-	#define int_hash(key)     int32_hash32(key)
-	#define string_hash(key)  string_hash32(key)
-	
-	static uint32_t int32_hash32(int32_t key);
-	static uint32_t string_hash32(const char* key);
-#endif
-
 // Values of the hash_t `key_type` field
 #define UNIFIED_HASH_NUMERIC_KEYS  0
 #define UNIFIED_HASH_STRING_KEYS   1
 
-// Special hash values
-#define UNIFIED_HASH_SLOT_FREE     0
-#define UNIFIED_HASH_SLOT_DELETED  UINT64_MAX
+// Control bytes
+#define CTRL_EMPTY    ((uint8_t)0x80)
+#define CTRL_DELETED  ((uint8_t)0xFE)
+#define GROUP_SIZE    16
+
+// At most 7/8 of the slots are occupied or deleted, then the table grows
+#define max_load(capacity)   ( (capacity) - (capacity) / 8 )
 
 // Macros for slot access
-#define slot_hash_size()     sizeof(unified_hash_hash_t)
 #define slot_key_size()      sizeof(const char *)
-#define slot_size(hash)      ( slot_hash_size() + slot_key_size() + hash->value_size )
+#define slot_size(hash)      ( slot_key_size() + hash->value_size )
 
-#define slot_ptr(hash, index)       ( (void*)                ( (char*)hash->slots + slot_size(hash) * (index)   ) )
-#define slot_hash_ptr(slot)         ( (unified_hash_hash_t*) ( slot                                             ) )
-#define slot_key_ptr(slot, type)    ( (type*)                ( (char*)slot + slot_hash_size()                   ) )
-#define slot_value_ptr(slot)        ( (void*)                ( (char*)slot + slot_hash_size() + slot_key_size() ) )
+#define slot_ptr(hash, index)       ( (void*)  ( (char*)hash->slots + slot_size(hash) * (index) ) )
+#define slot_index(hash, slot)      ( ((char*)(slot) - (char*)hash->slots) / slot_size(hash) )
+#define slot_key_ptr(slot, type)    ( (type*)  ( (char*)slot                   ) )
+#define slot_value_ptr(slot)        ( (void*)  ( (char*)slot + slot_key_size() ) )
+
+// Bit masks of the slots in a group that match a control byte (bit i = slot i of the group)
+static uint32_t group_match(const uint8_t* group, uint8_t ctrl);
+static uint32_t group_match_empty_or_deleted(const uint8_t* group);
+
+static uint64_t int_hash(uint64_t key);
+static uint64_t string_hash(const char* key);
 
 // Internal implementation functions that work for hash and dict (thus "unified hash")
 static unified_hash_p unified_hash_new(size_t capacity, size_t value_size, uint8_t key_type);
 static void           unified_hash_destroy(unified_hash_p hash);
-static ssize_t        unified_hash_search(unified_hash_p hashmap, int64_t int_key, const char* string_key, uint64_t hash);
+static bool           unified_hash_alloc(unified_hash_p hash, size_t capacity);
+static ssize_t        unified_hash_search(unified_hash_p hashmap, hash_key_t int_key, const char* string_key, uint64_t hash);
+static size_t         unified_hash_find_free_slot(unified_hash_p hashmap, uint64_t hash);
 
-static void*          unified_hash_get_ptr(unified_hash_p hashmap, int64_t int_key, const char* string_key);
-static void*          unified_hash_put_ptr(unified_hash_p hashmap, int64_t int_key, const char* string_key);
-static void           unified_hash_remove(hash_p hashmap, int64_t int_key, const char* string_key);
+static void*          unified_hash_get_ptr(unified_hash_p hashmap, hash_key_t int_key, const char* string_key);
+static void*          unified_hash_put_ptr(unified_hash_p hashmap, hash_key_t int_key, const char* string_key);
+static void           unified_hash_remove(hash_p hashmap, hash_key_t int_key, const char* string_key);
 static void           unified_hash_remove_elem(hash_p hashmap, void* element);
-static bool           unified_hash_contains(hash_p hashmap, int64_t int_key, const char* string_key);
+static bool           unified_hash_contains(hash_p hashmap, hash_key_t int_key, const char* string_key);
 
 static void*          unified_hash_start(unified_hash_p hashmap);
 static void*          unified_hash_next(unified_hash_p hashmap, void* element);
-static void*          unified_hash_element_at_or_after_slot(unified_hash_p hash, void* slot);
+static void*          unified_hash_element_at_or_after_index(unified_hash_p hash, size_t index);
 
 static void           unified_hash_resize(unified_hash_p hash, size_t new_capacity);
 
-// Prime functions
-       size_t         snap_to_prime(size_t x);
-static bool           is_prime(size_t x);
-
 
 //
 // Mapping from the hash or dict specific functions to the unified hash functions
@@ -132,14 +141,11 @@ static unified_hash_p unified_hash_new(size_t capacity, size_t value_size, uint8
 	if (hash == NULL)
 		return NULL;
 	
-	hash->capacity = capacity;
-	hash->length = 0;
 	// slot_size() uses key_type and value_size, so assign them first
 	hash->key_type = key_type;
 	hash->value_size = value_size;
-	hash->slots = calloc(hash->capacity, slot_size(hash));
 	
-	if (hash->slots == NULL){
+	if ( !unified_hash_alloc(hash, capacity) ){
 		free(hash);
 		return NULL;
 	}
@@ -148,10 +154,35 @@ static unified_hash_p unified_hash_new(size_t capacity, size_t value_size, uint8
 }
 
 static void unified_hash_destroy(unified_hash_p hash){
-	free(hash->slots);
+	free(hash->ctrl);
 	free(hash);
 }
 
+/**
+ * Allocates empty control bytes and slots for at least `capacity` slots (rounded up to a
+ * power of two, at least one group). The control bytes and the slots are one memory
+ * block. Leaves the hash untouched and returns `false` if the allocation failed.
+ */
+static bool unified_hash_alloc(unified_hash_p hash, size_t capacity){
+	size_t pow2_capacity = GROUP_SIZE;
+	while (pow2_capacity < capacity)
+		pow2_capacity *= 2;
+	
+	// The control bytes are a multiple of 16 bytes so the slots are properly aligned
+	uint8_t* block = malloc(pow2_capacity + pow2_capacity * slot_size(hash));
+	if (block == NULL)
+		return false;
+	memset(block, CTRL_EMPTY, pow2_capacity);
+	
+	hash->ctrl = block;
+	hash->slots = block + pow2_capacity;
+	hash->capacity = pow2_capacity;
+	hash->length = 0;
+	hash->deleted = 0;
+	
+	return true;
+}
+
 
 //
 // Lookup, get and put functions
@@ -161,28 +192,20 @@ static void unified_hash_destroy(unified_hash_p hash){
  * Search the hashmap for the specified key.
  * 
  * Return value >= 0: The key has been found and it's index is returned.
- * Return value <= -1: The key was not found. The index of a free slot -1 is returned
- *   as a negative number. This is either the first free slot in the probing sequence
- *   or the first slot marked as deleted.
+ * Return value == -1: The key was not found.
  */
-static ssize_t unified_hash_search(unified_hash_p hashmap, hash_key_t int_key, const char* string_key, unified_hash_hash_t hash){
-	unified_hash_hash_t hash_at_index;
-	size_t index = hash % hashmap->capacity;
-	size_t probe_offset = 1;
-	ssize_t first_deleted_index = -1;
+static ssize_t unified_hash_search(unified_hash_p hashmap, hash_key_t int_key, const char* string_key, uint64_t hash){
+	size_t mask = hashmap->capacity - 1;
+	size_t group_index = (hash >> 7) & mask & ~(size_t)(GROUP_SIZE - 1);
+	uint8_t h2 = hash & 0x7F;
 	
-	while(true) {
-		void* slot = slot_ptr(hashmap, index);
-		hash_at_index = *slot_hash_ptr(slot);
+	for(size_t step = GROUP_SIZE; true; step += GROUP_SIZE) {
+		const uint8_t* group = hashmap->ctrl + group_index;
 		
-		if (first_deleted_index == -1 && hash_at_index == UNIFIED_HASH_SLOT_DELETED) {
-			first_deleted_index = index;
-		} else if (hash_at_index == UNIFIED_HASH_SLOT_FREE) {
-			if (first_deleted_index != -1)
-				return -(first_deleted_index + 1);
-			else
-				return -(index + 1);
-		} else if ( hash_at_index == hash ) {
+		for(uint32_t matches = group_match(group, h2); matches != 0; matches &= matches - 1) {
+			size_t index = group_index + __builtin_ctz(matches);
+			void* slot = slot_ptr(hashmap, index);
+			
 			if (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) {
 				if ( *slot_key_ptr(slot, hash_key_t) == int_key )
 					return index;
@@ -192,13 +215,34 @@ static ssize_t unified_hash_search(unified_hash_p hashmap, hash_key_t int_key, c
 			}
 		}
 		
-		index = (index + probe_offset * probe_offset) % hashmap->capacity;
-		probe_offset++;
+		// An empty slot in the group ends the probe sequence of all keys that start here
+		if ( group_match(group, CTRL_EMPTY) != 0 )
+			return -1;
+		
+		// Triangular probing visits every group once (the group count is a power of two)
+		group_index = (group_index + step) & mask;
+	}
+}
+
+/**
+ * Returns the index of the first empty or deleted slot in the probe sequence of
+ * `hash`. The table must not be full (the load limit ensures that).
+ */
+static size_t unified_hash_find_free_slot(unified_hash_p hashmap, uint64_t hash){
+	size_t mask = hashmap->capacity - 1;
+	size_t group_index = (hash >> 7) & mask & ~(size_t)(GROUP_SIZE - 1);
+	
+	for(size_t step = GROUP_SIZE; true; step += GROUP_SIZE) {
+		uint32_t free_slots = group_match_empty_or_deleted(hashmap->ctrl + group_index);
+		if (free_slots != 0)
+			return group_index + __builtin_ctz(free_slots);
+		
+		group_index = (group_index + step) & mask;
 	}
 }
 
 static void* unified_hash_get_ptr(unified_hash_p hashmap, hash_key_t int_key, const char* string_key){
-	unified_hash_hash_t hash = (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(int_key) : string_hash(string_key);
+	uint64_t hash = (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(int_key) : string_hash(string_key);
 	ssize_t index = unified_hash_search(hashmap, int_key, string_key, hash);
 	if (index < 0)
 		return NULL;
@@ -206,52 +250,61 @@ static void* unified_hash_get_ptr(unified_hash_p hashmap, hash_key_t int_key, co
 }
 
 static void* unified_hash_put_ptr(unified_hash_p hashmap, hash_key_t int_key, const char* string_key){
-	if (hashmap->length + 1 > hashmap->capacity * 0.75)
-		unified_hash_resize(hashmap, snap_to_prime(hashmap->capacity * 2));
-	
-	unified_hash_hash_t hash = (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(int_key) : string_hash(string_key);
+	uint64_t hash = (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(int_key) : string_hash(string_key);
 	ssize_t index = unified_hash_search(hashmap, int_key, string_key, hash);
-	void* slot = NULL;
+	if (index >= 0)
+		return slot_value_ptr(slot_ptr(hashmap, index));
 	
-	if (index < 0) {
-		// Key wasn't found. The return value is -(next_free_index + 1).
-		index = -index - 1;
-		slot = slot_ptr(hashmap, index);
-		
-		*slot_hash_ptr(slot) = hash;
-		if (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS)
-			*slot_key_ptr(slot, hash_key_t) = int_key;
+	// Key wasn't found, make room for it. If most of the used slots are tombstones
+	// rehashing at the same capacity is enough to get rid of them.
+	if (hashmap->length + hashmap->deleted + 1 > max_load(hashmap->capacity)) {
+		if (hashmap->deleted > hashmap->capacity / 4)
+			unified_hash_resize(hashmap, hashmap->capacity);
 		else
-			*slot_key_ptr(slot, const char *) = string_key;
-		hashmap->length++;
-	} else {
-		slot = slot_ptr(hashmap, index);
+			unified_hash_resize(hashmap, hashmap->capacity * 2);
 	}
 	
+	index = unified_hash_find_free_slot(hashmap, hash);
+	if (hashmap->ctrl[index] == CTRL_DELETED)
+		hashmap->deleted--;
+	hashmap->ctrl[index] = hash & 0x7F;
+	hashmap->length++;
+	
+	void* slot = slot_ptr(hashmap, index);
+	if (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS)
+		*slot_key_ptr(slot, hash_key_t) = int_key;
+	else
+		*slot_key_ptr(slot, const char *) = string_key;
+	
 	return slot_value_ptr(slot);
 }
 
-void unified_hash_remove(hash_p hashmap, hash_key_t int_key, const char* string_key){
-	unified_hash_hash_t hash = (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(int_key) : string_hash(string_key);
+static void unified_hash_remove(hash_p hashmap, hash_key_t int_key, const char* string_key){
+	uint64_t hash = (hashmap->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(int_key) : string_hash(string_key);
 	ssize_t index = unified_hash_search(hashmap, int_key, string_key, hash);
 	
 	if (index < 0)
 		return;
 	
-	void* slot = slot_ptr(hashmap, index);
-	*slot_hash_ptr(slot) = UNIFIED_HASH_SLOT_DELETED;
-	hashmap->length--;
-	
-	if (hashmap->length < hashmap->capacity * 0.2)
-		unified_hash_resize(hashmap, snap_to_prime(hashmap->capacity / 2));
+	unified_hash_remove_elem(hashmap, slot_ptr(hashmap, index));
 }
 
-void unified_hash_remove_elem(hash_p hashmap, void* element){
-	*slot_hash_ptr(element) = UNIFIED_HASH_SLOT_DELETED;
+static void unified_hash_remove_elem(hash_p hashmap, void* element){
+	size_t index = slot_index(hashmap, element);
+	const uint8_t* group = hashmap->ctrl + (index & ~(size_t)(GROUP_SIZE - 1));
+	
+	// Lookups only probe past full groups. If the group already has an empty slot no
+	// probe sequence continues behind it and the slot can become empty, too.
+	if ( group_match(group, CTRL_EMPTY) != 0 ) {
+		hashmap->ctrl[index] = CTRL_EMPTY;
+	} else {
+		hashmap->ctrl[index] = CTRL_DELETED;
+		hashmap->deleted++;
+	}
 	hashmap->length--;
 }
 
-bool unified_hash_contains(hash_p hashmap, hash_key_t int_key, const char* string_key){
+static bool unified_hash_contains(hash_p hashmap, hash_key_t int_key, const char* string_key){
 	return (unified_hash_get_ptr(hashmap, int_key, string_key) != NULL);
 }
 
@@ -260,25 +313,25 @@ bool unified_hash_contains(hash_p hashmap, hash_key_t int_key, const char* strin
 // Iterator functions
 //
 
-void* unified_hash_start(unified_hash_p hashmap){
-	return unified_hash_element_at_or_after_slot(hashmap, hashmap->slots);
+static void* unified_hash_start(unified_hash_p hashmap){
+	return unified_hash_element_at_or_after_index(hashmap, 0);
 }
 
-void* unified_hash_next(unified_hash_p hashmap, void* element){
-	return unified_hash_element_at_or_after_slot(hashmap, (char*)element + slot_size(hashmap));
+static void* unified_hash_next(unified_hash_p hashmap, void* element){
+	return unified_hash_element_at_or_after_index(hashmap, slot_index(hashmap, element) + 1);
 }
 
 /**
- * Starts at the memory address of `slot` and scans for the next element (an slot
- * that is not free or deleted).
+ * Starts at the slot `index` and scans the control bytes for the next element (a slot
+ * that is not empty or deleted).
  * 
- * Returns NULL if there is no element at or after `slot`.
+ * Returns NULL if there is no element at or after `index`.
  */
-static void* unified_hash_element_at_or_after_slot(unified_hash_p hash, void* slot){
-	for(char* ptr = slot; ptr < (char*)hash->slots + slot_size(hash) * hash->capacity; ptr += slot_size(hash)) {
-		uint64_t slot_hash = *slot_hash_ptr(ptr);
-		if ( slot_hash != UNIFIED_HASH_SLOT_FREE && slot_hash != UNIFIED_HASH_SLOT_DELETED )
-			return ptr;
+static void* unified_hash_element_at_or_after_index(unified_hash_p hash, size_t index){
+	for(; index < hash->capacity; index++) {
+		// Occupied slots have the highest bit cleared
+		if ( (hash->ctrl[index] & 0x80) == 0 )
+			return slot_ptr(hash, index);
 	}
 	
 	return NULL;
@@ -286,159 +339,116 @@ static void* unified_hash_element_at_or_after_slot(unified_hash_p hash, void* sl
 
 
 
+/**
+ * Rehashes all elements into a table with room for at least `new_capacity` slots. Also
+ * removes all tombstones, so it can be used with the current capacity to clean up.
+ */
 static void unified_hash_resize(unified_hash_p hash, size_t new_capacity){
-	// Just in case: avoid to make the hashmap smaller than it can be
-	if (new_capacity < hash->length)
-		return;
+	// Just in case: avoid to make the hashmap smaller than it can be. Leave room for
+	// one more element so a put right after the resize doesn't resize again.
+	if (new_capacity < GROUP_SIZE)
+		new_capacity = GROUP_SIZE;
+	while (max_load(new_capacity) < hash->length + 1)
+		new_capacity *= 2;
 	
 	// Create a new empty hash map with the new capacity
 	unified_hash_t new_hash;
-	new_hash.capacity = new_capacity;
-	new_hash.length = 0;
 	new_hash.value_size = hash->value_size;
 	new_hash.key_type = hash->key_type;
-	new_hash.slots = calloc(new_hash.capacity, slot_size(hash));
 	
 	// Failed to allocate memory for new hash map, leave the original untouched
-	if (new_hash.slots == NULL)
+	if ( !unified_hash_alloc(&new_hash, new_capacity) )
 		return;
 	
+	// All keys are unique so there is no need to search the new table, just take
+	// the first free slot of each keys probe sequence
 	for(void* elem = unified_hash_start(hash); elem != NULL; elem = unified_hash_next(hash, elem)){
-		void* old_value_ptr = slot_value_ptr(elem);
-		void* new_value_ptr = unified_hash_put_ptr(&new_hash, *slot_key_ptr(elem, int64_t), *slot_key_ptr(elem, const char *));
-		memcpy(new_value_ptr, old_value_ptr, hash->value_size);
+		uint64_t key_hash = (hash->key_type == UNIFIED_HASH_NUMERIC_KEYS) ? int_hash(*slot_key_ptr(elem, hash_key_t)) : string_hash(*slot_key_ptr(elem, const char *));
+		size_t index = unified_hash_find_free_slot(&new_hash, key_hash);
+		new_hash.ctrl[index] = key_hash & 0x7F;
+		new_hash.length++;
+		memcpy(slot_ptr((&new_hash), index), elem, slot_size(hash));
 	}
 	
-	free(hash->slots);
+	free(hash->ctrl);
 	*hash = new_hash;
 }
 
 
 //
-// Hashing functions
-// 
-// The 32 and 64 bit integer hashing functions use the MurmurHash3.
-// 
-//   https://code.google.com/p/smhasher/wiki/MurmurHash3
-// 
-// For strings the djb2 hashing function is used. The 64 bit function is
-// a bit weak and could use some more thinking.
-// 
-//   http://stackoverflow.com/questions/7666509/hash-function-for-string
-//   http://www.cse.yorku.ca/~oz/hash.html
-//   http://stackoverflow.com/questions/8334836/convert-djb-hash-to-64-bit
-// 
-// The hash table uses the hash 0 and UINT64_MAX (or UINT32_MAX) as special
-// values to signal empty or deleted slots. Therefore the hash functions don't
-// generate these values. The price for this is that the values of 1 and
-// UINT64_MAX - 1 (or UINT32_MAX - 1) have twice the probability to appear.
-// Not really sure if this is bad or not.
-// 
-
-#if defined(UNIFIED_HASH_64BIT)
-
-	static uint64_t int64_hash64(int64_t key){
-		uint64_t h = key;
-		
-		h ^= h >> 33;
-		h *= 0xff51afd7ed558ccd;
-		h ^= h >> 33;
-		h *= 0xc4ceb9fe1a85ec53;
-		h ^= h >> 33;
-		
-		if (h == 0)
-			h = 1;
-		else if (h == UINT64_MAX)
-			h = UINT64_MAX - 1;
-		
-		return h;
+// Control byte group matching. Uses SSE2 to compare all 16 control bytes of a group
+// at once, the fallback does the same one byte at a time.
+//
+
+#if defined(__SSE2__)
+
+	static uint32_t group_match(const uint8_t* group, uint8_t ctrl){
+		__m128i bytes = _mm_loadu_si128((const __m128i*)group);
+		return _mm_movemask_epi8( _mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)) );
 	}
 	
-	static uint64_t string_hash64(const char* key){
-		uint64_t hash = 5381;
-		int c;
-		
-		while ( (c = *key++) != '\0' )
-			hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-		
-		if (hash == 0)
-			hash = 1;
-		else if (hash == UINT64_MAX)
-			hash = UINT64_MAX - 1;
-		
-		return hash;
+	// Empty (0x80) and deleted (0xFE) slots are the only ones with the highest bit set,
+	// and movemask collects exactly these bits
+	static uint32_t group_match_empty_or_deleted(const uint8_t* group){
+		return _mm_movemask_epi8( _mm_loadu_si128((const __m128i*)group) );
 	}
 
 #else
 
-	static uint32_t int32_hash32(int32_t key){
-		uint32_t h = key;
-		
-		h ^= h >> 16;
-		h *= 0x85ebca6b;
-		h ^= h >> 13;
-		h *= 0xc2b2ae35;
-		h ^= h >> 16;
-		
-		if (h == 0)
-			h = 1;
-		else if (h == UINT32_MAX)
-			h = UINT32_MAX - 1;
-		
-		return h;
+	static uint32_t group_match(const uint8_t* group, uint8_t ctrl){
+		uint32_t matches = 0;
+		for(size_t i = 0; i < GROUP_SIZE; i++) {
+			if (group[i] == ctrl)
+				matches |= 1 << i;
+		}
+		return matches;
 	}
 	
-	static uint32_t string_hash32(const char* key){
-		uint32_t hash = 5381;
-		int c;
-		
-		while ( (c = *key++) != '\0' )
-			hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-		
-		if (hash == 0)
-			hash = 1;
-		else if (hash == UINT32_MAX)
-			hash = UINT32_MAX - 1;
-		
-		return hash;
+	static uint32_t group_match_empty_or_deleted(const uint8_t* group){
+		uint32_t matches = 0;
+		for(size_t i = 0; i < GROUP_SIZE; i++) {
+			if (group[i] & 0x80)
+				matches |= 1 << i;
+		}
+		return matches;
 	}
 
 #endif
 
 
 //
-// Prime number functions.
-// Not quite optimized prime number finding algo taken from libc++ implementation
-// posted by Howard Hinnant at http://stackoverflow.com/a/5694432
+// Hashing functions
+//
+// Integers are hashed with the 64 bit finalizer of MurmurHash3.
+//
+//   https://code.google.com/p/smhasher/wiki/MurmurHash3
+//
+// For strings the djb2 hashing function is used. djb2 only mixes the last characters
+// into the upper bits a little, but h1 (the group) is taken from the upper bits. So
+// the djb2 result goes through the MurmurHash3 finalizer, too.
+//
+//   http://stackoverflow.com/questions/7666509/hash-function-for-string
+//   http://www.cse.yorku.ca/~oz/hash.html
 //
 
-size_t snap_to_prime(size_t x){
-	// First search the precomputed list. The list contains the next primes after 2^x (starting with x = 2).
-	size_t primes[] = {5, 11, 23, 47, 97, 197, 397, 797, 1597, 3203, 6421, 12853, 25717, 51437, 102877, 205759, 411527, 823117, 1646237, 3292489, 6584983};
-	for(size_t i = 0; i < sizeof(primes) / sizeof(size_t); i++){
-		if (primes[i] >= x)
-			return primes[i];
-	}
+static uint64_t int_hash(uint64_t key){
+	uint64_t h = key;
 	
-	// No match in precomputed list, compute next larger prime.
-	// Make x odd by setting the least significant bit (there are no even primes).
-	x |= 1;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccd;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53;
+	h ^= h >> 33;
 	
-	// Loop odd numbers until we have a prime
-	while( !is_prime(x) )
-		x += 2;
-	
-	return x;
+	return h;
 }
 
-static bool is_prime(size_t x){
-	for(size_t i = 3; true; i += 2){
-		size_t q = x / i;
-		if (q < i)
-			return true;
-		if (x % i == 0)
-			return false;
-	}
+static uint64_t string_hash(const char* key){
+	uint64_t hash = 5381;
+	int c;
 	
-	return true;
-}
\ No newline at end of file
+	while ( (c = *key++) != '\0' )
+		hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+	
+	return int_hash(hash);
+}
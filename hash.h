@@ -18,9 +18,12 @@ TODO:
 
 */
 
+// `ctrl` has one control byte per slot (empty, deleted or the lower 7 bits of the hash),
+// `slots` follows it in the same memory block. See hash.c for details.
 typedef struct {
-	size_t length, capacity;
+	size_t length, capacity, deleted;
 	uint32_t value_size, key_type;
+	uint8_t* ctrl;
 	void* slots;
 } unified_hash_t, *unified_hash_p, *hash_p, *dict_p;
 typedef void *hash_elem_t, *dict_elem_t;
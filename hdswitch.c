@@ -13,12 +13,17 @@ ffmpeg -y -i unix:hdswitch.sock -f webm - | ffmpeg2theora --output /dev/stdout -
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <math.h>
 
 #include <SDL/SDL.h>
 #include <pulse/pulseaudio.h>
 #include <poll.h>
 
 #include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -29,20 +34,49 @@ ffmpeg -y -i unix:hdswitch.sock -f webm - | ffmpeg2theora --output /dev/stdout -
 #include "array.h"
 #include "list.h"
 #include "server.h"
+#include "frame.h"
 #include "mixer.h"
 #include "text_renderer.h"
+#include "ticker.h"
+#include "image_cache.h"
+#include "slides.h"
+#include "media.h"
 #include "timer.h"
+#include "config.h"
+#include "metrics.h"
+#include "trace.h"
 
 
 // Global stuff used by event callbacks
-size_t scene_count = 0;
+const char* config_path = "hdswitch.conf";
+config_p config = NULL;
+size_t composite_w = 0, composite_h = 0;
 size_t scene_idx = 0;
+size_t next_scene_idx = 0;
 size_t ww, wh;
 bool something_to_render = false;
 uint32_t start_ms = 0;
 
 usec_t global_start_walltime = 0;
 
+// Scene transitions. The event callbacks only set next_scene_idx, the output path
+// starts and times the transition with the timecodes of the output frames. They run
+// for the transition_duration of the config.
+#define TRANSITION_CUT        0
+#define TRANSITION_CROSSFADE  1
+#define TRANSITION_WIPE       2
+
+uint8_t  transition_type = TRANSITION_CUT;
+bool     transition_running = false;
+size_t   transition_target = 0;
+uint64_t transition_start = 0;
+
+// Output frames are composed when an input frame arrived. Transitions and tickers also
+// move without new input frames (e.g. with slide decks or media that ended), then the
+// output timer composes frames at OUTPUT_FPS.
+#define OUTPUT_FPS 30
+usec_t last_compose_time = 0;
+
 double video_upload_time = 0, sld_event_time = 0, dispatch_time = 0, mixer_output_time = 0;
 double compose_time = 0, colorspace_time = 0, video_download_time = 0, enqueue_video_frame_time = 0;
 double draw_video_time = 0, draw_text_time = 0;
@@ -51,6 +85,37 @@ double total_time = 0;
 double total_time_max = 0, total_time_avg = 0, total_time_avg_sum = 0;
 uint32_t total_time_count = 0;
 
+// The times above are CPU times, they only show how long it took to submit the GL
+// commands. The GPU timers measure how long the GPU actually took for each stage.
+gpu_timer_p output_gpu_timer = NULL;
+FILE* stats_file = NULL;
+
+// Histograms of the stages (in µs) and frame counters, exported on the metrics socket
+metric_t capture_metric, compose_metric, colorspace_metric, readback_metric, enqueue_metric;
+metric_t output_frame_metric, mixer_output_metric, frames_captured_metric, frames_composed_metric;
+
+// Latency probe (config directive latency_probe). Output frames are tagged with the capture
+// time of the newest camera frame, the latencies of all stages are relative to it. It's
+// reset once an output frame took it, frames composed for other inputs (slides, media or
+// transitions) have no capture time and aren't measured.
+uint64_t latest_capture_time = 0;
+uint32_t latency_frame_counter = 0;
+metric_t latency_upload_metric, latency_composite_metric, latency_readback_metric, latency_enqueue_metric;
+
+// Output video and audio frames, shared with the server without copying
+frame_pool_p frame_pool = NULL;
+metric_t frame_pool_hits_metric, frame_pool_misses_metric;
+metric_t glyph_cache_hits_metric, glyph_cache_misses_metric, glyph_cache_evictions_metric;
+
+// Images of the scenes, decoded in the background and drawn over the views
+image_cache_p image_cache = NULL;
+drawable_p image_on_composite = NULL;
+metric_t image_cache_bytes_metric, image_cache_evictions_metric;
+
+// Sine tone mixed in by the synthetic_audio config directive instead of real mics
+mic_p synthetic_mic = NULL;
+uint64_t synthetic_audio_samples = 0;
+
 
 static int signals_init();
 static int signals_cleanup(int signal_fd);
@@ -58,107 +123,52 @@ static int signals_cleanup(int signal_fd);
 static void signals_cb(pa_mainloop_api *ea, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
 static void sdl_event_check_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata);
 static void camera_frame_cb(pa_mainloop_api *ea, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void slides_frame_cb(pa_mainloop_api *ea, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void media_frame_cb(pa_mainloop_api *ea, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void preview_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata);
+static void output_timer_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata);
+static void synthetic_audio_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata);
+static void reload_scenes();
+static void write_trace();
 
 
-typedef struct {
-	char* device_file;
-	size_t w, h;
-	cam_p cam;
-	GLuint tex;
-} video_input_t, *video_input_p;
+static void draw_scene(drawable_p video_on_composite, scene_p scene);
+static void request_scene_images();
+static void write_stats_line(FILE* f, gpu_timer_p timer);
+static void draw_frame_counter(uint8_t* yuyv, size_t width, size_t height, uint32_t counter);
 
+// Everything the preview window needs. The preview runs on its own timer and only
+// reads the composite texture, so it never holds up the output stream.
 typedef struct {
-	char    horizontal_anchor;
-	ssize_t x;
-	char    vertical_anchor;
-	ssize_t y;
+	SDL_Window* win;
+	drawable_p gui, text;
+	text_layout_p status_text;
 	
-	size_t video_idx;
-	ssize_t w, h;
-	
-	GLuint  vertices;
-} video_view_t, *video_view_p;
+	usec_t interval;
+	// Incremented by the output path for every new composite frame. The preview
+	// only redraws if this changed since the last time it drew.
+	size_t composite_frame, drawn_frame;
+	gpu_timer_p gpu_timer;
+} preview_t, *preview_p;
 
 
 int main(int argc, char** argv) {
 	
-	// One cam test setup
-	video_input_t video_inputs[] = {
-		{ "/dev/video0", 640, 480, NULL, 0 }
-	};
-	
-	video_view_t *scenes[] = {
-		(video_view_t[]){
-			{ 'l', 0, 'c', 0,     0, -100, 0,     0 },
-			{ 0 }
-		},
-		(video_view_t[]){
-			{ 'l', 0, 'c', 0,     0, -100, 0,     0 },
-			{ 'r', 0, 'b', 0,     0,  -33, 0,     0 },
-			{ 0 }
-		}
-	};
-	/*
-	// Two cam setup
-	video_input_t video_inputs[] = {
-		{ "/dev/video0", 640, 480, NULL, 0 },
-		{ "/dev/video1", 640, 480, NULL, 0 }
-	};
+	if (argc > 1)
+		config_path = argv[1];
 	
-	video_view_t *scenes[] = {
-		(video_view_t[]){
-			{ 'l', 0, 'c', 0,     0, -100, 0,     0 },
-			{ 0 }
-		},
-		(video_view_t[]){
-			{ 'l', 0, 'c', 0,     0, -100, 0,     0 },
-			{ 'r', 0, 'b', 0,     1,  -33, 0,     0 },
-			{ 0 }
-		},
-		(video_view_t[]){
-			{ 'c', 0, 'c', 0,     1, -100, 0,     0 },
-			{ 0 }
-		}
-	};
-	*/
+	config = config_load(config_path);
+	if (!config)
+		return 1;
 	
-	// Calculate rest of the configuration
-	size_t video_input_count = sizeof(video_inputs) / sizeof(video_inputs[0]);
-	scene_count = sizeof(scenes) / sizeof(scenes[0]);
+	trace_thread_name("mainloop");
 	
 	// Composite (output video) size
-	size_t composite_w = 0, composite_h = 0;
+	size_t video_input_count = config->inputs->length;
 	for(size_t i = 0; i < video_input_count; i++) {
-		composite_w = (composite_w > video_inputs[i].w) ? composite_w : video_inputs[i].w;
-		composite_h = (composite_h > video_inputs[i].h) ? composite_h : video_inputs[i].h;
-	}
-	
-	// Sizes of individual video views
-	for(size_t i = 0; i < scene_count; i++) {
-		for(size_t j = 0; scenes[i][j].horizontal_anchor != 0; j++) {
-			video_view_p  vv = &scenes[i][j];
-			video_input_p vi = &video_inputs[vv->video_idx];
-			
-			// percent size to pixel size
-			if (vv->w < 0) vv->w = (ssize_t)vi->w * vv->w / -100;
-			if (vv->h < 0) vv->h = (ssize_t)vi->h * vv->h / -100;
-			
-			// calculate aspect ratio correct height if height is 0
-			if (vv->h == 0) vv->h = vv->w * (ssize_t)vi->h / (ssize_t)vi->w;
-			
-			// position (with anchor)
-			switch (vv->horizontal_anchor) {
-				case 'l': /* nothing to do, x already correct*/    break;
-				case 'r': vv->x = composite_w - vv->x - vv->w;     break;
-				case 'c': vv->x = (composite_w - vv->w) / 2 + vv->x; break;
-			}
-			
-			switch (vv->vertical_anchor) {
-				case 't': /* nothing to do, y already correct*/    break;
-				case 'b': vv->y = composite_h - vv->y - vv->h;     break;
-				case 'c': vv->y = (composite_h - vv->h) / 2 + vv->y; break;
-			}
-		}
+		video_input_p vi = array_elem_ptr(config->inputs, i);
+		composite_w = (composite_w > vi->w) ? composite_w : vi->w;
+		composite_h = (composite_h > vi->h) ? composite_h : vi->h;
 	}
 	
 	
@@ -175,31 +185,101 @@ int main(int argc, char** argv) {
 	
 	ww = composite_w;
 	wh = composite_h;
-	SDL_Window* win = SDL_CreateWindow("HDSwitch", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ww, wh, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+	#ifndef NDEBUG
+	// Debug contexts report OpenGL errors through the KHR_debug callback (see check_required_gl_extentions())
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+	#endif
+	// Headless runs (benchmarks) still need a window for the GL context but never show it
+	uint32_t window_flags = SDL_WINDOW_OPENGL | (config->headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE);
+	SDL_Window* win = SDL_CreateWindow("HDSwitch", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ww, wh, window_flags);
 	SDL_GLContext gl_ctx = SDL_GL_CreateContext(win);
+	// Don't wait for vsync when swapping. Output and preview share the mainloop thread
+	// and a vsync wait would block the output. The preview timer paces the window instead.
 	SDL_GL_SetSwapInterval(0);
 	
 	
 	// Setup OpenGL stuff
 	check_required_gl_extentions();
+	output_gpu_timer = gpu_timer_new();
+	
+	if (config->stats_path) {
+		stats_file = fopen(config->stats_path, "w");
+		if (stats_file == NULL)
+			return perror("fopen stats file"), 1;
+		setvbuf(stats_file, NULL, _IOLBF, 0);
+	}
 	
 	
-	// Setup videos and textures
+	// Sample spec of the mixer, media inputs convert their audio into it
+	pa_sample_spec mixer_sample_spec = {
+		.format   = PA_SAMPLE_S16LE,
+		.rate     = 48000,
+		.channels = 2
+	};
+	
+	
+	// Setup videos and the input texture. All inputs are stacked on top of each other
+	// in one texture with a few rows of padding so the chroma sampling of one input
+	// doesn't bleed into the next one. GPUs limit the texture size (often to 16384), when
+	// an input doesn't fit below the others it starts a new column to the right.
+	GLint max_tex_size = 0;
+	glGetIntegerv(GL_MAX_RECTANGLE_TEXTURE_SIZE, &max_tex_size);
+	const size_t input_padding = 2;
+	size_t input_tex_w = 0, input_tex_h = 0;
+	size_t column_x = 0, column_w = 0, column_h = 0;
 	for(size_t i = 0; i < video_input_count; i++) {
-		video_input_p vi = &video_inputs[i];
+		video_input_p vi = array_elem_ptr(config->inputs, i);
 		
-		vi->cam = cam_open(vi->device_file);
-		cam_print_info(vi->cam);
-		cam_setup(vi->cam, cam_pixel_format('YUYV'), vi->w, vi->h, 30, 1, NULL);
-		cam_print_frame_rate(vi->cam);
+		// Directories are slide decks, regular files are played as media files and
+		// everything else is a capture device
+		struct stat device_stat;
+		bool exists = ( stat(vi->device_file, &device_stat) == 0 );
+		if ( exists && S_ISDIR(device_stat.st_mode) ) {
+			vi->slides = slides_new(vi->device_file, vi->w, vi->h);
+			if (!vi->slides)
+				return 1;
+		} else if ( exists && S_ISREG(device_stat.st_mode) ) {
+			vi->media = media_new(vi->device_file, vi->w, vi->h, mixer_sample_spec);
+			if (!vi->media)
+				return 1;
+		} else {
+			vi->cam = cam_open(vi->device_file);
+			cam_print_info(vi->cam);
+			cam_setup(vi->cam, cam_pixel_format('YUYV'), vi->w, vi->h, 30, 1, NULL);
+			cam_print_frame_rate(vi->cam);
+		}
 		
-		vi->tex = texture_new(vi->w, vi->h, GL_RG8);
+		if (column_h > 0 && column_h + vi->h + input_padding > (size_t)max_tex_size) {
+			column_x += column_w + input_padding;
+			column_w = 0;
+			column_h = 0;
+		}
+		
+		// Columns start at even texels, the shaders find the chroma samples by the parity of x
+		vi->tex_x = column_x;
+		vi->tex_y = column_h;
+		size_t even_w = (vi->w + 1) & ~1;
+		column_w = (column_w > even_w) ? column_w : even_w;
+		column_h += vi->h + input_padding;
+		input_tex_w = (input_tex_w > column_x + column_w) ? input_tex_w : column_x + column_w;
+		input_tex_h = (input_tex_h > column_h) ? input_tex_h : column_h;
+	}
+	
+	if (input_tex_w > (size_t)max_tex_size || input_tex_h > (size_t)max_tex_size) {
+		fprintf(stderr, "The inputs need an input texture of %zux%zu texels but the GPU supports at most %dx%d, use fewer or smaller inputs\n",
+			input_tex_w, input_tex_h, max_tex_size, max_tex_size);
+		return 1;
 	}
 	
+	GLuint input_tex = texture_new(input_tex_w, input_tex_h, GL_RG8);
+	for(size_t i = 0; i < video_input_count; i++)
+		array_elem(config->inputs, video_input_t, i).tex = input_tex;
+	
 	GLuint composite_video_tex  = texture_new(composite_w, composite_h, GL_RGB8);
+	GLuint transition_video_tex = texture_new(composite_w, composite_h, GL_RGB8);
 	GLuint stream_video_tex     = texture_new(composite_w, composite_h, GL_RG8);
 	size_t stream_video_size = composite_w * composite_h * 2;
-	void*  stream_video_ptr  = malloc(stream_video_size);
+	frame_pool = frame_pool_new();
 	
 	
 	// Initialize the textures so we don't get random GPU RAM garbage in
@@ -210,40 +290,36 @@ int main(int argc, char** argv) {
 		// Clear rest to black (luma 0, cb 0, cr 0 but croma channels are not in [-0.5, 0.5] but in [0, 1] so 0.5 it is)
 		glClearColor(0, 0.5, 0, 0);
 		
-		for(size_t i = 0; i < video_input_count; i++) {
-			video_input_p vi = &video_inputs[i];
-			
-			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, vi->tex, 0);
-			if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-				return fprintf(stderr, "Framebuffer setup failed to clear video texture\n"), 1;
-			glViewport(0, 0, vi->w, vi->h);
-			glClear(GL_COLOR_BUFFER_BIT);
-		}
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, input_tex, 0);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			return fprintf(stderr, "Framebuffer setup failed to clear video texture\n"), 1;
+		glViewport(0, 0, input_tex_w, input_tex_h);
+		glClear(GL_COLOR_BUFFER_BIT);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	glDeleteFramebuffers(1, &clear_fbo);
 	
 	fbo_p composite_video = fbo_new(composite_video_tex);
+	fbo_p transition_video = fbo_new(transition_video_tex);
 	
-	// Build vertex buffers, use triangle strips for a basic quad. Quads were removed in OpenGL 3.2.
-	drawable_p video_on_composite = drawable_new(GL_TRIANGLE_STRIP, "shaders/video_on_composite.vs", "shaders/video_on_composite.fs");
+	drawable_p video_on_composite = drawable_new(GL_TRIANGLES, "shaders/video_on_composite.vs", "shaders/video_on_composite.fs");
+	video_on_composite->texture = input_tex;
 	size_t cw = composite_w, ch = composite_h;
-	for(size_t i = 0; i < scene_count; i++) {
-		for(size_t j = 0; scenes[i][j].horizontal_anchor != 0; j++) {
-			video_view_p  vv = &scenes[i][j];
-			video_input_p vi = &video_inputs[vv->video_idx];
-			
-			// B D
-			// A C
-			float tri_strip[] = {
-				// pos x                           y                                  tex coord u, v
-				 vv->x          / (cw / 2.0f) - 1, (vv->y + vv->h) / (ch / 2.0f) - 1,         0, vi->h,
-				 vv->x          / (cw / 2.0f) - 1,  vv->y          / (ch / 2.0f) - 1,         0,     0,
-				(vv->x + vv->w) / (cw / 2.0f) - 1, (vv->y + vv->h) / (ch / 2.0f) - 1,     vi->w, vi->h,
-				(vv->x + vv->w) / (cw / 2.0f) - 1,  vv->y          / (ch / 2.0f) - 1,     vi->w,     0
-			};
-			vv->vertices = buffer_new(sizeof(tri_strip), tri_strip);
-		}
+	if ( !config_build_scenes(config, config->inputs, cw, ch) )
+		return 1;
+	
+	// Images are drawn as a unit quad stretched by the `rect` uniform
+	image_on_composite = drawable_new(GL_TRIANGLE_STRIP, "shaders/image_on_composite.vs", "shaders/image_on_composite.fs");
+	{
+		float tri_strip[] = {
+			0, 0,    0, 0,
+			0, 1,    0, 0,
+			1, 0,    0, 0,
+			1, 1,    0, 0
+		};
+		image_on_composite->vertex_buffer = buffer_new(sizeof(tri_strip), tri_strip);
 	}
+	image_cache = image_cache_new(256 * 1024 * 1024);
+	request_scene_images();
 	
 	drawable_p gui = drawable_new(GL_TRIANGLE_STRIP, "shaders/video.vs", "shaders/video.fs");
 	gui->texture = composite_video_tex;
@@ -257,6 +333,20 @@ int main(int argc, char** argv) {
 		gui->vertex_buffer = buffer_new(sizeof(tri_strip), tri_strip);
 	}
 	
+	// Blends the scene we transition to (rendered into transition_video) over the
+	// composite. Costs one extra texture sample per pixel while a transition runs.
+	drawable_p transition = drawable_new(GL_TRIANGLE_STRIP, "shaders/transition.vs", "shaders/transition.fs");
+	transition->texture = transition_video_tex;
+	{
+		float tri_strip[] = {
+			-1.0, -1.0,      0,  0,
+			-1.0,  1.0,      0, ch,
+			 1.0, -1.0,     cw,  0,
+			 1.0,  1.0,     cw, ch
+		};
+		transition->vertex_buffer = buffer_new(sizeof(tri_strip), tri_strip);
+	}
+	
 	fbo_p stream_fbo = fbo_new(stream_video_tex);
 	drawable_p stream = drawable_new(GL_TRIANGLE_STRIP, "shaders/composite_on_stream.vs", "shaders/composite_on_stream.fs");
 	stream->texture = composite_video_tex;
@@ -276,31 +366,105 @@ int main(int argc, char** argv) {
 	uint32_t status_font = text_renderer_font_new(&tr, "DroidSans.ttf", 14);
 	text_renderer_prepare(&tr, status_font, 0, 127);
 	
-	drawable_p text = drawable_new(GL_TRIANGLES, "shaders/text.vs", "shaders/text.fs");
-	text->vertex_buffer = buffer_new(0, NULL);
-	text->texture = tr.texture;
-	float text_vertex_buffer[6*4*400];
+	// One instance per glyph, the vertex buffer and texture are set by text_layout_draw()
+	drawable_p text = drawable_new_instanced(GL_TRIANGLE_STRIP, 4, "shaders/text.vs", "shaders/text.fs");
 	
-	// Setup sound input and output
-	pa_sample_spec mixer_sample_spec = {
-		.format   = PA_SAMPLE_S16LE,
-		.rate     = 48000,
-		.channels = 2
-	};
+	preview_p preview = malloc(sizeof(preview_t));
+	preview->win = win;
+	preview->gui = gui;
+	preview->text = text;
+	preview->status_text = text_layout_new(&tr, status_font, 10, 10);
+	preview->interval = 1000000 / config->preview_fps;
+	preview->composite_frame = 0;
+	preview->drawn_frame = 0;
+	preview->gpu_timer = gpu_timer_new();
+	
+	// Tickers are drawn into the composite with a distance field font, so any text
+	// height stays sharp
+	drawable_p ticker_text = NULL;
+	array_p tickers = array_of(ticker_p);
+	if (config->tickers->length > 0) {
+		int32_t ticker_font = text_renderer_sdf_font_new(&tr, "DroidSans.ttf");
+		text_renderer_prepare(&tr, ticker_font, 32, 127);
+		
+		ticker_text = drawable_new_instanced(GL_TRIANGLE_STRIP, 4, "shaders/ticker.vs", "shaders/text_sdf.fs");
+		float screen_to_normal[9] = {
+			2.0 / cw,  0,        -1,
+			0,         2.0 / ch, -1,
+			0,         0,         1
+		};
+		drawable_uniform_mat3(ticker_text, "screen_to_normal", screen_to_normal);
+		drawable_uniform_4f(ticker_text, "color", 1, 1, 1, 1);
+		drawable_uniform_1f(ticker_text, "outline_width", 2);
+		
+		for(size_t i = 0; i < config->tickers->length; i++) {
+			ticker_lane_p lane = array_elem_ptr(config->tickers, i);
+			ticker_p ticker = ticker_new(&tr, ticker_font, lane->x, lane->y, lane->width, lane->height, lane->speed);
+			if (!ticker) {
+				fprintf(stderr, "Skipping ticker lane %zu, its font couldn't be loaded\n", i);
+				continue;
+			}
+			
+			ticker_listen(ticker, lane->socket_path, mainloop);
+			array_append(tickers, ticker_p, ticker);
+		}
+	}
 	
+	// Init metrics and local server
+	metrics_start("hdswitch-metrics.sock", mainloop);
+	capture_metric         = metrics_histogram("capture_us");
+	compose_metric         = metrics_histogram("compose_us");
+	colorspace_metric      = metrics_histogram("colorspace_us");
+	readback_metric        = metrics_histogram("readback_us");
+	enqueue_metric         = metrics_histogram("enqueue_us");
+	output_frame_metric    = metrics_histogram("output_frame_us");
+	mixer_output_metric    = metrics_histogram("mixer_output_us");
+	frames_captured_metric = metrics_counter("frames_captured");
+	frames_composed_metric = metrics_counter("frames_composed");
+	frame_pool_hits_metric   = metrics_gauge("frame_pool_hits");
+	frame_pool_misses_metric = metrics_gauge("frame_pool_misses");
+	glyph_cache_hits_metric      = metrics_gauge("glyph_cache_hits");
+	glyph_cache_misses_metric    = metrics_gauge("glyph_cache_misses");
+	glyph_cache_evictions_metric = metrics_gauge("glyph_cache_evictions");
+	image_cache_bytes_metric     = metrics_gauge("image_cache_bytes");
+	image_cache_evictions_metric = metrics_gauge("image_cache_evictions");
+	if (config->latency_probe) {
+		latency_upload_metric    = metrics_histogram("latency_upload_us");
+		latency_composite_metric = metrics_histogram("latency_composite_us");
+		latency_readback_metric  = metrics_histogram("latency_readback_us");
+		latency_enqueue_metric   = metrics_histogram("latency_enqueue_us");
+	}
 	
-	// Init local server
 	server_start("hdswitch.sock", cw, ch, mixer_sample_spec.rate, mixer_sample_spec.channels, pa_sample_size(&mixer_sample_spec) * 8, mainloop);
 	
 	
 	// Start everything up
-	for(size_t i = 0; i < video_input_count; i++)
-		cam_stream_start(video_inputs[i].cam, 2);
+	for(size_t i = 0; i < video_input_count; i++) {
+		video_input_p vi = array_elem_ptr(config->inputs, i);
+		if (vi->slides) {
+			char socket_path[64];
+			snprintf(socket_path, sizeof(socket_path), "hdswitch-slides%zu.sock", i);
+			slides_listen(vi->slides, socket_path, mainloop);
+		} else if (vi->cam) {
+			cam_stream_start(vi->cam, 2);
+		}
+	}
 	
 	
 	// Init sound
 	global_start_walltime = time_now();
 	mixer_start(global_start_walltime, 10, 1000, 30, mixer_sample_spec, mainloop);
+	// Media files mix their audio in as virtual mics, so they can only start now
+	for(size_t i = 0; i < video_input_count; i++) {
+		video_input_p vi = array_elem_ptr(config->inputs, i);
+		if (vi->media)
+			media_play(vi->media);
+	}
+	if (config->synthetic_audio) {
+		synthetic_mic = mixer_virtual_mic_new("synthetic");
+		struct timeval next_audio_time = usec_to_timeval( time_now() + 10000 );
+		mainloop->time_new(mainloop, &next_audio_time, synthetic_audio_cb, &mixer_sample_spec);
+	}
 	
 	// Prepare mainloop event callbacks
 	mainloop->io_new(mainloop, signal_fd, PA_IO_EVENT_INPUT, signals_cb, NULL);
@@ -308,8 +472,23 @@ int main(int argc, char** argv) {
 	struct timeval next_sdl_check_time = usec_to_timeval( time_now() + 25000 );
 	mainloop->time_new(mainloop, &next_sdl_check_time, sdl_event_check_cb, NULL);
 	
+	struct timeval next_output_time = usec_to_timeval( time_now() + 1000000 / OUTPUT_FPS );
+	mainloop->time_new(mainloop, &next_output_time, output_timer_cb, tickers);
+	
+	if (!config->headless) {
+		struct timeval next_preview_time = usec_to_timeval( time_now() + preview->interval );
+		mainloop->time_new(mainloop, &next_preview_time, preview_cb, preview);
+	}
+	
 	for(size_t i = 0; i < video_input_count; i++) {
-		video_input_p vi = &video_inputs[i];
+		video_input_p vi = array_elem_ptr(config->inputs, i);
+		if (vi->slides) {
+			mainloop->io_new(mainloop, vi->slides->fd, PA_IO_EVENT_INPUT, slides_frame_cb, vi);
+			continue;
+		} else if (vi->media) {
+			mainloop->io_new(mainloop, vi->media->fd, PA_IO_EVENT_INPUT, media_frame_cb, vi);
+			continue;
+		}
 		pa_io_event* e = mainloop->io_new(mainloop, vi->cam->fd, PA_IO_EVENT_INPUT, camera_frame_cb, vi);
 		//mainloop->io_enable(e, PA_IO_EVENT_NULL);
 	}
@@ -327,73 +506,156 @@ int main(int argc, char** argv) {
 		uint64_t buffer_pts = 0;
 		mixer_output_peek(&buffer_ptr, &buffer_size, &buffer_pts);
 		if (buffer_size > 0) {
-			server_enqueue_frame(2, buffer_pts, buffer_ptr, buffer_size);
+			uint64_t trace_start = trace_begin();
+			// The mixer reuses its buffer, so this is the one copy of the audio data
+			frame_p frame = frame_new(frame_pool, FRAME_FORMAT_PCM_S16LE, buffer_size);
+			memcpy(frame->ptr, buffer_ptr, buffer_size);
+			frame->timestamp = buffer_pts;
+			server_enqueue_frame(2, frame);
+			frame_unref(frame);
 			mixer_output_consume();
+			trace_end("mixer_output", trace_start);
 		}
 		mixer_output_time = time_mark_ms(&performance_timer);
+		if (buffer_size > 0)
+			metrics_record(mixer_output_metric, mixer_output_time * 1000);
 		
 		// Render new video frames if one or more frames have been uploaded
 		if (something_to_render) {
-			video_view_p scene = scenes[scene_idx];
+			uint64_t trace_start = trace_begin();
+			
+			// The timecode of this frame is also the clock for scene transitions
+			uint64_t timecode = time_now() - global_start_walltime;
+			// Only set in latency probe mode and only for the first frame after a capture
+			uint64_t capture_time = latest_capture_time;
+			latest_capture_time = 0;
+			
+			if ( gpu_timer_begin_frame(output_gpu_timer) && stats_file )
+				write_stats_line(stats_file, output_gpu_timer);
+			
+			// Start pending scene switches. Cuts happen right away, all other transitions
+			// start with this frame and run for transition_duration.
+			if (next_scene_idx != scene_idx && !transition_running) {
+				if (transition_type == TRANSITION_CUT) {
+					scene_idx = next_scene_idx;
+				} else {
+					transition_running = true;
+					transition_target = next_scene_idx;
+					transition_start = timecode;
+				}
+			}
+			
+			float transition_progress = 0;
+			if (transition_running) {
+				transition_progress = (float)(timecode - transition_start) / (config->transition_duration * 1000);
+				if (transition_progress >= 1) {
+					scene_idx = transition_target;
+					transition_running = false;
+				}
+			}
+			
+			// Upload the glyphs and images the workers finished. The preview draws with the
+			// same text renderer but only uploads, so glyphs age by output frames.
+			text_renderer_next_frame(&tr);
+			image_cache_next_frame(image_cache);
+			
+			if (transition_running) {
+				fbo_bind(transition_video);
+					glClearColor(0, 0, 0, 0);
+					glClear(GL_COLOR_BUFFER_BIT);
+					draw_scene(video_on_composite, array_elem_ptr(config->scenes, transition_target));
+			}
 			
 			fbo_bind(composite_video);
 				glClearColor(0, 0, 0, 0);
 				glClear(GL_COLOR_BUFFER_BIT);
+				draw_scene(video_on_composite, array_elem_ptr(config->scenes, scene_idx));
 				
-				for(video_view_p vv = scene; vv->horizontal_anchor != 0; vv++) {
-					video_input_p vi = &video_inputs[vv->video_idx];
+				if (transition_running) {
+					// Crossfades blend the entire frame, wipes blend with a soft edge that
+					// moves from left to right.
+					float fade = 1, wipe_x = cw + 8;
+					if (transition_type == TRANSITION_CROSSFADE)
+						fade = transition_progress;
+					else
+						wipe_x = transition_progress * (cw + 16) - 8;
 					
-					video_on_composite->texture = vi->tex;
-					video_on_composite->vertex_buffer = vv->vertices;
-					drawable_draw(video_on_composite);
+					glEnable(GL_BLEND);
+						glBlendEquation(GL_FUNC_ADD);
+						glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+						
+						drawable_uniform_1f(transition, "fade", fade);
+						drawable_uniform_1f(transition, "wipe_x", wipe_x);
+						drawable_draw(transition);
+					glDisable(GL_BLEND);
+				}
+				
+				// Tickers go on top of the scenes, also during transitions
+				if (tickers->length > 0) {
+					glEnable(GL_BLEND);
+						glBlendEquation(GL_FUNC_ADD);
+						glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+						
+						for(size_t i = 0; i < tickers->length; i++)
+							ticker_draw(array_elem(tickers, ticker_p, i), ticker_text, timecode);
+					glDisable(GL_BLEND);
 				}
 				
 			fbo_bind(stream_fbo);
 				compose_time = time_mark_ms(&performance_timer);
+				gpu_timer_mark(output_gpu_timer, "compose");
+				trace_end("compose", trace_start);
+				trace_start = trace_begin();
+				if (capture_time)
+					metrics_record(latency_composite_metric, time_monotonic() - capture_time);
 				
 				drawable_draw(stream);
 				
 			fbo_bind(NULL);
 			colorspace_time = time_mark_ms(&performance_timer);
+			gpu_timer_mark(output_gpu_timer, "colorspace");
+			trace_end("colorspace", trace_start);
+			trace_start = trace_begin();
 			
-			fbo_read(stream_fbo, GL_RG, GL_UNSIGNED_BYTE, stream_video_ptr);
+			frame_p frame = frame_new(frame_pool, FRAME_FORMAT_YUY2, stream_video_size);
+			frame->width = cw;
+			frame->height = ch;
+			frame->timestamp = timecode;
+			frame->capture_time = capture_time;
+			fbo_read(stream_fbo, GL_RG, GL_UNSIGNED_BYTE, frame->ptr);
 			video_download_time = time_mark_ms(&performance_timer);
+			gpu_timer_mark(output_gpu_timer, "download");
+			gpu_timer_end_frame(output_gpu_timer);
+			trace_end("readback", trace_start);
+			trace_start = trace_begin();
 			
-			uint64_t timecode = time_now() - global_start_walltime;
-			server_enqueue_frame(1, timecode, stream_video_ptr, stream_video_size);
-			enqueue_video_frame_time = time_mark_ms(&performance_timer);
-			
-			glViewport(0, 0, ww, wh);
-			
-			drawable_draw(gui);
-			draw_video_time = time_mark_ms(&performance_timer);
+			if (capture_time) {
+				metrics_record(latency_readback_metric, time_monotonic() - capture_time);
+				if (config->latency_pattern)
+					draw_frame_counter(frame->ptr, cw, ch, latency_frame_counter++);
+			}
 			
-			char text_buffer[512];
-			snprintf(text_buffer, sizeof(text_buffer), "event dispatch: %.2lf ms, sdl: %.2lf ms, video upload: %.2lf\ncompose: %.2lf colorspace: %.2lf ms download: %.2lf ms enqueue: %.2lf ms\ndraw video: %.2lf ms text: %.2lf ms\ntotal: %.2lf ms, avg %.2lf ms, max %.2lf ms",
-				dispatch_time, sld_event_time, video_upload_time,
-				compose_time, colorspace_time, video_download_time, enqueue_video_frame_time,
-				draw_video_time, draw_text_time,
-				total_time, total_time_avg, total_time_max);
-			size_t buffer_used = text_renderer_render(&tr, status_font, text_buffer, 10, 10, text_vertex_buffer, sizeof(text_vertex_buffer));
-			buffer_update(text->vertex_buffer, buffer_used, text_vertex_buffer, GL_STREAM_DRAW);
+			server_enqueue_frame(1, frame);
+			frame_unref(frame);
+			metrics_set(frame_pool_hits_metric, frame_pool->buffers->hits);
+			metrics_set(frame_pool_misses_metric, frame_pool->buffers->misses);
+			metrics_set(image_cache_bytes_metric, image_cache->texture_bytes);
+			metrics_set(image_cache_evictions_metric, image_cache->evictions);
+			if (capture_time)
+				metrics_record(latency_enqueue_metric, time_monotonic() - capture_time);
+			enqueue_video_frame_time = time_mark_ms(&performance_timer);
+			trace_end("enqueue", trace_start);
 			
-			glEnable(GL_BLEND);
-				glBlendEquation(GL_FUNC_ADD);
-				glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
-				
-				drawable_begin_uniforms(text);
-					float screen_to_normal[9] = {
-						2.0 / ww,  0,        -1,
-						0,        -2.0 / wh,  1,
-						0,         0,         1
-					};
-					glUniformMatrix3fv( glGetUniformLocation(text->program, "screen_to_normal"), 1, true, screen_to_normal );
-				drawable_draw(text);
-			glDisable(GL_BLEND);
-			draw_text_time = time_mark_ms(&performance_timer);
+			metrics_record(compose_metric, compose_time * 1000);
+			metrics_record(colorspace_metric, colorspace_time * 1000);
+			metrics_record(readback_metric, video_download_time * 1000);
+			metrics_record(enqueue_metric, enqueue_video_frame_time * 1000);
+			metrics_record(output_frame_metric, (compose_time + colorspace_time + video_download_time + enqueue_video_frame_time) * 1000);
+			metrics_add(frames_composed_metric, 1);
 			
-			SDL_GL_SwapWindow(win);
+			preview->composite_frame++;
 			
+			last_compose_time = time_now();
 			something_to_render = false;
 		}
 		
@@ -412,7 +674,7 @@ int main(int argc, char** argv) {
 		if (total_time > total_time_max)
 			total_time_max = total_time;
 	}
-
+	
 		// Output stats
 		/*
 		printf("poll: %zu fds, %d active, %4.1lf ms  ", poll_fds_used, active_fds, poll_time);
@@ -430,35 +692,59 @@ int main(int argc, char** argv) {
 		//	poll_time, 1000.0 / poll_time, frame_time, tex_update_time, draw_time, swap_time);
 	
 	server_stop();
+	if (synthetic_mic)
+		mixer_virtual_mic_destroy(synthetic_mic);
 	mixer_stop();
+	metrics_stop();
+	trace_cleanup();
 	
 	for(size_t i = 0; i < video_input_count; i++) {
-		video_input_p vi = &video_inputs[i];
+		video_input_p vi = array_elem_ptr(config->inputs, i);
 		
+		if (vi->slides) {
+			slides_destroy(vi->slides);
+			continue;
+		} else if (vi->media) {
+			media_destroy(vi->media);
+			continue;
+		}
 		cam_stream_stop(vi->cam);
 		cam_close(vi->cam);
-		
-		texture_destroy(vi->tex);
 	}
 	
-	for(size_t i = 0; i < scene_count; i++) {
-		for(size_t j = 0; scenes[i][j].horizontal_anchor != 0; j++) {
-			video_view_p  vv = &scenes[i][j];
-			buffer_destroy(vv->vertices);
-		}
-	}
+	config_destroy(config);
 	
+	text_layout_destroy(preview->status_text);
+	for(size_t i = 0; i < tickers->length; i++)
+		ticker_destroy(array_elem(tickers, ticker_p, i));
+	array_destroy(tickers);
+	if (ticker_text)
+		drawable_destroy(ticker_text);
 	text_renderer_destroy(&tr);
 	drawable_destroy(text);
+	gpu_timer_destroy(preview->gpu_timer);
+	free(preview);
+	
+	gpu_timer_destroy(output_gpu_timer);
+	if (stats_file)
+		fclose(stats_file);
 	
+	image_cache_destroy(image_cache);
+	drawable_destroy(image_on_composite);
+	drawable_destroy(transition);
 	drawable_destroy(stream);
 	drawable_destroy(gui);
+	// Also destroys the input texture, the vertex buffers belong to the scenes
+	video_on_composite->vertex_buffer = 0;
 	drawable_destroy(video_on_composite);
 	
 	fbo_destroy(stream_fbo);
+	fbo_destroy(transition_video);
 	fbo_destroy(composite_video);
 	texture_destroy(composite_video_tex);
-	free(stream_video_ptr);
+	texture_destroy(transition_video_tex);
+	// After server_stop() no one holds any frames anymore
+	frame_pool_destroy(frame_pool);
 	
 	SDL_GL_DeleteContext(gl_ctx);
 	SDL_DestroyWindow(win);
@@ -481,12 +767,15 @@ static int signals_init() {
 	if ( signal(SIGPIPE, SIG_IGN) == SIG_ERR )
 		return perror("signal"), -1;
 	
-	// Setup SIGINT and SIGTERM to terminate our poll loop. For that we read them via a signal fd.
-	// To prevent the signals from interrupting our process we need to block them first.
+	// Setup SIGINT and SIGTERM to terminate our poll loop, SIGHUP to reload the scenes and SIGUSR1
+	// to write a trace file. For that we read them via a signal fd. To prevent the signals from interrupting our process we need to
+	// block them first.
 	sigset_t signal_mask;
 	sigemptyset(&signal_mask);
 	sigaddset(&signal_mask, SIGINT);
 	sigaddset(&signal_mask, SIGTERM);
+	sigaddset(&signal_mask, SIGHUP);
+	sigaddset(&signal_mask, SIGUSR1);
 	
 	if ( sigprocmask(SIG_BLOCK, &signal_mask, NULL) == -1 )
 		return perror("sigprocmask"), -1;
@@ -511,6 +800,8 @@ static int signals_cleanup(int signal_fd) {
 	sigemptyset(&signal_mask);
 	sigaddset(&signal_mask, SIGINT);
 	sigaddset(&signal_mask, SIGTERM);
+	sigaddset(&signal_mask, SIGHUP);
+	sigaddset(&signal_mask, SIGUSR1);
 	if ( sigprocmask(SIG_UNBLOCK, &signal_mask, NULL) == -1 )
 		return perror("sigprocmask"), -1;
 	
@@ -522,6 +813,103 @@ static int signals_cleanup(int signal_fd) {
 
 
 
+//
+// Rendering
+//
+
+// Loads the scenes from the config file again and replaces the current scenes with them.
+// The new scenes (including their vertex buffers) are completely built before they're
+// swapped in. If anything goes wrong the current scenes stay untouched. Inputs can't
+// be changed without a restart since that would change the output stream.
+static void reload_scenes() {
+	config_p fresh = config_load(config_path);
+	if (!fresh) {
+		fprintf(stderr, "reload of %s failed, keeping current scenes\n", config_path);
+		return;
+	}
+	
+	if ( !config_inputs_equal(config, fresh) )
+		fprintf(stderr, "inputs in %s changed, restart to use them (only reloading scenes)\n", config_path);
+	
+	if ( !config_build_scenes(fresh, config->inputs, composite_w, composite_h) ) {
+		fprintf(stderr, "reload of %s failed, keeping current scenes\n", config_path);
+		config_destroy(fresh);
+		return;
+	}
+	
+	config->transition_duration = fresh->transition_duration;
+	
+	// Swap the scenes, the old ones are destroyed along with the fresh config
+	array_p old_scenes = config->scenes;
+	config->scenes = fresh->scenes;
+	fresh->scenes = old_scenes;
+	config_destroy(fresh);
+	request_scene_images();
+	
+	// Scene indices might point past the new scenes, so end running transitions
+	transition_running = false;
+	if (scene_idx >= config->scenes->length)
+		scene_idx = 0;
+	if (next_scene_idx >= config->scenes->length)
+		next_scene_idx = scene_idx;
+	
+	printf("reloaded %zu scenes from %s\n", config->scenes->length, config_path);
+}
+
+// Writes the spans recorded during the last few seconds into a new Chrome trace file.
+// Triggered by SIGUSR1 or the t key, e.g. right after a frame hitch.
+static void write_trace() {
+	char path[64];
+	snprintf(path, sizeof(path), "hdswitch-trace-%ld.json", (long)time(NULL));
+	trace_flush(path);
+}
+
+// Draws all views of a scene into the currently bound framebuffer. All inputs are in
+// the same texture and all views of a scene in one vertex buffer, so that's one draw
+// call no matter how many views the scene has. The images of the scene follow with one
+// draw call each, images still being decoded are left out.
+static void draw_scene(drawable_p video_on_composite, scene_p scene) {
+	video_on_composite->vertex_buffer = scene->vertices;
+	drawable_draw(video_on_composite);
+	
+	if (scene->images->length == 0)
+		return;
+	
+	glEnable(GL_BLEND);
+		glBlendEquation(GL_FUNC_ADD);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		
+		for(size_t i = 0; i < scene->images->length; i++) {
+			image_layer_p image = array_elem_ptr(scene->images, i);
+			uint32_t w = 0, h = 0;
+			GLuint texture = image_cache_get(image_cache, image->path, &w, &h);
+			if (!texture)
+				continue;
+			
+			float rect[4];
+			config_image_rect(image, w, h, composite_w, composite_h, rect);
+			drawable_uniform_4f(image_on_composite, "rect", rect[0], rect[1], rect[2], rect[3]);
+			drawable_uniform_2f(image_on_composite, "tex_size", w, h);
+			image_on_composite->texture = texture;
+			drawable_draw(image_on_composite);
+		}
+		// The textures belong to the image cache
+		image_on_composite->texture = 0;
+	glDisable(GL_BLEND);
+}
+
+// Lets the image cache decode the images of all scenes right away, so switching to a
+// scene doesn't wait for them (as long as they all fit into the cache)
+static void request_scene_images() {
+	for(size_t i = 0; i < config->scenes->length; i++) {
+		scene_p scene = array_elem_ptr(config->scenes, i);
+		for(size_t j = 0; j < scene->images->length; j++)
+			image_cache_request(image_cache, array_elem(scene->images, image_layer_t, j).path);
+	}
+}
+
+
+
 //
 // Event handling callbacks.
 //
@@ -535,12 +923,18 @@ static void signals_cb(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_
 		return;
 	}
 	
-	mainloop->quit(mainloop, 0);
+	if (siginfo.ssi_signo == SIGHUP)
+		reload_scenes();
+	else if (siginfo.ssi_signo == SIGUSR1)
+		write_trace();
+	else
+		mainloop->quit(mainloop, 0);
 }
 
 // Called periodically to handle pending SDL events
 static void sdl_event_check_cb(pa_mainloop_api *mainloop, pa_time_event *e, const struct timeval *tv, void *userdata) {
 	usec_t start = time_now();
+	uint64_t trace_start = trace_begin();
 	
 	SDL_Event event;
 	while ( SDL_PollEvent(&event) ) {
@@ -556,15 +950,53 @@ static void sdl_event_check_cb(pa_mainloop_api *mainloop, pa_time_event *e, cons
 		
 		if (event.type == SDL_KEYDOWN && event.key.keysym.sym >= SDLK_1 && event.key.keysym.sym <= SDLK_9) {
 			size_t num = event.key.keysym.sym - SDLK_1;
-			if (num < scene_count) {
+			if (num < config->scenes->length) {
 				printf("switching to scene %zu\n", num);
-				scene_idx = num;
+				next_scene_idx = num;
 			}
 		}
 		
-		if (event.type == SDL_KEYDOWN && event.key.keysym.sym >= SDLK_d) {
+		// Select the transition used for the next scene switches
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_c)
+			transition_type = TRANSITION_CUT;
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_f)
+			transition_type = TRANSITION_CROSSFADE;
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_w)
+			transition_type = TRANSITION_WIPE;
+		
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r)
+			reload_scenes();
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_t)
+			write_trace();
+		
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_d) {
 			server_flush_and_disconnect_clients();
 		}
+		
+		// Presenter remotes send page down/up, step all slide decks
+		if (event.type == SDL_KEYDOWN) {
+			SDL_Keycode key = event.key.keysym.sym;
+			ssize_t step = 0;
+			if (key == SDLK_PAGEDOWN || key == SDLK_RIGHT)
+				step = 1;
+			else if (key == SDLK_PAGEUP || key == SDLK_LEFT)
+				step = -1;
+			
+			for(size_t i = 0; step != 0 && i < config->inputs->length; i++) {
+				video_input_p vi = array_elem_ptr(config->inputs, i);
+				if (vi->slides)
+					slides_show(vi->slides, (ssize_t)vi->slides->current + step);
+			}
+		}
+		
+		// Play all media files from the start again
+		if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_p) {
+			for(size_t i = 0; i < config->inputs->length; i++) {
+				video_input_p vi = array_elem_ptr(config->inputs, i);
+				if (vi->media)
+					media_play(vi->media);
+			}
+		}
 	}
 	
 	// Restart the timer for the next time
@@ -572,6 +1004,7 @@ static void sdl_event_check_cb(pa_mainloop_api *mainloop, pa_time_event *e, cons
 	mainloop->time_restart(e, &next_sdl_check_time);
 	
 	sld_event_time = time_mark_ms(&start);
+	trace_end("sdl_events", trace_start);
 }
 
 // Upload new video frames to the GPU
@@ -579,10 +1012,184 @@ static void camera_frame_cb(pa_mainloop_api *mainloop, pa_io_event *e, int fd, p
 	video_input_p video_input = userdata;
 	
 	usec_t start = time_now();
+	uint64_t trace_start = trace_begin();
 		cam_buffer_t frame = cam_frame_get(video_input->cam);
-			texture_update(video_input->tex, GL_RG, frame.ptr);
+			texture_update_part(video_input->tex, GL_RG, frame.ptr, video_input->tex_x, video_input->tex_y, video_input->w, video_input->h, video_input->w);
 		cam_frame_release(video_input->cam);
+	
+	if (config->latency_probe) {
+		// Drivers that don't timestamp with CLOCK_MONOTONIC get the dequeue time instead
+		latest_capture_time = (frame.timestamp != 0) ? frame.timestamp : (uint64_t)time_monotonic();
+		metrics_record(latency_upload_metric, time_monotonic() - latest_capture_time);
+	}
 	video_upload_time = time_mark_ms(&start);
+	metrics_record(capture_metric, video_upload_time * 1000);
+	metrics_add(frames_captured_metric, 1);
+	trace_end("capture", trace_start);
 	
 	something_to_render = true;
+}
+
+// Called when a slide deck changed slides or decoded slides. Slides are copied into the
+// input texture on the GPU, there is nothing to wait for.
+static void slides_frame_cb(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	video_input_p video_input = userdata;
+	
+	uint64_t trace_start = trace_begin();
+	if ( slides_update(video_input->slides, video_input->tex, video_input->tex_x, video_input->tex_y) )
+		something_to_render = true;
+	trace_end("slides", trace_start);
+}
+
+// Called when the next frame (or audio) of a media file is due
+static void media_frame_cb(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	video_input_p video_input = userdata;
+	
+	usec_t start = time_now();
+	uint64_t trace_start = trace_begin();
+	if ( media_update(video_input->media, video_input->tex, video_input->tex_x, video_input->tex_y, start) ) {
+		something_to_render = true;
+		video_upload_time = time_mark_ms(&start);
+		metrics_record(capture_metric, video_upload_time * 1000);
+		metrics_add(frames_captured_metric, 1);
+	}
+	trace_end("media", trace_start);
+}
+
+// Writes a 440 Hz sine tone into the synthetic mic. Writes as many samples as passed
+// since the mixer started so timer jitter doesn't change the amount of audio.
+static void synthetic_audio_cb(pa_mainloop_api *mainloop, pa_time_event *e, const struct timeval *tv, void *userdata) {
+	pa_sample_spec* spec = userdata;
+	
+	struct timeval next_audio_time = usec_to_timeval( time_now() + 10000 );
+	mainloop->time_restart(e, &next_audio_time);
+	
+	uint64_t target_samples = (time_now() - global_start_walltime) * spec->rate / 1000000;
+	size_t sample_count = target_samples - synthetic_audio_samples;
+	if (sample_count == 0)
+		return;
+	
+	int16_t* samples = malloc(sample_count * spec->channels * sizeof(int16_t));
+	for(size_t i = 0; i < sample_count; i++) {
+		int16_t value = 8000 * sin(2 * M_PI * 440 * (synthetic_audio_samples + i) / spec->rate);
+		for(size_t c = 0; c < spec->channels; c++)
+			samples[i * spec->channels + c] = value;
+	}
+	synthetic_audio_samples = target_samples;
+	
+	mixer_virtual_mic_write(synthetic_mic, samples, sample_count * spec->channels * sizeof(int16_t));
+	free(samples);
+}
+
+// Composes an output frame while a transition or ticker is moving but no input frame
+// arrived within the last output frame interval. Inputs that deliver frames at the
+// output rate already keep the output going.
+static void output_timer_cb(pa_mainloop_api *mainloop, pa_time_event *e, const struct timeval *tv, void *userdata) {
+	array_p tickers = userdata;
+	
+	usec_t now = time_now();
+	struct timeval next_output_time = usec_to_timeval( now + 1000000 / OUTPUT_FPS );
+	mainloop->time_restart(e, &next_output_time);
+	
+	bool moving = transition_running || next_scene_idx != scene_idx || tickers->length > 0;
+	if (moving && now - last_compose_time >= 1000000 / OUTPUT_FPS)
+		something_to_render = true;
+}
+
+// Draws the latest composite frame and the status text into the preview window. Runs
+// on its own timer so presenting the preview (and a possible vsync wait in there) is
+// decoupled from the output frame rate.
+static void preview_cb(pa_mainloop_api *mainloop, pa_time_event *e, const struct timeval *tv, void *userdata) {
+	preview_p preview = userdata;
+	
+	// Restart the timer for the next time
+	struct timeval next_preview_time = usec_to_timeval( time_now() + preview->interval );
+	mainloop->time_restart(e, &next_preview_time);
+	
+	// Don't waste GPU time on frames we already showed
+	if (preview->drawn_frame == preview->composite_frame)
+		return;
+	preview->drawn_frame = preview->composite_frame;
+	
+	usec_t start = time_now();
+	uint64_t trace_start = trace_begin();
+	gpu_timer_begin_frame(preview->gpu_timer);
+	
+	glViewport(0, 0, ww, wh);
+	
+	drawable_draw(preview->gui);
+	draw_video_time = time_mark_ms(&start);
+	gpu_timer_mark(preview->gpu_timer, "video");
+	
+	// GPU times are only shown if the timer has results (the driver supports timer queries)
+	char gpu_buffer[256] = "";
+	gpu_timer_p ogt = output_gpu_timer, pgt = preview->gpu_timer;
+	if (ogt && ogt->stage_count == 3 && pgt && pgt->stage_count == 2) {
+		snprintf(gpu_buffer, sizeof(gpu_buffer), "\ngpu compose: %.2lf colorspace: %.2lf ms download: %.2lf ms, %zu queued, %zu frames late\ngpu draw video: %.2lf ms text: %.2lf ms",
+			ogt->stage_ms[0], ogt->stage_ms[1], ogt->stage_ms[2], ogt->queue_depth, ogt->frames_late,
+			pgt->stage_ms[0], pgt->stage_ms[1]);
+	}
+	
+	char text_buffer[768];
+	snprintf(text_buffer, sizeof(text_buffer), "event dispatch: %.2lf ms, sdl: %.2lf ms, video upload: %.2lf\ncompose: %.2lf colorspace: %.2lf ms download: %.2lf ms enqueue: %.2lf ms\ndraw video: %.2lf ms text: %.2lf ms\ntotal: %.2lf ms, avg %.2lf ms, max %.2lf ms%s",
+		dispatch_time, sld_event_time, video_upload_time,
+		compose_time, colorspace_time, video_download_time, enqueue_video_frame_time,
+		draw_video_time, draw_text_time,
+		total_time, total_time_avg, total_time_max, gpu_buffer);
+	// Only lays out and uploads the parts of the lines that changed. The output path
+	// advances the glyph frames, glyphs used here are safe until the next output frame.
+	text_renderer_p tr = preview->status_text->renderer;
+	text_renderer_upload(tr);
+	text_layout_update(preview->status_text, text_buffer);
+	metrics_set(glyph_cache_hits_metric, tr->hits);
+	metrics_set(glyph_cache_misses_metric, tr->misses);
+	metrics_set(glyph_cache_evictions_metric, tr->evictions);
+	
+	glEnable(GL_BLEND);
+		glBlendEquation(GL_FUNC_ADD);
+		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+		
+		float screen_to_normal[9] = {
+			2.0 / ww,  0,        -1,
+			0,        -2.0 / wh,  1,
+			0,         0,         1
+		};
+		drawable_uniform_mat3(preview->text, "screen_to_normal", screen_to_normal);
+		text_layout_draw(preview->status_text, preview->text);
+	glDisable(GL_BLEND);
+	draw_text_time = time_mark_ms(&start);
+	gpu_timer_mark(preview->gpu_timer, "text");
+	gpu_timer_end_frame(preview->gpu_timer);
+	
+	SDL_GL_SwapWindow(preview->win);
+	trace_end("preview", trace_start);
+}
+
+// Writes the GPU times of the output stages and the latest CPU times as one line of
+// key=value pairs. Meant for scripts, e.g. `tail -f hdswitch.stats`.
+static void write_stats_line(FILE* f, gpu_timer_p timer) {
+	fprintf(f, "frame=%" PRIu64 " queue_depth=%zu frames_late=%zu skipped_frames=%zu gpu_total_ms=%.3lf",
+		timer->frame, timer->queue_depth, timer->frames_late, timer->skipped_frames, timer->total_ms);
+	for(size_t i = 0; i < timer->stage_count; i++)
+		fprintf(f, " gpu_%s_ms=%.3lf", timer->stage_names[i], timer->stage_ms[i]);
+	fprintf(f, " cpu_compose_ms=%.3lf cpu_colorspace_ms=%.3lf cpu_download_ms=%.3lf cpu_enqueue_ms=%.3lf\n",
+		compose_time, colorspace_time, video_download_time, enqueue_video_frame_time);
+}
+
+// Draws `counter` as 32 blocks of 8x8 pixels into the top left of a YUYV frame, most
+// significant bit first. Set bits are white (luma 235), cleared bits black (luma 16).
+// A loopback consumer can read the luma at the block centers to identify the frame.
+static void draw_frame_counter(uint8_t* yuyv, size_t width, size_t height, uint32_t counter) {
+	const size_t block_size = 8;
+	if (width < 32 * block_size || height < block_size)
+		return;
+	
+	for(size_t y = 0; y < block_size; y++) {
+		uint8_t* row = yuyv + y * width * 2;
+		for(size_t x = 0; x < 32 * block_size; x++) {
+			bool bit = (counter >> (31 - x / block_size)) & 1;
+			row[x*2 + 0] = bit ? 235 : 16;
+			row[x*2 + 1] = 128;
+		}
+	}
 }
\ No newline at end of file
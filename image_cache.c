@@ -0,0 +1,259 @@
+// For strdup()
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drawable.h"
+#include "stb_image.h"
+#include "image_cache.h"
+
+
+static void   upload_image(image_cache_p cache, image_cache_image_p image);
+static bool   evict_image(image_cache_p cache);
+static void*  worker_main(void* arg);
+
+
+/**
+ * Creates a cache that keeps at most `budget` bytes of textures and starts its worker.
+ */
+image_cache_p image_cache_new(size_t budget) {
+	image_cache_p cache = malloc(sizeof(image_cache_t));
+	memset(cache, 0, sizeof(image_cache_t));
+	
+	cache->entries = dict_of(image_cache_entry_t);
+	cache->budget = budget;
+	// About two 1080p images per frame
+	cache->upload_budget = 16 * 1024 * 1024;
+	glGenBuffers(1, &cache->pbo);
+	cache->uploads = array_of(image_cache_image_t);
+	
+	cache->jobs = array_of(char*);
+	cache->decoded = array_of(image_cache_image_t);
+	cache->worker_quit = false;
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->jobs_added, NULL);
+	
+	int err = pthread_create(&cache->worker, NULL, worker_main, cache);
+	if (err != 0)
+		fprintf(stderr, "image_cache_new(): pthread_create() failed: %s\n", strerror(err));
+	
+	return cache;
+}
+
+/**
+ * Stops the worker (images it didn't start to decode yet are skipped) and destroys all
+ * textures.
+ */
+void image_cache_destroy(image_cache_p cache) {
+	pthread_mutex_lock(&cache->lock);
+		cache->worker_quit = true;
+		pthread_cond_signal(&cache->jobs_added);
+	pthread_mutex_unlock(&cache->lock);
+	pthread_join(cache->worker, NULL);
+	
+	for(size_t i = 0; i < cache->jobs->length; i++)
+		free( array_elem(cache->jobs, char*, i) );
+	array_destroy(cache->jobs);
+	
+	array_p images[2] = { cache->decoded, cache->uploads };
+	for(size_t i = 0; i < 2; i++) {
+		for(size_t j = 0; j < images[i]->length; j++) {
+			image_cache_image_p image = array_elem_ptr(images[i], j);
+			free(image->path);
+			stbi_image_free(image->pixels);
+		}
+		array_destroy(images[i]);
+	}
+	
+	for(dict_elem_t e = dict_start(cache->entries); e != NULL; e = dict_next(cache->entries, e)) {
+		image_cache_entry_p entry = dict_value_ptr(e);
+		if (entry->texture)
+			texture_destroy(entry->texture);
+		free(entry->path);
+	}
+	dict_destroy(cache->entries);
+	
+	glDeleteBuffers(1, &cache->pbo);
+	pthread_cond_destroy(&cache->jobs_added);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/**
+ * Lets the worker decode the image at `path` unless it's already in the cache (or being
+ * decoded).
+ */
+void image_cache_request(image_cache_p cache, const char* path) {
+	if ( dict_contains(cache->entries, path) )
+		return;
+	
+	char* entry_path = strdup(path);
+	dict_put(cache->entries, entry_path, image_cache_entry_t, ((image_cache_entry_t){
+		.path = entry_path,
+		.state = IMAGE_CACHE_DECODING,
+		.last_used = cache->frame
+	}));
+	cache->misses++;
+	
+	pthread_mutex_lock(&cache->lock);
+		array_append(cache->jobs, char*, strdup(path));
+		pthread_cond_signal(&cache->jobs_added);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Returns the texture of the image at `path` (a GL_RGBA8 rectangle texture) and stores its
+ * size in `width` and `height`. Returns 0 if the image isn't decoded yet or couldn't be
+ * decoded, images not in the cache are requested. The image stays in the cache at least
+ * until the next frame.
+ */
+GLuint image_cache_get(image_cache_p cache, const char* path, uint32_t* width, uint32_t* height) {
+	image_cache_entry_p entry = dict_get_ptr(cache->entries, path);
+	if (!entry) {
+		image_cache_request(cache, path);
+		return 0;
+	}
+	
+	entry->last_used = cache->frame;
+	if (entry->state != IMAGE_CACHE_READY)
+		return 0;
+	
+	cache->hits++;
+	*width = entry->width;
+	*height = entry->height;
+	return entry->texture;
+}
+
+/**
+ * Uploads the images the worker decoded (up to `upload_budget` bytes, the rest waits for
+ * the next frame) and evicts images to get below `budget` again. Images used since the last
+ * call are never evicted.
+ */
+void image_cache_next_frame(image_cache_p cache) {
+	cache->frame++;
+	
+	pthread_mutex_lock(&cache->lock);
+		for(size_t i = 0; i < cache->decoded->length; i++)
+			array_append(cache->uploads, image_cache_image_t, array_elem(cache->decoded, image_cache_image_t, i));
+		array_resize(cache->decoded, 0);
+	pthread_mutex_unlock(&cache->lock);
+	
+	size_t uploaded = 0, upload_count = 0;
+	for(; upload_count < cache->uploads->length; upload_count++) {
+		image_cache_image_p image = array_elem_ptr(cache->uploads, upload_count);
+		size_t image_size = (size_t)image->width * image->height * 4;
+		if (upload_count > 0 && uploaded + image_size > cache->upload_budget)
+			break;
+		
+		upload_image(cache, image);
+		uploaded += image_size;
+	}
+	
+	if (upload_count > 0) {
+		image_cache_image_p images = array_data(cache->uploads, image_cache_image_t);
+		memmove(images, images + upload_count, (cache->uploads->length - upload_count) * sizeof(image_cache_image_t));
+		array_resize(cache->uploads, cache->uploads->length - upload_count);
+	}
+	
+	while (cache->texture_bytes > cache->budget && evict_image(cache))
+		;
+}
+
+
+//
+// Internal functions
+//
+
+/**
+ * Copies the pixels into the pixel buffer object and fills a new texture from there.
+ * glTexSubImage2D() returns right away then, the driver transfers the pixels when the
+ * GPU gets to it. Frees the pixels and the path of `image`.
+ */
+static void upload_image(image_cache_p cache, image_cache_image_p image) {
+	image_cache_entry_p entry = dict_get_ptr(cache->entries, image->path);
+	if (entry && image->pixels) {
+		size_t size = (size_t)image->width * image->height * 4;
+		
+		// Orphan the buffer so we don't wait until the GPU is done with the last upload
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, cache->pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void* buffer_ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		memcpy(buffer_ptr, image->pixels, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		
+		entry->texture = texture_new(image->width, image->height, GL_RGBA8);
+		glBindTexture(GL_TEXTURE_RECTANGLE, entry->texture);
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, 0, image->width, image->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		
+		entry->state = IMAGE_CACHE_READY;
+		entry->width = image->width;
+		entry->height = image->height;
+		cache->texture_bytes += size;
+	} else if (entry) {
+		entry->state = IMAGE_CACHE_FAILED;
+	}
+	
+	free(image->path);
+	stbi_image_free(image->pixels);
+}
+
+/**
+ * Destroys the least recently used texture not used since the last frame started. Returns
+ * `false` if there is none.
+ */
+static bool evict_image(image_cache_p cache) {
+	dict_elem_t lru = NULL;
+	for(dict_elem_t e = dict_start(cache->entries); e != NULL; e = dict_next(cache->entries, e)) {
+		image_cache_entry_p entry = dict_value_ptr(e);
+		if (entry->state != IMAGE_CACHE_READY || entry->last_used >= cache->frame - 1)
+			continue;
+		if (lru == NULL || entry->last_used < ((image_cache_entry_p)dict_value_ptr(lru))->last_used)
+			lru = e;
+	}
+	
+	if (lru == NULL)
+		return false;
+	
+	image_cache_entry_p entry = dict_value_ptr(lru);
+	cache->texture_bytes -= (size_t)entry->width * entry->height * 4;
+	texture_destroy(entry->texture);
+	char* path = entry->path;
+	dict_remove_elem(cache->entries, lru);
+	free(path);
+	cache->evictions++;
+	return true;
+}
+
+/**
+ * Decodes one image after another. The decoded pixels are handed over to the frame loop,
+ * only it has the OpenGL context to upload them.
+ */
+static void* worker_main(void* arg) {
+	image_cache_p cache = arg;
+	
+	pthread_mutex_lock(&cache->lock);
+	while (true) {
+		while (cache->jobs->length == 0 && !cache->worker_quit)
+			pthread_cond_wait(&cache->jobs_added, &cache->lock);
+		if (cache->worker_quit)
+			break;
+		
+		char* path = array_elem(cache->jobs, char*, 0);
+		array_remove(cache->jobs, 0);
+		
+		pthread_mutex_unlock(&cache->lock);
+			int width = 0, height = 0, components = 0;
+			uint8_t* pixels = stbi_load(path, &width, &height, &components, 4);
+			if (pixels == NULL)
+				fprintf(stderr, "[image_cache] %s: %s\n", path, stbi_failure_reason());
+		pthread_mutex_lock(&cache->lock);
+		
+		array_append(cache->decoded, image_cache_image_t, ((image_cache_image_t){ path, pixels, width, height }));
+	}
+	pthread_mutex_unlock(&cache->lock);
+	
+	return NULL;
+}
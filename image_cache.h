@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "hash.h"
+#include "array.h"
+
+
+/**
+
+Keeps images (logos, slides, backgrounds) as RGBA textures. Images are decoded by a
+worker thread with stb_image, so asking for an image never waits for disk I/O or the
+decoder. Until an image is ready image_cache_get() returns 0 and the image is just not
+drawn.
+
+Decoded images are copied into a pixel buffer object and the texture is filled from
+there, the driver does the actual transfer without stalling the frame. At most
+`upload_budget` bytes are uploaded per frame, larger images get a frame of their own.
+
+The textures take at most `budget` bytes. Beyond that the least recently used images
+not drawn since the last image_cache_next_frame() are dropped and decoded again when
+they're needed. Request the images of all scenes right away so switching to a scene
+finds them ready.
+
+Basic API usage:
+
+image_cache_p cache = image_cache_new(256 * 1024 * 1024);
+image_cache_request(cache, "logo.png");
+
+// Once per frame, uploads the images the worker decoded
+image_cache_next_frame(cache);
+
+uint32_t w = 0, h = 0;
+GLuint texture = image_cache_get(cache, "logo.png", &w, &h);
+if (texture)
+	...
+
+image_cache_destroy(cache);
+
+*/
+
+#define IMAGE_CACHE_DECODING  1
+#define IMAGE_CACHE_READY     2
+#define IMAGE_CACHE_FAILED    3
+
+typedef struct {
+	// Owned by the entry, it's also the key of the entry in `entries`
+	char*    path;
+	uint8_t  state;
+	GLuint   texture;
+	uint32_t width, height;
+	// Frame the image was last drawn in, for LRU eviction
+	uint64_t last_used;
+} image_cache_entry_t, *image_cache_entry_p;
+
+typedef struct {
+	char*    path;
+	// RGBA pixels from stb_image, NULL if the image couldn't be decoded
+	uint8_t* pixels;
+	uint32_t width, height;
+} image_cache_image_t, *image_cache_image_p;
+
+typedef struct {
+	dict_p entries;
+	size_t budget, texture_bytes;
+	size_t upload_budget;
+	uint64_t frame;
+	uint64_t hits, misses, evictions;
+	
+	// Reused for all uploads, orphaned before each one
+	GLuint pbo;
+	// Decoded images waiting for their upload (only used by the frame loop)
+	array_p uploads;
+	
+	// Protects `jobs` (paths to decode), `decoded` and `worker_quit`
+	pthread_mutex_t lock;
+	pthread_cond_t jobs_added;
+	array_p jobs, decoded;
+	bool worker_quit;
+	pthread_t worker;
+} image_cache_t, *image_cache_p;
+
+image_cache_p image_cache_new(size_t budget);
+void          image_cache_destroy(image_cache_p cache);
+void          image_cache_request(image_cache_p cache, const char* path);
+GLuint        image_cache_get(image_cache_p cache, const char* path, uint32_t* width, uint32_t* height);
+void          image_cache_next_frame(image_cache_p cache);
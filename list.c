@@ -4,12 +4,25 @@
 #include "list.h"
 
 
+static void list_free_node(list_p list, list_node_p node) {
+	if (list->pool)
+		pool_free(list->pool, node);
+	else
+		free(node);
+}
+
+
 list_p list_new(size_t element_size) {
+	return list_new_pooled(element_size, NULL);
+}
+
+list_p list_new_pooled(size_t element_size, pool_p pool) {
 	list_p list = malloc(sizeof(list_t));
 	
 	list->element_size = element_size;
 	list->first = NULL;
 	list->last = NULL;
+	list->pool = pool;
 	
 	return list;
 }
@@ -55,7 +68,7 @@ void list_clear(list_p list) {
 	list_node_p next = NULL;
 	for(list_node_p n = list->first; n != NULL; n = next) {
 		next = n->next;
-		free(n);
+		list_free_node(list, n);
 	}
 	
 	list->first = NULL;
@@ -72,7 +85,7 @@ void list_remove_first(list_p list) {
 	if (list->last == node)
 		list->last = NULL;
 	
-	free(node);
+	list_free_node(list, node);
 }
 
 void list_remove_last(list_p list) {
@@ -85,7 +98,7 @@ void list_remove_last(list_p list) {
 	if (list->first == node)
 		list->first = NULL;
 	
-	free(node);
+	list_free_node(list, node);
 }
 
 void list_remove(list_p list, list_node_p node) {
@@ -96,7 +109,7 @@ void list_remove(list_p list, list_node_p node) {
 	} else {
 		node->prev->next = node->next;
 		node->next->prev = node->prev;
-		free(node);
+		list_free_node(list, node);
 	}
 }
 
@@ -137,7 +150,7 @@ void* list_insert_after_ptr(list_p list, list_node_p target_node) {
 }
 
 list_node_p list_new_node(list_p list) {
-	list_node_p new_node = malloc(sizeof(list_node_t) + list->element_size);
+	list_node_p new_node = list->pool ? pool_alloc(list->pool) : malloc(list_node_size(list->element_size));
 	
 	new_node->prev = NULL;
 	new_node->next = NULL;
@@ -13,6 +13,13 @@ A list has a `first` and `last` pointer to the first and last node. Each node ha
 list_p list = list_of(int);
 list_destroy(list);
 
+// Lists can take their nodes from a pool (see pool.h) instead of malloc(). The pool
+// has to be created for list_node_size(element_size) bytes large blocks and has to
+// outlive the list. Several lists with the same element size can share one pool.
+
+pool_p pool = pool_new(list_node_size(sizeof(int)), 64);
+list_p list = list_of_pooled(int, pool);
+
 
 // Adding nodes to the list and accessing the first and last nodes
 
@@ -80,6 +87,8 @@ list_insert_after_ptr(list, node);   // adds a node after 7 and returns the addr
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "pool.h"
+
 
 typedef struct list_node_s list_node_t, *list_node_p;
 struct list_node_s {
@@ -90,11 +99,15 @@ struct list_node_s {
 typedef struct {
 	size_t element_size;
 	list_node_p first, last;
+	pool_p pool;
 } list_t, *list_p;
 
 
 #define              list_of(               type)                              list_new(sizeof(type))
 list_p               list_new(              size_t element_size);
+#define              list_of_pooled(        type, pool)                        list_new_pooled(sizeof(type), (pool))
+list_p               list_new_pooled(       size_t element_size, pool_p pool);
+#define              list_node_size(        element_size)                      (sizeof(list_node_t) + (element_size))
 void                 list_destroy(          list_p list);
 
 #define              list_prepend(          list, type, value)                 (*((type*)list_prepend_ptr(list)) = (value))
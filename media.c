@@ -0,0 +1,672 @@
+// For strdup(), strnlen() and madvise()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "drawable.h"
+#include "ebml_writer.h"
+#include "stb_image.h"
+#include "yuyv.h"
+#include "media.h"
+
+
+// Poll interval while waiting for the demuxer and interval of audio writes, in µs
+#define MEDIA_POLL_INTERVAL   5000
+#define MEDIA_AUDIO_INTERVAL  10000
+
+
+static bool     next_element(const uint8_t** ptr, const uint8_t* end, uint32_t* id, const uint8_t** data, const uint8_t** data_end);
+static uint64_t read_uint(const uint8_t* data, const uint8_t* end);
+static double   read_float(const uint8_t* data, const uint8_t* end);
+static bool     string_equals(const uint8_t* data, const uint8_t* end, const char* string);
+static void     parse_track(media_p media, const uint8_t* data, const uint8_t* end);
+
+static void     start_demuxer(media_p media);
+static void     stop_demuxer(media_p media);
+static void*    demux_main(void* arg);
+static void     demux_block(media_p media, const uint8_t* data, const uint8_t* end, uint64_t cluster_timecode, int64_t* first_pts, int64_t* next_position);
+static void     feed_audio(media_p media, int64_t elapsed);
+static void     arm_timer(media_p media, int64_t delay);
+
+
+/**
+ * Opens the MKV file at `path` and picks its first usable video and audio track. Video
+ * is shown in an input of `width` times `height` pixels, uncompressed video has to have
+ * exactly that size. Audio is mixed in with `sample_spec` (the mixer sample spec).
+ * 
+ * Returns `NULL` if the file can't be read or has no track we can play.
+ */
+media_p media_new(const char* path, size_t width, size_t height, pa_sample_spec sample_spec) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "[media] %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	
+	struct stat file_stat;
+	if ( fstat(fd, &file_stat) == -1 || file_stat.st_size == 0 ) {
+		fprintf(stderr, "[media] %s: can't read file\n", path);
+		close(fd);
+		return NULL;
+	}
+	
+	void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "[media] %s: mmap: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	// The demuxer reads the file from start to end, let the kernel read ahead
+	madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+	
+	media_p media = malloc(sizeof(media_t));
+	memset(media, 0, sizeof(media_t));
+	media->path = strdup(path);
+	media->width = width;
+	media->height = height;
+	media->sample_spec = sample_spec;
+	media->data = data;
+	media->size = file_stat.st_size;
+	media->timecode_scale = 1000000;
+	media->fd = -1;
+	
+	const uint8_t *p = media->data, *end = media->data + media->size;
+	const uint8_t *element_data = NULL, *element_end = NULL;
+	uint32_t id = 0;
+	
+	if ( !next_element(&p, end, &id, &element_data, &element_end) || id != MKV_EBML ) {
+		fprintf(stderr, "[media] %s: not a Matroska file\n", path);
+		goto failed;
+	}
+	const uint8_t *child_data = NULL, *child_end = NULL;
+	for(const uint8_t* c = element_data; next_element(&c, element_end, &id, &child_data, &child_end); ) {
+		if ( id == MKV_DocType && !string_equals(child_data, child_end, "matroska") && !string_equals(child_data, child_end, "webm") ) {
+			fprintf(stderr, "[media] %s: unknown document type %.*s\n", path, (int)(child_end - child_data), child_data);
+			goto failed;
+		}
+	}
+	
+	if ( !next_element(&p, end, &id, &element_data, &element_end) || id != MKV_Segment ) {
+		fprintf(stderr, "[media] %s: no segment\n", path);
+		goto failed;
+	}
+	
+	// Read the segment up to its first cluster, that's where the demuxer starts
+	const uint8_t* segment_end = element_end;
+	p = element_data;
+	while (p < segment_end && media->clusters_offset == 0) {
+		const uint8_t* element = p;
+		if ( !next_element(&p, segment_end, &id, &element_data, &element_end) )
+			break;
+		
+		if (id == MKV_Info) {
+			for(const uint8_t* c = element_data; next_element(&c, element_end, &id, &child_data, &child_end); ) {
+				if (id == MKV_TimecodeScale)
+					media->timecode_scale = read_uint(child_data, child_end);
+			}
+		} else if (id == MKV_Tracks) {
+			for(const uint8_t* c = element_data; next_element(&c, element_end, &id, &child_data, &child_end); ) {
+				if (id == MKV_TrackEntry)
+					parse_track(media, child_data, child_end);
+			}
+		} else if (id == MKV_Cluster) {
+			media->clusters_offset = element - media->data;
+		}
+	}
+	
+	if (media->clusters_offset == 0 || (media->video_track == 0 && media->audio_track == 0)) {
+		fprintf(stderr, "[media] %s: no video or audio we can play\n", path);
+		goto failed;
+	}
+	
+	media->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (media->fd == -1) {
+		perror("[media] timerfd_create");
+		goto failed;
+	}
+	
+	for(size_t i = 0; i < MEDIA_QUEUE_FRAMES; i++)
+		media->frames[i].pixels = malloc(width * height * 2);
+	media->audio = array_of(media_audio_t);
+	media->start = -1;
+	pthread_mutex_init(&media->lock, NULL);
+	pthread_cond_init(&media->space_available, NULL);
+	
+	printf("[media] %s: video track %" PRIu64 "%s, audio track %" PRIu64 "\n", path, media->video_track,
+		media->video_mjpeg ? " (MJPEG)" : "", media->audio_track);
+	return media;
+	
+	failed:
+		munmap((void*)media->data, media->size);
+		free(media->path);
+		free(media);
+	return NULL;
+}
+
+/**
+ * Stops the demuxer and frees everything, including the mic if the audio is still playing.
+ */
+void media_destroy(media_p media) {
+	stop_demuxer(media);
+	if (media->mic)
+		mixer_virtual_mic_destroy(media->mic);
+	
+	for(size_t i = 0; i < MEDIA_QUEUE_FRAMES; i++)
+		free(media->frames[i].pixels);
+	array_destroy(media->audio);
+	
+	pthread_cond_destroy(&media->space_available);
+	pthread_mutex_destroy(&media->lock);
+	close(media->fd);
+	munmap((void*)media->data, media->size);
+	free(media->path);
+	free(media);
+}
+
+/**
+ * Starts playback from the start of the file (again). Only call it after mixer_start(),
+ * the audio is mixed in as a virtual mic.
+ */
+void media_play(media_p media) {
+	stop_demuxer(media);
+	if (media->mic) {
+		mixer_virtual_mic_destroy(media->mic);
+		media->mic = NULL;
+	}
+	
+	media->playing = true;
+	media->start = -1;
+	media->audio_pos = 0;
+	media->frames_shown = 0;
+	media->frames_skipped = 0;
+	start_demuxer(media);
+	arm_timer(media, MEDIA_POLL_INTERVAL);
+}
+
+/**
+ * Shows the frame due at `now` (the output clock) by uploading it into `texture` at `x`,
+ * `y` and writes the audio into the mixer. Returns `true` if `texture` was changed.
+ */
+bool media_update(media_p media, GLuint texture, size_t x, size_t y, usec_t now) {
+	uint64_t expirations = 0;
+	if ( read(media->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN )
+		perror("[media] read");
+	if (!media->playing)
+		return false;
+	
+	// The clock starts with the first frame so the time the demuxer needs to get going
+	// doesn't make us skip frames
+	if (media->start == -1) {
+		pthread_mutex_lock(&media->lock);
+			bool ready = (media->frames_count > 0 || media->audio->length > 0 || media->demux_done);
+		pthread_mutex_unlock(&media->lock);
+		if (!ready) {
+			arm_timer(media, MEDIA_POLL_INTERVAL);
+			return false;
+		}
+		
+		media->start = now;
+		if (media->audio_track)
+			media->mic = mixer_virtual_mic_new(media->path);
+	}
+	int64_t elapsed = now - media->start;
+	
+	// Show the newest frame that is due and skip the ones before it. The frames stay in
+	// the queue until they're uploaded so the demuxer doesn't overwrite them.
+	pthread_mutex_lock(&media->lock);
+		size_t due = 0;
+		while (due < media->frames_count && media->frames[(media->frames_head + due) % MEDIA_QUEUE_FRAMES].pts <= elapsed)
+			due++;
+	pthread_mutex_unlock(&media->lock);
+	
+	if (due > 0) {
+		media_frame_p frame = &media->frames[(media->frames_head + due - 1) % MEDIA_QUEUE_FRAMES];
+		texture_update_part(texture, GL_RG, frame->pixels, x, y, media->width, media->height, media->width);
+		media->frames_shown++;
+		media->frames_skipped += due - 1;
+		
+		pthread_mutex_lock(&media->lock);
+			media->frames_head = (media->frames_head + due) % MEDIA_QUEUE_FRAMES;
+			media->frames_count -= due;
+			pthread_cond_signal(&media->space_available);
+		pthread_mutex_unlock(&media->lock);
+	}
+	
+	if (media->mic)
+		feed_audio(media, elapsed);
+	
+	// Wake up for the next frame, to poll the demuxer or to write more audio
+	int64_t next = INT64_MAX;
+	pthread_mutex_lock(&media->lock);
+		if (media->frames_count > 0)
+			next = media->frames[media->frames_head].pts;
+		else if (!media->demux_done)
+			next = elapsed + MEDIA_POLL_INTERVAL;
+		bool audio_done = media->demux_done && media->audio->length == 0;
+	pthread_mutex_unlock(&media->lock);
+	
+	if (media->mic && audio_done) {
+		// Otherwise the mixer would wait for audio that never comes
+		mixer_virtual_mic_destroy(media->mic);
+		media->mic = NULL;
+	} else if (media->mic && elapsed + MEDIA_AUDIO_INTERVAL < next) {
+		next = elapsed + MEDIA_AUDIO_INTERVAL;
+	}
+	
+	if (next == INT64_MAX) {
+		printf("[media] %s: done, showed %" PRIu64 " frames, skipped %" PRIu64 " late frames\n", media->path,
+			media->frames_shown, media->frames_skipped);
+		media->playing = false;
+	} else {
+		arm_timer(media, next - elapsed);
+	}
+	
+	return (due > 0);
+}
+
+
+//
+// EBML parsing
+//
+
+/**
+ * Reads the element at `ptr` and moves `ptr` behind it. `data` and `data_end` are set to
+ * the data of the element. Elements with an unknown size (or a size beyond `end`) extend
+ * up to `end`. Returns `false` at the end or if there is no valid element.
+ */
+static bool next_element(const uint8_t** ptr, const uint8_t* end, uint32_t* id, const uint8_t** data, const uint8_t** data_end) {
+	const uint8_t* p = *ptr;
+	uint64_t values[2] = { 0, 0 };
+	size_t lengths[2] = { 0, 0 };
+	
+	// ID (keeps its length marker, at most 4 bytes) and size (vint of up to 8 bytes)
+	for(size_t i = 0; i < 2; i++) {
+		if (p >= end || *p == 0)
+			return false;
+		
+		size_t length = __builtin_clz(*p) - 24 + 1;
+		if ((i == 0 && length > 4) || length > (size_t)(end - p))
+			return false;
+		
+		for(size_t j = 0; j < length; j++)
+			values[i] = (values[i] << 8) | p[j];
+		lengths[i] = length;
+		p += length;
+	}
+	
+	uint64_t marker = 1ULL << (7 * lengths[1]);
+	uint64_t size = values[1] & ~marker;
+	bool unknown_size = (size == marker - 1);
+	
+	*id = values[0];
+	*data = p;
+	*data_end = (unknown_size || size > (uint64_t)(end - p)) ? end : p + size;
+	*ptr = *data_end;
+	return true;
+}
+
+static uint64_t read_uint(const uint8_t* data, const uint8_t* end) {
+	uint64_t value = 0;
+	for(const uint8_t* p = data; p < end && p < data + 8; p++)
+		value = (value << 8) | *p;
+	return value;
+}
+
+static double read_float(const uint8_t* data, const uint8_t* end) {
+	uint64_t bits = read_uint(data, end);
+	if (end - data == 4) {
+		uint32_t bits32 = bits;
+		float value = 0;
+		memcpy(&value, &bits32, sizeof(value));
+		return value;
+	}
+	
+	double value = 0;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// EBML strings can be padded with zeros
+static bool string_equals(const uint8_t* data, const uint8_t* end, const char* string) {
+	size_t length = strnlen((const char*)data, end - data);
+	return length == strlen(string) && memcmp(data, string, length) == 0;
+}
+
+/**
+ * Uses the track if it's the first usable video or audio track.
+ */
+static void parse_track(media_p media, const uint8_t* data, const uint8_t* end) {
+	uint64_t number = 0, type = 0, width = 0, height = 0, channels = 1, bit_depth = 0;
+	double rate = 8000;
+	const uint8_t *codec = NULL, *codec_end = NULL, *colour_space = NULL, *colour_space_end = NULL;
+	
+	uint32_t id = 0;
+	const uint8_t *element_data = NULL, *element_end = NULL;
+	for(const uint8_t* p = data; next_element(&p, end, &id, &element_data, &element_end); ) {
+		switch(id) {
+			case MKV_TrackNumber:  number = read_uint(element_data, element_end);  break;
+			case MKV_TrackType:    type = read_uint(element_data, element_end);    break;
+			case MKV_CodecID:
+				codec = element_data;
+				codec_end = element_end;
+				break;
+			case MKV_Video:
+			case MKV_Audio: {
+				const uint8_t *child_data = NULL, *child_end = NULL;
+				for(const uint8_t* c = element_data; next_element(&c, element_end, &id, &child_data, &child_end); ) {
+					switch(id) {
+						case MKV_PixelWidth:         width = read_uint(child_data, child_end);      break;
+						case MKV_PixelHeight:        height = read_uint(child_data, child_end);     break;
+						case MKV_SamplingFrequency:  rate = read_float(child_data, child_end);      break;
+						case MKV_Channels:           channels = read_uint(child_data, child_end);   break;
+						case MKV_BitDepth:           bit_depth = read_uint(child_data, child_end);  break;
+						case MKV_ColourSpace:
+							colour_space = child_data;
+							colour_space_end = child_end;
+							break;
+					}
+				}
+			} break;
+		}
+	}
+	
+	if (codec == NULL || number == 0)
+		return;
+	
+	if (type == MKV_TrackType_Video && media->video_track == 0) {
+		if ( string_equals(codec, codec_end, "V_MJPEG") ) {
+			media->video_track = number;
+			media->video_mjpeg = true;
+		} else if ( string_equals(codec, codec_end, "V_UNCOMPRESSED") && colour_space && string_equals(colour_space, colour_space_end, "YUY2")
+			&& width == media->width && height == media->height ) {
+			media->video_track = number;
+			media->video_mjpeg = false;
+		} else {
+			fprintf(stderr, "[media] %s: can't play video track %" PRIu64 " (%.*s %" PRIu64 "x%" PRIu64 "), only MJPEG or %zux%zu YUY2\n", media->path,
+				number, (int)(codec_end - codec), codec, width, height, media->width, media->height);
+		}
+	} else if (type == MKV_TrackType_Audio && media->audio_track == 0) {
+		bool little_endian = string_equals(codec, codec_end, "A_PCM/INT/LIT"), big_endian = string_equals(codec, codec_end, "A_PCM/INT/BIG");
+		bool channels_match = (channels == 1 || channels == media->sample_spec.channels || media->sample_spec.channels == 1);
+		if ( (little_endian || big_endian) && bit_depth == 16 && (uint32_t)rate == media->sample_spec.rate && channels_match ) {
+			media->audio_track = number;
+			media->audio_channels = channels;
+			media->audio_big_endian = big_endian;
+		} else {
+			fprintf(stderr, "[media] %s: can't play audio track %" PRIu64 " (%.*s, %" PRIu64 " bit, %.0lf Hz, %" PRIu64 " channels), only 16 bit PCM with %u Hz\n",
+				media->path, number, (int)(codec_end - codec), codec, bit_depth, rate, channels, media->sample_spec.rate);
+		}
+	}
+}
+
+
+//
+// Demuxer
+//
+
+static void start_demuxer(media_p media) {
+	media->frames_head = 0;
+	media->frames_count = 0;
+	media->audio_queued = 0;
+	media->demux_done = false;
+	media->demux_quit = false;
+	
+	int err = pthread_create(&media->demux_thread, NULL, demux_main, media);
+	if (err != 0) {
+		fprintf(stderr, "media_play(): pthread_create() failed: %s\n", strerror(err));
+		media->demux_done = true;
+		return;
+	}
+	media->demux_running = true;
+}
+
+/**
+ * Stops the demuxer and empties the queues.
+ */
+static void stop_demuxer(media_p media) {
+	if (!media->demux_running)
+		return;
+	
+	pthread_mutex_lock(&media->lock);
+		media->demux_quit = true;
+		pthread_cond_signal(&media->space_available);
+	pthread_mutex_unlock(&media->lock);
+	pthread_join(media->demux_thread, NULL);
+	media->demux_running = false;
+	
+	for(size_t i = 0; i < media->audio->length; i++)
+		free( array_elem(media->audio, media_audio_t, i).samples );
+	array_resize(media->audio, 0);
+}
+
+/**
+ * Walks over all clusters and their blocks. Clusters and block groups are entered
+ * instead of skipped, their children have IDs of their own. That way clusters with
+ * an unknown size (live streams) work, too.
+ */
+static void* demux_main(void* arg) {
+	media_p media = arg;
+	const uint8_t *p = media->data + media->clusters_offset, *end = media->data + media->size;
+	uint64_t cluster_timecode = 0;
+	int64_t first_pts = -1, next_position = 0;
+	
+	while (true) {
+		pthread_mutex_lock(&media->lock);
+			bool quit = media->demux_quit;
+		pthread_mutex_unlock(&media->lock);
+		if (quit)
+			break;
+		
+		uint32_t id = 0;
+		const uint8_t *data = NULL, *data_end = NULL;
+		if ( !next_element(&p, end, &id, &data, &data_end) )
+			break;
+		
+		if (id == MKV_Cluster || id == MKV_BlockGroup)
+			p = data;
+		else if (id == MKV_Timecode)
+			cluster_timecode = read_uint(data, data_end);
+		else if (id == MKV_SimpleBlock || id == MKV_Block)
+			demux_block(media, data, data_end, cluster_timecode, &first_pts, &next_position);
+	}
+	
+	pthread_mutex_lock(&media->lock);
+		media->demux_done = true;
+	pthread_mutex_unlock(&media->lock);
+	return NULL;
+}
+
+/**
+ * Decodes a block into the frame or audio queue, waits until there is space in the
+ * queue. `first_pts` is the PTS playback starts with, `next_position` the sample right
+ * after the last audio block.
+ */
+static void demux_block(media_p media, const uint8_t* data, const uint8_t* end, uint64_t cluster_timecode, int64_t* first_pts, int64_t* next_position) {
+	// Track number (a vint), timecode relative to the cluster and flags
+	const uint8_t* p = data;
+	if (p >= end || *p == 0)
+		return;
+	size_t track_length = __builtin_clz(*p) - 24 + 1;
+	if (track_length > (size_t)(end - p))
+		return;
+	uint64_t track = read_uint(p, p + track_length) & ~(1ULL << (7 * track_length));
+	p += track_length;
+	if (end - p < 3 || (track != media->video_track && track != media->audio_track))
+		return;
+	
+	int16_t relative_timecode = (int16_t)((p[0] << 8) | p[1]);
+	uint8_t lacing = (p[2] >> 1) & 0x03;
+	p += 3;
+	
+	int64_t pts = (int64_t)(cluster_timecode + relative_timecode) * (int64_t)media->timecode_scale / 1000;
+	if (*first_pts == -1)
+		*first_pts = pts;
+	pts -= *first_pts;
+	
+	if (track == media->video_track) {
+		if (lacing != 0)
+			return;
+		
+		pthread_mutex_lock(&media->lock);
+			while (media->frames_count == MEDIA_QUEUE_FRAMES && !media->demux_quit)
+				pthread_cond_wait(&media->space_available, &media->lock);
+			if (media->demux_quit) {
+				pthread_mutex_unlock(&media->lock);
+				return;
+			}
+			// The frame loop doesn't touch frames beyond `frames_count`
+			media_frame_p frame = &media->frames[(media->frames_head + media->frames_count) % MEDIA_QUEUE_FRAMES];
+		pthread_mutex_unlock(&media->lock);
+		
+		size_t frame_size = media->width * media->height * 2;
+		if (media->video_mjpeg) {
+			int rgb_w = 0, rgb_h = 0, components = 0;
+			uint8_t* rgb = stbi_load_from_memory(p, end - p, &rgb_w, &rgb_h, &components, 3);
+			if (rgb == NULL)
+				fprintf(stderr, "[media] %s: frame at %.3lf s: %s\n", media->path, pts / 1000000.0, stbi_failure_reason());
+			yuyv_from_rgb(rgb, rgb_w, rgb_h, frame->pixels, media->width, media->height);
+			stbi_image_free(rgb);
+		} else if ((size_t)(end - p) == frame_size) {
+			memcpy(frame->pixels, p, frame_size);
+		} else {
+			fprintf(stderr, "[media] %s: frame at %.3lf s has %zu bytes instead of %zu, skipping it\n", media->path,
+				pts / 1000000.0, (size_t)(end - p), frame_size);
+			return;
+		}
+		
+		pthread_mutex_lock(&media->lock);
+			frame->pts = pts;
+			media->frames_count++;
+		pthread_mutex_unlock(&media->lock);
+	} else {
+		// PCM frames of laced blocks are stored one after another, only skip the lace sizes
+		if (lacing != 0) {
+			if (p >= end)
+				return;
+			size_t lace_count = *p++ + 1;
+			if (lacing == 1) {
+				// Xiph lacing, the sizes are sums of bytes that end with a byte below 255
+				for(size_t i = 0; i < lace_count - 1 && p < end; p++)
+					if (*p != 255)
+						i++;
+			} else if (lacing == 3) {
+				// EBML lacing, the first size and then differences as vints
+				for(size_t i = 0; i < lace_count - 1 && p < end; i++)
+					p += (*p == 0) ? 1 : __builtin_clz(*p) - 24 + 1;
+			}
+			if (p > end)
+				return;
+		}
+		
+		size_t in_frame_size = media->audio_channels * 2, out_channels = media->sample_spec.channels;
+		size_t sample_frames = (end - p) / in_frame_size;
+		int16_t* samples = malloc(sample_frames * out_channels * sizeof(int16_t));
+		for(size_t i = 0; i < sample_frames; i++) {
+			int32_t in[2] = { 0, 0 };
+			for(size_t c = 0; c < media->audio_channels && c < 2; c++) {
+				const uint8_t* s = p + i * in_frame_size + c * 2;
+				in[c] = media->audio_big_endian ? (int16_t)((s[0] << 8) | s[1]) : (int16_t)((s[1] << 8) | s[0]);
+			}
+			
+			for(size_t c = 0; c < out_channels; c++) {
+				if (media->audio_channels == 1)
+					samples[i * out_channels + c] = in[0];
+				else if (out_channels == 1)
+					samples[i * out_channels + c] = (in[0] + in[1]) / 2;
+				else
+					samples[i * out_channels + c] = in[c < 2 ? c : 0];
+			}
+		}
+		
+		// Timecodes are usually in ms, snap blocks that continue the last one to it so
+		// the rounding doesn't add gaps or cut off samples
+		int64_t position = pts * media->sample_spec.rate / 1000000;
+		int64_t tolerance = (int64_t)media->timecode_scale * media->sample_spec.rate / 1000000000 + 1;
+		if (llabs(position - *next_position) <= tolerance)
+			position = *next_position;
+		*next_position = position + sample_frames;
+		
+		size_t size = sample_frames * out_channels * sizeof(int16_t);
+		size_t max_queued = pa_usec_to_bytes(MEDIA_AUDIO_QUEUE, &media->sample_spec);
+		pthread_mutex_lock(&media->lock);
+			while (media->audio_queued + size > max_queued && media->audio->length > 0 && !media->demux_quit)
+				pthread_cond_wait(&media->space_available, &media->lock);
+			if (media->demux_quit) {
+				free(samples);
+			} else {
+				array_append(media->audio, media_audio_t, ((media_audio_t){ position, (uint8_t*)samples, size }));
+				media->audio_queued += size;
+			}
+		pthread_mutex_unlock(&media->lock);
+	}
+}
+
+
+//
+// Playback
+//
+
+/**
+ * Writes the queued audio into the mic up to MEDIA_AUDIO_LEAD after `elapsed`. Gaps
+ * become holes in the mic (silence). When the demuxer fell behind the mic is kept up
+ * to `elapsed` the same way, audio arriving later for that time is skipped.
+ */
+static void feed_audio(media_p media, int64_t elapsed) {
+	size_t frame_size = pa_frame_size(&media->sample_spec);
+	int64_t target = (elapsed + MEDIA_AUDIO_LEAD) * media->sample_spec.rate / 1000000;
+	int64_t now = elapsed * media->sample_spec.rate / 1000000;
+	
+	pthread_mutex_lock(&media->lock);
+	while (media->audio_pos < target) {
+		if (media->audio->length == 0) {
+			if (!media->demux_done && now > media->audio_pos) {
+				mixer_virtual_mic_write(media->mic, NULL, (now - media->audio_pos) * frame_size);
+				media->audio_pos = now;
+			}
+			break;
+		}
+		
+		media_audio_p chunk = array_elem_ptr(media->audio, 0);
+		int64_t chunk_end = chunk->position + chunk->size / frame_size;
+		if (chunk_end <= media->audio_pos) {
+			media->audio_queued -= chunk->size;
+			free(chunk->samples);
+			array_remove(media->audio, 0);
+			pthread_cond_signal(&media->space_available);
+			continue;
+		}
+		
+		int64_t write_end = (chunk->position < target) ? chunk->position : target;
+		if (write_end > media->audio_pos) {
+			mixer_virtual_mic_write(media->mic, NULL, (write_end - media->audio_pos) * frame_size);
+			media->audio_pos = write_end;
+			continue;
+		}
+		
+		write_end = (chunk_end < target) ? chunk_end : target;
+		size_t offset = (media->audio_pos - chunk->position) * frame_size;
+		mixer_virtual_mic_write(media->mic, chunk->samples + offset, (write_end - media->audio_pos) * frame_size);
+		media->audio_pos = write_end;
+	}
+	pthread_mutex_unlock(&media->lock);
+}
+
+static void arm_timer(media_p media, int64_t delay) {
+	if (delay < 1)
+		delay = 1;
+	struct itimerspec timer_spec = {
+		.it_interval = { 0, 0 },
+		.it_value    = { .tv_sec = delay / 1000000, .tv_nsec = (delay % 1000000) * 1000 }
+	};
+	if ( timerfd_settime(media->fd, 0, &timer_spec, NULL) == -1 )
+		perror("[media] timerfd_settime");
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <pulse/pulseaudio.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "array.h"
+#include "mixer.h"
+#include "timer.h"
+
+
+/**
+
+Plays a Matroska file (MKV) as a video input, e.g. an intro clip. Video tracks can be
+uncompressed YUY2 (what hdswitch itself streams, so recorded streams play back as is)
+or MJPEG (with Huffman tables, as ffmpeg writes them). Audio tracks have to be 16 bit
+PCM with the mixer sample rate and are mixed in as a virtual mic.
+
+A demux thread reads the mapped file, decodes the frames into YUYV and keeps a few of
+them in a queue, it waits when the queue is full. The frame loop takes the frames out
+when they're due. A frame is due when the time since playback started reaches the
+frame's PTS (relative to the first frame), frames that are already late when the next
+one is due are skipped. Audio is written into the mixer a bit ahead of time, gaps (the
+demuxer fell behind or the file has none) are filled with silence so the mixer never
+waits for us.
+
+Playback starts with the first decoded frame after media_play(). At the end of the
+file the last frame stays on the input and the mic is removed from the mixer.
+
+`fd` is a timer that becomes readable when the next frame (or audio) is due, the
+mainloop calls media_update() then just like it reads camera frames.
+
+Basic API usage:
+
+media_p media = media_new("intro.mkv", 1280, 720, mixer_sample_spec);
+media_play(media);
+
+// When `media->fd` is readable, returns true if the input texture changed
+if ( media_update(media, input_tex, tex_x, tex_y, time_now()) )
+	...
+
+media_destroy(media);
+
+*/
+
+// Decoded frames queued ahead, each takes width * height * 2 bytes
+#define MEDIA_QUEUE_FRAMES  8
+// Audio queued ahead at most, in µs
+#define MEDIA_AUDIO_QUEUE   1000000
+// Audio is written into the mixer that far ahead of the playback time, in µs
+#define MEDIA_AUDIO_LEAD    50000
+
+typedef struct {
+	// µs since the first frame of the file
+	int64_t  pts;
+	// YUYV pixels in the size of the input
+	uint8_t* pixels;
+} media_frame_t, *media_frame_p;
+
+typedef struct {
+	// Sample frame since the first frame of the file
+	int64_t  position;
+	// Samples in the mixer sample spec, owned by the queue
+	uint8_t* samples;
+	size_t   size;
+} media_audio_t, *media_audio_p;
+
+typedef struct {
+	char* path;
+	size_t width, height;
+	pa_sample_spec sample_spec;
+	
+	// The whole file mapped into memory and where its first cluster starts
+	const uint8_t* data;
+	size_t size, clusters_offset;
+	uint64_t timecode_scale;
+	
+	// Track numbers (0 if there is no usable track) and their formats
+	uint64_t video_track, audio_track;
+	bool video_mjpeg;
+	uint32_t audio_channels;
+	bool audio_big_endian;
+	
+	// Playback state of the frame loop, `start` is -1 until the first frame arrived
+	bool playing;
+	usec_t start;
+	// Sample frame (since `start`) up to which audio was written into the mic
+	int64_t audio_pos;
+	mic_p mic;
+	uint64_t frames_shown, frames_skipped;
+	// timerfd, readable when media_update() has something to do
+	int fd;
+	pthread_t demux_thread;
+	bool demux_running;
+	
+	// Protects everything below, `space_available` is signaled when the frame loop took
+	// frames or audio out of the queues
+	pthread_mutex_t lock;
+	pthread_cond_t space_available;
+	media_frame_t frames[MEDIA_QUEUE_FRAMES];
+	size_t frames_head, frames_count;
+	array_p audio;
+	// Bytes of audio in `audio`
+	size_t audio_queued;
+	bool demux_done, demux_quit;
+} media_t, *media_p;
+
+media_p media_new(const char* path, size_t width, size_t height, pa_sample_spec sample_spec);
+void    media_destroy(media_p media);
+void    media_play(media_p media);
+bool    media_update(media_p media, GLuint texture, size_t x, size_t y, usec_t now);
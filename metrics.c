@@ -0,0 +1,392 @@
+// For accept4() and open_memstream() (needs _POSIX_C_SOURCE 200809L which is also defined by _GNU_SOURCE)
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "timer.h"
+#include "metrics.h"
+
+
+#define METRIC_COUNTER    1
+#define METRIC_GAUGE      2
+#define METRIC_HISTOGRAM  3
+
+// Values below 16 get a bucket of their own, above that every power of two is split
+// into 16 buckets. Values up to 2^40 (12 days in µs) are tracked, larger values end
+// up in the last bucket.
+#define SUB_BUCKET_BITS    4
+#define SUB_BUCKETS        (1 << SUB_BUCKET_BITS)
+#define MAX_VALUE_BITS     40
+#define HISTOGRAM_BUCKETS  ((MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+typedef struct {
+	uint64_t count, sum, max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t, *histogram_p;
+
+// Only the thread that owns a shard writes into it. Everyone else just reads.
+typedef struct shard_s shard_t, *shard_p;
+struct shard_s {
+	shard_p  next;
+	uint64_t counters[METRICS_MAX];
+	histogram_t histograms[METRICS_MAX_HISTOGRAMS];
+};
+
+// Metric registry, only modified by the mainloop thread. `metric_slots` is the index
+// into the counter, gauge or histogram arrays depending on the type of the metric.
+static const char* metric_names[METRICS_MAX];
+static uint8_t     metric_types[METRICS_MAX];
+static uint32_t    metric_slots[METRICS_MAX];
+static size_t      metric_count = 0, histogram_count = 0;
+
+// Gauges are set with a plain store, they're not summed up over threads
+static int64_t gauges[METRICS_MAX];
+
+// All shards ever created. New shards are pushed to the front with a compare and swap.
+static shard_p shards = NULL;
+static __thread shard_p local_shard = NULL;
+
+// Histograms at the time of the last interval report. Subtracted from the current
+// histograms to get the values of the interval.
+static histogram_t interval_start[METRICS_MAX_HISTOGRAMS];
+static usec_t interval_start_time = 0;
+
+static pa_mainloop_api* metrics_mainloop = NULL;
+static const char* metrics_socket_path = NULL;
+static int metrics_fd = -1;
+static pa_io_event* metrics_accept_event = NULL;
+static usec_t metrics_start_time = 0;
+
+
+static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void on_request(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+
+static metric_t metric_register(const char* name, uint8_t type);
+static shard_p  shard_for_this_thread();
+static void     histogram_collect(uint32_t slot, histogram_p total);
+static uint64_t histogram_percentile(histogram_p histogram, double percentile);
+static void     write_report(FILE* f, bool json, bool interval);
+
+
+
+bool metrics_start(const char* socket_path, pa_mainloop_api* mainloop) {
+	metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (metrics_fd == -1)
+		return perror("[metrics] socket"), false;
+	
+	metrics_socket_path = socket_path;
+	unlink(socket_path);
+	
+	struct sockaddr_un addr = { AF_UNIX, "" };
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+	if ( bind(metrics_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 )
+		return perror("[metrics] bind"), false;
+	
+	if ( listen(metrics_fd, 3) == -1 )
+		return perror("[metrics] listen"), false;
+	
+	metrics_start_time = time_now();
+	interval_start_time = metrics_start_time;
+	
+	metrics_mainloop = mainloop;
+	metrics_accept_event = metrics_mainloop->io_new(metrics_mainloop, metrics_fd, PA_IO_EVENT_INPUT, on_accept, NULL);
+	
+	return true;
+}
+
+/**
+ * Closes the socket and frees all shards. Only call this after all other threads
+ * that recorded values are done.
+ */
+void metrics_stop() {
+	if (metrics_fd != -1) {
+		metrics_mainloop->io_free(metrics_accept_event);
+		close(metrics_fd);
+		unlink(metrics_socket_path);
+		metrics_fd = -1;
+	}
+	
+	for(shard_p shard = shards, next = NULL; shard != NULL; shard = next) {
+		next = shard->next;
+		free(shard);
+	}
+	shards = NULL;
+	local_shard = NULL;
+}
+
+
+metric_t metrics_counter(const char* name) {
+	return metric_register(name, METRIC_COUNTER);
+}
+
+metric_t metrics_gauge(const char* name) {
+	return metric_register(name, METRIC_GAUGE);
+}
+
+metric_t metrics_histogram(const char* name) {
+	return metric_register(name, METRIC_HISTOGRAM);
+}
+
+
+//
+// Recording values. Only the owning thread writes into a shard so a relaxed load and
+// store is enough, no need for locked read-modify-write instructions. The atomics just
+// make sure the reporter never sees half written values.
+//
+
+static inline void shard_add(uint64_t* value_ptr, uint64_t value) {
+	__atomic_store_n(value_ptr, __atomic_load_n(value_ptr, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline size_t bucket_of(uint64_t value) {
+	if (value < SUB_BUCKETS)
+		return value;
+	
+	size_t exponent = 63 - __builtin_clzll(value);
+	if (exponent >= MAX_VALUE_BITS)
+		return HISTOGRAM_BUCKETS - 1;
+	
+	size_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+void metrics_add(metric_t counter, uint64_t value) {
+	// Metrics that didn't fit into the registry are ignored
+	if (counter >= METRICS_MAX)
+		return;
+	
+	shard_p shard = shard_for_this_thread();
+	shard_add(&shard->counters[metric_slots[counter]], value);
+}
+
+void metrics_set(metric_t gauge, int64_t value) {
+	if (gauge >= METRICS_MAX)
+		return;
+	
+	__atomic_store_n(&gauges[metric_slots[gauge]], value, __ATOMIC_RELAXED);
+}
+
+void metrics_record(metric_t histogram, uint64_t value) {
+	if (histogram >= METRICS_MAX)
+		return;
+	
+	histogram_p h = &shard_for_this_thread()->histograms[metric_slots[histogram]];
+	shard_add(&h->buckets[bucket_of(value)], 1);
+	shard_add(&h->count, 1);
+	shard_add(&h->sum, value);
+	if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+
+
+//
+// Event handlers
+//
+
+static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	int client_fd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (client_fd == -1) {
+		perror("[metrics] accept4");
+		return;
+	}
+	
+	mainloop->io_new(mainloop, client_fd, PA_IO_EVENT_INPUT | PA_IO_EVENT_HANGUP, on_request, NULL);
+}
+
+/**
+ * Reads the request line of a client ("text", "json", optionally followed by "interval"),
+ * writes the report and closes the connection. A client that closes its side without
+ * sending anything gets the text report.
+ */
+static void on_request(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	char request[64] = "";
+	ssize_t bytes_read = read(fd, request, sizeof(request) - 1);
+	if (bytes_read > 0)
+		request[bytes_read] = '\0';
+	
+	bool json = (strncmp(request, "json", 4) == 0);
+	bool interval = (strstr(request, "interval") != NULL);
+	
+	char* report_ptr = NULL;
+	size_t report_size = 0;
+	FILE* f = open_memstream(&report_ptr, &report_size);
+	write_report(f, json, interval);
+	fclose(f);
+	
+	// The client socket is blocking and the report is a few KiByte at most, so it
+	// fits into the socket buffer anyway
+	for(size_t written = 0; written < report_size; ) {
+		ssize_t bytes_written = write(fd, report_ptr + written, report_size - written);
+		if (bytes_written < 0) {
+			perror("[metrics] write");
+			break;
+		}
+		written += bytes_written;
+	}
+	
+	free(report_ptr);
+	mainloop->io_free(e);
+	close(fd);
+}
+
+
+
+//
+// Utility functions
+//
+
+static metric_t metric_register(const char* name, uint8_t type) {
+	if (metric_count >= METRICS_MAX || (type == METRIC_HISTOGRAM && histogram_count >= METRICS_MAX_HISTOGRAMS)) {
+		fprintf(stderr, "[metrics] no room for %s, increase METRICS_MAX or METRICS_MAX_HISTOGRAMS\n", name);
+		return METRICS_MAX;
+	}
+	
+	metric_t metric = metric_count++;
+	metric_names[metric] = name;
+	metric_types[metric] = type;
+	metric_slots[metric] = (type == METRIC_HISTOGRAM) ? histogram_count++ : metric;
+	
+	return metric;
+}
+
+static shard_p shard_for_this_thread() {
+	if (local_shard != NULL)
+		return local_shard;
+	
+	local_shard = calloc(1, sizeof(shard_t));
+	shard_p head = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+	do {
+		local_shard->next = head;
+	} while ( !__atomic_compare_exchange_n(&shards, &head, local_shard, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) );
+	
+	return local_shard;
+}
+
+/**
+ * Sums up the histogram `slot` of all shards. The count is taken from the buckets so it
+ * always matches them even if a thread records a value while we're reading.
+ */
+static void histogram_collect(uint32_t slot, histogram_p total) {
+	memset(total, 0, sizeof(histogram_t));
+	
+	for(shard_p shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard != NULL; shard = shard->next) {
+		histogram_p h = &shard->histograms[slot];
+		
+		for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+			uint64_t bucket = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+			total->buckets[i] += bucket;
+			total->count += bucket;
+		}
+		
+		total->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+		uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+		if (max > total->max)
+			total->max = max;
+	}
+}
+
+/**
+ * Returns the highest value of the bucket the percentile falls into (so the result is
+ * rounded up, never down), but not more than the largest recorded value.
+ */
+static uint64_t histogram_percentile(histogram_p histogram, double percentile) {
+	uint64_t rank = percentile / 100 * histogram->count + 0.5;
+	if (rank < 1)
+		rank = 1;
+	
+	uint64_t seen = 0;
+	for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen < rank)
+			continue;
+		
+		if (i < SUB_BUCKETS)
+			return i;
+		
+		size_t exponent = i / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+		uint64_t sub_bucket = i % SUB_BUCKETS;
+		uint64_t upper_bound = ((SUB_BUCKETS + sub_bucket + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+		return (upper_bound < histogram->max) ? upper_bound : histogram->max;
+	}
+	
+	return histogram->max;
+}
+
+/**
+ * Writes all metrics in registration order. Counters are totals since the start. For
+ * interval reports histograms only contain the values recorded since the previous
+ * interval report, the max is then the upper bound of the highest used bucket.
+ */
+static void write_report(FILE* f, bool json, bool interval) {
+	usec_t now = time_now();
+	const char* separator = "";
+	
+	if (json)
+		fprintf(f, "{\"uptime_us\": %" PRId64 ", \"interval_us\": %" PRId64 ", \"metrics\": {", now - metrics_start_time, interval ? now - interval_start_time : now - metrics_start_time);
+	else
+		fprintf(f, "uptime_us %" PRId64 "\n", now - metrics_start_time);
+	
+	for(size_t i = 0; i < metric_count; i++) {
+		const char* name = metric_names[i];
+		uint32_t slot = metric_slots[i];
+		
+		if (metric_types[i] == METRIC_COUNTER || metric_types[i] == METRIC_GAUGE) {
+			int64_t value = 0;
+			if (metric_types[i] == METRIC_GAUGE) {
+				value = __atomic_load_n(&gauges[slot], __ATOMIC_RELAXED);
+			} else {
+				for(shard_p shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard != NULL; shard = shard->next)
+					value += __atomic_load_n(&shard->counters[slot], __ATOMIC_RELAXED);
+			}
+			
+			if (json)
+				fprintf(f, "%s\n\t\"%s\": %" PRId64, separator, name, value);
+			else
+				fprintf(f, "%s %s %" PRId64 "\n", (metric_types[i] == METRIC_GAUGE) ? "gauge" : "counter", name, value);
+		} else {
+			histogram_t h;
+			histogram_collect(slot, &h);
+			
+			if (interval) {
+				histogram_t current = h;
+				histogram_p start = &interval_start[slot];
+				
+				h.count = current.count - start->count;
+				h.sum = current.sum - start->sum;
+				for(size_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+					h.buckets[b] = current.buckets[b] - start->buckets[b];
+				h.max = (h.count > 0) ? histogram_percentile(&h, 100) : 0;
+				
+				*start = current;
+			}
+			
+			double mean = (h.count > 0) ? (double)h.sum / h.count : 0;
+			uint64_t p50 = histogram_percentile(&h, 50), p90 = histogram_percentile(&h, 90);
+			uint64_t p99 = histogram_percentile(&h, 99), p999 = histogram_percentile(&h, 99.9);
+			
+			if (json) {
+				fprintf(f, "%s\n\t\"%s\": { \"count\": %" PRIu64 ", \"mean\": %.1lf, \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"p999\": %" PRIu64 ", \"max\": %" PRIu64 " }",
+					separator, name, h.count, mean, p50, p90, p99, p999, h.max);
+			} else {
+				fprintf(f, "histogram %s count %" PRIu64 " mean %.1lf p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64 " p999 %" PRIu64 " max %" PRIu64 "\n",
+					name, h.count, mean, p50, p90, p99, p999, h.max);
+			}
+		}
+		
+		separator = ",";
+	}
+	
+	if (json)
+		fprintf(f, "\n}}\n");
+	
+	if (interval)
+		interval_start_time = now;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pulse/pulseaudio.h>
+
+/**
+
+Counters, gauges and latency histograms that can be updated from any thread
+without locks and are exported over a unix socket.
+
+Every thread that records values gets its own shard of counters and histograms
+on first use. Only that thread writes into its shard (no locked instructions), the
+report sums up all shards. Histograms are log-linear (like HDR histograms): 16
+linear sub-buckets per power of two, so percentiles are off by 6.25% at most.
+
+Metrics have to be registered on the mainloop thread, recording works from all
+threads. Register them once at startup, there is room for METRICS_MAX metrics
+(at most METRICS_MAX_HISTOGRAMS of them histograms). Names aren't copied, use
+string literals.
+
+Basic API usage:
+
+metrics_start("hdswitch-metrics.sock", mainloop);
+
+metric_t compose_us = metrics_histogram("compose_us");
+metric_t frames     = metrics_counter("frames");
+metric_t clients    = metrics_gauge("clients");
+
+metrics_record(compose_us, 1250);
+metrics_add(frames, 1);
+metrics_set(clients, 3);
+
+metrics_stop();
+
+Reading the metrics (send "text" or "json", add "interval" to get percentiles of
+only the values recorded since the last interval report):
+
+echo json | socat - UNIX-CONNECT:hdswitch-metrics.sock
+echo "text interval" | socat - UNIX-CONNECT:hdswitch-metrics.sock
+
+*/
+
+#define METRICS_MAX            48
+#define METRICS_MAX_HISTOGRAMS 24
+
+typedef uint32_t metric_t;
+
+bool     metrics_start(const char* socket_path, pa_mainloop_api* mainloop);
+void     metrics_stop();
+
+metric_t metrics_counter(const char* name);
+metric_t metrics_gauge(const char* name);
+metric_t metrics_histogram(const char* name);
+
+void     metrics_add(metric_t counter, uint64_t value);
+void     metrics_set(metric_t gauge, int64_t value);
+void     metrics_record(metric_t histogram, uint64_t value);
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <pulse/pulseaudio.h>
 
 #include "timer.h"
+#include "metrics.h"
+#include "trace.h"
 #include "mixer.h"
 
 
@@ -21,7 +23,7 @@ uint32_t mixer_buffer_time_ms = 0;
 uint32_t max_latency_for_mixer_block_ms = 0;
 pa_sample_spec mixer_sample_spec;
 
-typedef struct mic_s mic_t, *mic_p;
+// Virtual mics have no stream, their audio data is written with mixer_virtual_mic_write()
 struct mic_s {
 	pa_stream* stream;
 	uint8_t state;
@@ -48,9 +50,14 @@ pa_context* context = NULL;
 uint16_t log_countdown = 0;
 static usec_t global_start_walltime = 0;
 
+metric_t mix_metric, dropped_packets_metric, late_bytes_metric, incomplete_metric;
+
 static void mixer_on_context_state_changed(pa_context *c, void *userdata);
 static void source_info_list_cb(pa_context *c, const pa_source_info *i, int eol, void *userdata);
 static void on_new_mic_data(pa_stream *s, size_t length, void *userdata);
+static void mix_mic_data(pa_stream *s, size_t length, mic_p mic);
+static void mix_packet(mic_p mic, const void* in_buffer_ptr, size_t in_buffer_size, bool log_packets);
+static void advance_mixer(bool log_packets);
 static void playback_audio(void* buffer_ptr, size_t buffer_size);
 
 
@@ -66,6 +73,11 @@ bool mixer_start(usec_t start_walltime, uint32_t requested_latency_ms, uint32_t
 	mixer_buffer_ptr = malloc(mixer_buffer_size);
 	memset(mixer_buffer_ptr, 0, mixer_buffer_size);
 	
+	mix_metric             = metrics_histogram("mixer_mix_us");
+	dropped_packets_metric = metrics_counter("mixer_dropped_packets");
+	late_bytes_metric      = metrics_counter("mixer_late_bytes");
+	incomplete_metric      = metrics_gauge("mixer_incomplete_us");
+	
 	context = pa_context_new(mainloop, "HDswitch");
 	pa_context_set_state_callback(context, mixer_on_context_state_changed, NULL);
 	pa_context_connect(context, NULL, 0, NULL);
@@ -84,6 +96,53 @@ void mixer_output_peek(void** buffer_ptr, size_t* buffer_size, uint64_t* buffer_
 	*buffer_pts  = mixer_pts - pa_bytes_to_usec(mixer_pos, &mixer_sample_spec);
 }
 
+/**
+ * Creates a mic that isn't backed by a Pulse Audio source. The audio data (in the mixer
+ * sample spec) is written with mixer_virtual_mic_write() and mixed in directly, without
+ * latency measurements. The mic starts at the current mixer PTS (or the current time if
+ * nothing was mixed yet). Only call it after mixer_start().
+ */
+mic_p mixer_virtual_mic_new(const char* name) {
+	mic_p mic = malloc(sizeof(mic_t));
+	mic->stream = NULL;
+	mic->state = MIC_STATE_MIXING;
+	mic->name = strdup(name);
+	mic->start = time_now();
+	
+	// Initialize the mixer PTS if no one is using the mixer yet
+	if (mixer_pts == 0)
+		mixer_pts = time_now() - global_start_walltime;
+	mic->pts = mixer_pts;
+	
+	mic->next = mics;
+	mics = mic;
+	
+	return mic;
+}
+
+void mixer_virtual_mic_write(mic_p mic, const void* samples, size_t size) {
+	uint64_t trace_start = trace_begin();
+	usec_t mix_start = time_now();
+	
+	mix_packet(mic, samples, size, false);
+	advance_mixer(false);
+	
+	metrics_record(mix_metric, time_now() - mix_start);
+	trace_end("virtual_mic_data", trace_start);
+}
+
+void mixer_virtual_mic_destroy(mic_p mic) {
+	for(mic_p* link = &mics; *link != NULL; link = &(*link)->next) {
+		if (*link == mic) {
+			*link = mic->next;
+			break;
+		}
+	}
+	
+	free(mic->name);
+	free(mic);
+}
+
 void mixer_output_consume() {
 	size_t remaining_size = mixer_buffer_size - mixer_pos;
 	// Move everything after the mixer pos to the start of the mixer buffer
@@ -182,8 +241,12 @@ static void source_info_list_cb(pa_context *c, const pa_source_info *i, int eol,
 
 
 static void on_new_mic_data(pa_stream *s, size_t length, void *userdata) {
-	mic_p mic = userdata;
-	
+	uint64_t trace_start = trace_begin();
+	mix_mic_data(s, length, userdata);
+	trace_end("mic_data", trace_start);
+}
+
+static void mix_mic_data(pa_stream *s, size_t length, mic_p mic) {
 	void print_packet_details(const char* description) {
 		printf("[mic %15.15s] %s after %.2lf ms, data: %zu bytes, %.2lf ms, latency: ",
 			mic->name, description, (time_now() - global_start_walltime) / 1000.0,
@@ -280,7 +343,7 @@ static void on_new_mic_data(pa_stream *s, size_t length, void *userdata) {
 			length, pa_bytes_to_usec(length, &mixer_sample_spec) / 1000.0);
 	
 	// Read all the audio data from the packet and mix it into the mixer buffer
-	uint64_t mixer_buffer_end_pts = mixer_pts + pa_bytes_to_usec(mixer_buffer_size - mixer_pos, &mixer_sample_spec);
+	usec_t mix_start = time_now();
 	while (pa_stream_readable_size(s) > 0) {
 		// Read the audio data and make sure we have enough space for it in the mixer
 		const void *in_buffer_ptr;
@@ -296,77 +359,99 @@ static void on_new_mic_data(pa_stream *s, size_t length, void *userdata) {
 			continue;
 		}
 		
-		uint64_t packet_start_pts = mic->pts;
-		uint64_t packet_duration = pa_bytes_to_usec(in_buffer_size, &mixer_sample_spec);
-		uint64_t packet_end_pts = packet_start_pts + packet_duration;
-		
-		if (in_buffer_ptr == NULL && in_buffer_size > 0) {
-			if (log_packets) printf("  hole of %zu bytes! skip ahead in mixer buffer.\n", in_buffer_size);
-			mic->pts += packet_duration;
-			continue;
-		}
-		
-		if (packet_end_pts > mixer_buffer_end_pts) {
-			if (log_packets) printf("  mixer buffer overflow, droping audio packet\n");
-			mic->pts += packet_duration;
-			pa_stream_drop(s);
-			continue;
-		}
-		
-		// Determine what part of the incomming audio data is new enough so we can write it
-		// into the mixer buffer.
-		const int16_t* in_samples_ptr = NULL;
-		size_t in_sample_count = 0, in_samples_size = 0;
-		uint64_t in_samples_pts = 0;
-		
-		if (packet_start_pts >= mixer_pts) {
-			// The audio packet is newer than the stuff emitted by the mixer. So we can write
-			// our entire audio into the mixer.
-			in_samples_ptr  = in_buffer_ptr;
-			in_samples_size = in_buffer_size;
-			in_sample_count = in_samples_size / sizeof(in_samples_ptr[0]);
-			in_samples_pts  = packet_start_pts;
-			if (log_packets) printf("  writing %zu bytes into mixer\n", in_samples_size);
-		} else if (packet_start_pts < mixer_pts && packet_end_pts > mixer_pts) {
-			// A part of the audio packet is to old but the rest is new stuff that should be
-			// written into the mixer.
-			size_t size_of_old_stuff = pa_usec_to_bytes(mixer_pts - packet_start_pts, &mixer_sample_spec);
-			in_samples_ptr  = in_buffer_ptr + size_of_old_stuff;
-			in_samples_size = in_buffer_size - size_of_old_stuff;
-			in_sample_count = in_samples_size / sizeof(in_samples_ptr[0]);
-			in_samples_pts  = mixer_pts;
-			if (log_packets) printf("  skipping %zu bytes, writing %zu bytes into mixer (pts: start %lu, end %lu, mixer %lu)\n",
-				size_of_old_stuff, in_samples_size, packet_start_pts, packet_end_pts, mixer_pts);
-		} else {
-			// This entire audio packet is to old. The mixer already emitted newer audio
-			// data. So throw this packet away.
-			if (log_packets) printf("  skipping %zu bytes (pts: start %lu, end %lu, mixer %lu)\n",
-				in_buffer_size, packet_start_pts, packet_end_pts, mixer_pts);
-		}
+		// Holes have to be dropped too, otherwise we would peek the same hole again
+		mix_packet(mic, in_buffer_ptr, in_buffer_size, log_packets);
+		pa_stream_drop(s);
+	}
+	
+	advance_mixer(log_packets);
+	metrics_record(mix_metric, time_now() - mix_start);
+}
+
+/**
+ * Mixes one packet of audio data of `mic` into the mixer buffer at the mics PTS and advances
+ * the PTS. A `NULL` pointer is a hole in the audio data and just advances the PTS.
+ */
+static void mix_packet(mic_p mic, const void* in_buffer_ptr, size_t in_buffer_size, bool log_packets) {
+	uint64_t mixer_buffer_end_pts = mixer_pts + pa_bytes_to_usec(mixer_buffer_size - mixer_pos, &mixer_sample_spec);
+	
+	uint64_t packet_start_pts = mic->pts;
+	uint64_t packet_duration = pa_bytes_to_usec(in_buffer_size, &mixer_sample_spec);
+	uint64_t packet_end_pts = packet_start_pts + packet_duration;
+	
+	if (in_buffer_ptr == NULL && in_buffer_size > 0) {
+		if (log_packets) printf("  hole of %zu bytes! skip ahead in mixer buffer.\n", in_buffer_size);
+		mic->pts += packet_duration;
+		return;
+	}
+	
+	if (packet_end_pts > mixer_buffer_end_pts) {
+		if (log_packets) printf("  mixer buffer overflow, droping audio packet\n");
+		metrics_add(dropped_packets_metric, 1);
+		mic->pts += packet_duration;
+		return;
+	}
+	
+	// Determine what part of the incomming audio data is new enough so we can write it
+	// into the mixer buffer.
+	const int16_t* in_samples_ptr = NULL;
+	size_t in_sample_count = 0, in_samples_size = 0;
+	uint64_t in_samples_pts = 0;
+	
+	if (packet_start_pts >= mixer_pts) {
+		// The audio packet is newer than the stuff emitted by the mixer. So we can write
+		// our entire audio into the mixer.
+		in_samples_ptr  = in_buffer_ptr;
+		in_samples_size = in_buffer_size;
+		in_sample_count = in_samples_size / sizeof(in_samples_ptr[0]);
+		in_samples_pts  = packet_start_pts;
+		if (log_packets) printf("  writing %zu bytes into mixer\n", in_samples_size);
+	} else if (packet_start_pts < mixer_pts && packet_end_pts > mixer_pts) {
+		// A part of the audio packet is to old but the rest is new stuff that should be
+		// written into the mixer.
+		size_t size_of_old_stuff = pa_usec_to_bytes(mixer_pts - packet_start_pts, &mixer_sample_spec);
+		in_samples_ptr  = in_buffer_ptr + size_of_old_stuff;
+		in_samples_size = in_buffer_size - size_of_old_stuff;
+		in_sample_count = in_samples_size / sizeof(in_samples_ptr[0]);
+		in_samples_pts  = mixer_pts;
+		metrics_add(late_bytes_metric, size_of_old_stuff);
+		if (log_packets) printf("  skipping %zu bytes, writing %zu bytes into mixer (pts: start %lu, end %lu, mixer %lu)\n",
+			size_of_old_stuff, in_samples_size, packet_start_pts, packet_end_pts, mixer_pts);
+	} else {
+		// This entire audio packet is to old. The mixer already emitted newer audio
+		// data. So throw this packet away.
+		if (log_packets) printf("  skipping %zu bytes (pts: start %lu, end %lu, mixer %lu)\n",
+			in_buffer_size, packet_start_pts, packet_end_pts, mixer_pts);
+		metrics_add(late_bytes_metric, in_buffer_size);
+	}
+	
+	if (in_samples_ptr) {
+		// Mix new samples into the mixer buffer
+		int16_t* mixer_samples_ptr = mixer_buffer_ptr + mixer_pos + pa_usec_to_bytes(in_samples_pts - mixer_pts, &mixer_sample_spec);
+		//int16_t* mixer_samples_ptr = mixer_buffer_ptr + stream_data->bytes_in_mixer_buffer;
 		
-		if (in_samples_ptr) {
-			// Mix new samples into the mixer buffer
-			int16_t* mixer_samples_ptr = mixer_buffer_ptr + mixer_pos + pa_usec_to_bytes(in_samples_pts - mixer_pts, &mixer_sample_spec);
-			//int16_t* mixer_samples_ptr = mixer_buffer_ptr + stream_data->bytes_in_mixer_buffer;
+		for(size_t i = 0; i < in_sample_count; i++) {
+			//mixer_samples_ptr[i] = in_samples_ptr[i];
 			
-			for(size_t i = 0; i < in_sample_count; i++) {
-				//mixer_samples_ptr[i] = in_samples_ptr[i];
-				
-				int16_t a = mixer_samples_ptr[i], b = in_samples_ptr[i];
-				if (a < 0 && b < 0)
-					mixer_samples_ptr[i] = (a + b) - (a * b) / INT16_MIN;
-				else if (a > 0 && b > 0)
-					mixer_samples_ptr[i] = (a + b) - (a * b) / INT16_MAX;
-				else
-					mixer_samples_ptr[i] = a + b;
-			}
+			int16_t a = mixer_samples_ptr[i], b = in_samples_ptr[i];
+			if (a < 0 && b < 0)
+				mixer_samples_ptr[i] = (a + b) - (a * b) / INT16_MIN;
+			else if (a > 0 && b > 0)
+				mixer_samples_ptr[i] = (a + b) - (a * b) / INT16_MAX;
+			else
+				mixer_samples_ptr[i] = a + b;
 		}
-		
-		// Advance the mics PTS and drop the consumed audio data
-		mic->pts += packet_duration;
-		pa_stream_drop(s);
 	}
 	
+	// Advance the mics PTS
+	mic->pts += packet_duration;
+}
+
+/**
+ * Checks if a part of the mixer buffer has been written to by all mixing mics. That part
+ * is played back and made available via mixer_output_peek().
+ */
+static void advance_mixer(bool log_packets) {
 	// Check if a part of the mixer buffer has been written to by all streams. In that case
 	// this part contains data from all streams and can be written out.
 	if (log_packets) printf("  mixer pts %.2lf ms, stream pts: ", mixer_pts / 1000.0);
@@ -396,6 +481,7 @@ static void on_new_mic_data(pa_stream *s, size_t length, void *userdata) {
 	if (log_packets) printf("finished: %.2lf ms, incomplete: %.2lf ms\n",
 		finished_duration / 1000.0, incomplete_duration / 1000.0);
 	
+	uint64_t mixer_buffer_end_pts = mixer_pts + pa_bytes_to_usec(mixer_buffer_size - mixer_pos, &mixer_sample_spec);
 	if (mixer_pts + finished_duration > mixer_buffer_end_pts) {
 		// There is no mixer buffer space left but the streams presentation timestamps (PTS)
 		// went ahead. So we have a finished buffer area that is larger than the rest of the
@@ -412,30 +498,8 @@ static void on_new_mic_data(pa_stream *s, size_t length, void *userdata) {
 		mixer_pos += finished_size;
 		mixer_pts += finished_duration;
 	}
-	/*
-	if (min_bytes_in_mixer > 0) {
-		playback_audio(mixer_buffer_ptr, min_bytes_in_mixer);
-		
-		server_enqueue_frame(2, mixer_pts, mixer_buffer_ptr, min_bytes_in_mixer);
-		
-		mixer_pts += pa_bytes_to_usec(min_bytes_in_mixer, &mixer_sample_spec);
-		
-		size_t incomplete_mixer_bytes = max_bytes_in_mixer - min_bytes_in_mixer;
-		if (incomplete_mixer_bytes > 0) {
-			memmove(mixer_buffer_ptr, mixer_buffer_ptr + min_bytes_in_mixer, incomplete_mixer_bytes);
-		}
-		// Always clear the buffer space written out, even if no bytes are incomplete
-		memset(mixer_buffer_ptr + incomplete_mixer_bytes, 0, max_bytes_in_mixer - incomplete_mixer_bytes);
-		
-		for(mic_p s = mics; s != NULL; s = s->next) {
-			// Ignore streams that have not yet received any data
-			if (s->bytes_in_mixer_buffer < 0)
-				continue;
-			
-			s->bytes_in_mixer_buffer -= min_bytes_in_mixer;
-		}
-	}
-	*/
+	
+	metrics_set(incomplete_metric, incomplete_duration);
 }
 
 
@@ -444,6 +508,10 @@ static void on_new_mic_data(pa_stream *s, size_t length, void *userdata) {
 //
 
 static void playback_audio(void* buffer_ptr, size_t buffer_size) {
+	// Without a Pulse Audio server (e.g. benchmarks with virtual mics) there is nothing to play on
+	if (pa_context_get_state(context) != PA_CONTEXT_READY)
+		return;
+	
 	if (audio_playback_stream == NULL) {
 		audio_playback_stream = pa_stream_new(context, "HDswitch", &mixer_sample_spec, NULL);
 		
@@ -5,8 +5,14 @@
 #include <pulse/pulseaudio.h>
 #include "timer.h"
 
+typedef struct mic_s mic_t, *mic_p;
+
 bool mixer_start(usec_t start_walltime, uint32_t requested_latency_ms, uint32_t buffer_time_ms, uint32_t max_latency_to_block_for_ms, pa_sample_spec sample_spec, pa_mainloop_api* mainloop);
 void mixer_stop();
 
 void mixer_output_peek(void** buffer_ptr, size_t* buffer_size, uint64_t* buffer_pts);
-void mixer_output_consume();
\ No newline at end of file
+void mixer_output_consume();
+
+mic_p mixer_virtual_mic_new(const char* name);
+void  mixer_virtual_mic_write(mic_p mic, const void* samples, size_t size);
+void  mixer_virtual_mic_destroy(mic_p mic);
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "pool.h"
+
+
+// Blocks and chunks are aligned like malloc() memory. Chunks start with the pointer
+// to the next chunk, padded to this alignment.
+#define POOL_ALIGNMENT  16
+#define align(size)     ( ((size) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1) )
+
+// Every buffer of a buffer pool is preceded by a header that stores its size class
+// (or BUFFER_POOL_UNPOOLED for buffers larger than the largest class)
+#define BUFFER_POOL_UNPOOLED  UINT32_MAX
+#define BUFFER_HEADER_SIZE    POOL_ALIGNMENT
+
+
+pool_p pool_new(size_t block_size, size_t blocks_per_chunk) {
+	pool_p pool = malloc(sizeof(pool_t));
+	if (pool == NULL)
+		return NULL;
+	
+	// Free blocks store the free list pointer in their first bytes
+	pool->block_size = align( (block_size > sizeof(void*)) ? block_size : sizeof(void*) );
+	pool->blocks_per_chunk = (blocks_per_chunk > 0) ? blocks_per_chunk : 1;
+	pool->free_blocks = NULL;
+	pool->chunks = NULL;
+	pool->hits = 0;
+	pool->misses = 0;
+	
+	return pool;
+}
+
+void pool_destroy(pool_p pool) {
+	void* next = NULL;
+	for(void* chunk = pool->chunks; chunk != NULL; chunk = next) {
+		next = *(void**)chunk;
+		free(chunk);
+	}
+	
+	free(pool);
+}
+
+/**
+ * Returns a block from the free list. If it's empty a new chunk is allocated and
+ * its blocks are put into the free list. Returns `NULL` if that allocation failed.
+ */
+void* pool_alloc(pool_p pool) {
+	if (pool->free_blocks == NULL) {
+		char* chunk = malloc(align(sizeof(void*)) + pool->block_size * pool->blocks_per_chunk);
+		if (chunk == NULL)
+			return NULL;
+		
+		*(void**)chunk = pool->chunks;
+		pool->chunks = chunk;
+		
+		// Put the blocks into the free list in reverse so they're handed out in order
+		char* blocks = chunk + align(sizeof(void*));
+		for(size_t i = pool->blocks_per_chunk; i > 0; i--) {
+			void* block = blocks + (i - 1) * pool->block_size;
+			*(void**)block = pool->free_blocks;
+			pool->free_blocks = block;
+		}
+		
+		pool->misses++;
+	} else {
+		pool->hits++;
+	}
+	
+	void* block = pool->free_blocks;
+	pool->free_blocks = *(void**)block;
+	return block;
+}
+
+void pool_free(pool_p pool, void* block) {
+	if (block == NULL)
+		return;
+	
+	*(void**)block = pool->free_blocks;
+	pool->free_blocks = block;
+}
+
+
+
+buffer_pool_p buffer_pool_new() {
+	buffer_pool_p pool = malloc(sizeof(buffer_pool_t));
+	if (pool == NULL)
+		return NULL;
+	
+	// Created on first use, most size classes are never needed
+	for(size_t i = 0; i < BUFFER_POOL_CLASSES; i++)
+		pool->classes[i] = NULL;
+	pool->hits = 0;
+	pool->misses = 0;
+	
+	return pool;
+}
+
+void buffer_pool_destroy(buffer_pool_p pool) {
+	for(size_t i = 0; i < BUFFER_POOL_CLASSES; i++) {
+		if (pool->classes[i])
+			pool_destroy(pool->classes[i]);
+	}
+	
+	free(pool);
+}
+
+/**
+ * Returns a buffer of at least `size` bytes. Buffers are rounded up to the next size
+ * class and taken from its pool. Returns `NULL` if the allocation failed.
+ */
+void* buffer_pool_alloc(buffer_pool_p pool, size_t size) {
+	size_t size_class = 0;
+	while (size_class < BUFFER_POOL_CLASSES && ((size_t)1 << (size_class + BUFFER_POOL_MIN_SIZE_LOG2)) < size)
+		size_class++;
+	
+	char* block = NULL;
+	if (size_class < BUFFER_POOL_CLASSES) {
+		if (pool->classes[size_class] == NULL) {
+			// Large buffers come one at a time, small ones in chunks of 16
+			size_t class_size = (size_t)1 << (size_class + BUFFER_POOL_MIN_SIZE_LOG2);
+			pool->classes[size_class] = pool_new(BUFFER_HEADER_SIZE + class_size, (class_size < 64 * 1024) ? 16 : 1);
+			if (pool->classes[size_class] == NULL)
+				return NULL;
+		}
+		
+		pool_p class_pool = pool->classes[size_class];
+		uint64_t misses = class_pool->misses;
+		block = pool_alloc(class_pool);
+		if (block == NULL)
+			return NULL;
+		
+		if (class_pool->misses != misses)
+			pool->misses++;
+		else
+			pool->hits++;
+		*(uint32_t*)block = size_class;
+	} else {
+		block = malloc(BUFFER_HEADER_SIZE + size);
+		if (block == NULL)
+			return NULL;
+		
+		pool->misses++;
+		*(uint32_t*)block = BUFFER_POOL_UNPOOLED;
+	}
+	
+	return block + BUFFER_HEADER_SIZE;
+}
+
+void buffer_pool_free(buffer_pool_p pool, void* buffer) {
+	if (buffer == NULL)
+		return;
+	
+	char* block = (char*)buffer - BUFFER_HEADER_SIZE;
+	uint32_t size_class = *(uint32_t*)block;
+	
+	if (size_class == BUFFER_POOL_UNPOOLED)
+		free(block);
+	else
+		pool_free(pool->classes[size_class], block);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/**
+
+# Pool allocators
+
+A pool hands out blocks of one fixed size and keeps freed blocks in a free list
+to hand them out again. New blocks are allocated in chunks of several blocks at
+once. Once the pool has grown to the peak number of blocks in use it does no
+more heap allocations. All memory is freed by pool_destroy(), including blocks
+still in use.
+
+pool_p pool = pool_new(sizeof(foo_t), 64);
+foo_p foo = pool_alloc(pool);
+pool_free(pool, foo);
+pool_destroy(pool);
+
+
+A buffer pool does the same for variable sized buffers. It has one pool per size
+class (powers of two from 4 KiByte to 64 MiByte). Larger buffers are allocated
+with malloc() every time.
+
+buffer_pool_p buffers = buffer_pool_new();
+void* buffer = buffer_pool_alloc(buffers, 640*480*2);
+buffer_pool_free(buffers, buffer);
+buffer_pool_destroy(buffers);
+
+
+`hits` counts allocations served from the free list, `misses` allocations that
+needed new memory from the heap. Pools are not thread safe.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+typedef struct {
+	size_t block_size, blocks_per_chunk;
+	// Both lists are linked through the first pointer of their blocks and chunks
+	void* free_blocks;
+	void* chunks;
+	uint64_t hits, misses;
+} pool_t, *pool_p;
+
+pool_p pool_new(size_t block_size, size_t blocks_per_chunk);
+void   pool_destroy(pool_p pool);
+void*  pool_alloc(pool_p pool);
+void   pool_free(pool_p pool, void* block);
+
+
+#define BUFFER_POOL_MIN_SIZE_LOG2  12
+#define BUFFER_POOL_MAX_SIZE_LOG2  26
+#define BUFFER_POOL_CLASSES        (BUFFER_POOL_MAX_SIZE_LOG2 - BUFFER_POOL_MIN_SIZE_LOG2 + 1)
+
+typedef struct {
+	pool_p classes[BUFFER_POOL_CLASSES];
+	uint64_t hits, misses;
+} buffer_pool_t, *buffer_pool_p;
+
+buffer_pool_p buffer_pool_new();
+void          buffer_pool_destroy(buffer_pool_p pool);
+void*         buffer_pool_alloc(buffer_pool_p pool, size_t size);
+void          buffer_pool_free(buffer_pool_p pool, void* buffer);
@@ -2,14 +2,20 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <errno.h>
 
 #include "list.h"
+#include "pool.h"
 #include "ebml_writer.h"
+#include "timer.h"
+#include "metrics.h"
+#include "trace.h"
 #include "server.h"
 
 
@@ -17,17 +23,26 @@ typedef struct {
 	int fd;
 	pa_io_event* io_event;
 	
-	void* ptr;
-	size_t size;
+	// Data left to write, a cluster header and the frame data of a buffer
+	struct iovec iov[2];
+	int iov_count;
 	
 	list_node_p current_buffer_node;
 	list_node_p disconnect_at_node;
 } client_t, *client_p;
 
+// Cluster (4 byte ID, 8 byte size), Timecode (1 byte ID, 1 byte size, 8 byte value),
+// SimpleBlock (1 byte ID, 8 byte size, 1 byte track number, 2 byte timecode, 1 byte flags)
+#define MKV_CLUSTER_HEADER_SIZE  (4 + 8 + 1 + 1 + 8 + 1 + 8 + 1 + 2 + 1)
+
+// Buffers reference the frame instead of copying it, the cluster header is written
+// before the frame data.
 typedef struct {
-	void*  ptr;
-	size_t size;
-	size_t refcount;
+	uint8_t header[MKV_CLUSTER_HEADER_SIZE];
+	size_t  header_size;
+	frame_p frame;
+	size_t  refcount;
+	usec_t  enqueued;
 } buffer_t, *buffer_p;
 
 pa_mainloop_api *server_mainloop = NULL;
@@ -36,7 +51,21 @@ int server_fd = -1;
 list_p clients = NULL;
 list_p buffers = NULL;
 
-buffer_t header;
+char*  header_ptr = NULL;
+size_t header_size = 0;
+
+// Nodes of the client and buffer lists are reused. Once the pools grew to the peak
+// number of queued buffers streaming doesn't touch the heap.
+pool_p client_node_pool = NULL, buffer_node_pool = NULL;
+metric_t pool_hits_metric, pool_misses_metric;
+
+// Per client stages are recorded into shared histograms, the lag is the time from
+// enqueuing a buffer until a client wrote the last byte of it.
+size_t buffer_count = 0;
+metric_t client_write_metric, client_lag_metric, bytes_written_metric, disconnects_metric;
+metric_t clients_metric, queued_buffers_metric;
+// Capture to last client write, only recorded for frames with a capture time
+metric_t latency_metric;
 
 
 static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
@@ -45,6 +74,10 @@ static void on_client_disconnect(pa_mainloop_api *mainloop, list_node_p client_n
 
 static void mkv_build_header(uint16_t width, uint16_t height, uint32_t sample_rate, uint8_t channels, uint8_t bits_per_sample);
 static void buffer_node_unref(list_node_p buffer_node);
+static size_t mkv_write_cluster_header(uint8_t* ptr, uint8_t track, uint64_t timecode_us, size_t frame_size);
+static void update_pool_metrics();
+static void client_set_buffer(client_p client, buffer_p buffer);
+static void client_consume(client_p client, size_t bytes);
 
 
 
@@ -65,10 +98,22 @@ bool server_start(const char* socket_path, uint16_t width, uint16_t height, uint
 	if ( listen(server_fd, 3) == -1 )
 		return perror("[server] listen"), false;
 	
-	clients = list_of(client_t);
-	buffers = list_of(buffer_t);
+	client_node_pool = pool_new(list_node_size(sizeof(client_t)), 16);
+	buffer_node_pool = pool_new(list_node_size(sizeof(buffer_t)), 64);
+	clients = list_of_pooled(client_t, client_node_pool);
+	buffers = list_of_pooled(buffer_t, buffer_node_pool);
 	mkv_build_header(width, height, sample_rate, channels, bits_per_sample);
 	
+	client_write_metric   = metrics_histogram("server_client_write_us");
+	client_lag_metric     = metrics_histogram("server_client_lag_us");
+	bytes_written_metric  = metrics_counter("server_bytes_written");
+	disconnects_metric    = metrics_counter("server_client_disconnects");
+	clients_metric        = metrics_gauge("server_clients");
+	queued_buffers_metric = metrics_gauge("server_queued_buffers");
+	latency_metric        = metrics_histogram("latency_socket_us");
+	pool_hits_metric      = metrics_gauge("server_pool_hits");
+	pool_misses_metric    = metrics_gauge("server_pool_misses");
+	
 	server_mainloop = mainloop;
 	server_mainloop->io_new(server_mainloop, server_fd, PA_IO_EVENT_INPUT, on_accept, NULL);
 	
@@ -85,13 +130,20 @@ void server_stop() {
 	list_destroy(clients);
 	close(server_fd);
 	
+	for(list_node_p n = buffers->first; n != NULL; n = n->next) {
+		buffer_p buffer = list_value_ptr(n);
+		frame_unref(buffer->frame);
+	}
 	list_destroy(buffers);
-	free(header.ptr);
+	free(header_ptr);
+	
+	pool_destroy(buffer_node_pool);
+	pool_destroy(client_node_pool);
 	
 	unlink(server_socket_path);
 }
 
-void server_enqueue_frame(uint8_t track, uint64_t timecode_us, void* frame_data, size_t frame_size) {
+void server_enqueue_frame(uint8_t track, frame_p frame) {
 	size_t connected_client_count = list_count(clients);
 	// Throw the buffer away if no one is listening
 	if (connected_client_count == 0)
@@ -100,27 +152,11 @@ void server_enqueue_frame(uint8_t track, uint64_t timecode_us, void* frame_data,
 	//printf("[server] queuing frame\n");
 	buffer_p buffer = list_append_ptr(buffers);
 	buffer->refcount = connected_client_count;
-	
-	FILE* f = open_memstream((char**)&buffer->ptr, &buffer->size);
-	
-	off_t o2, o3;
-	o2 = ebml_element_start(f, MKV_Cluster);
-		ebml_element_uint(f, MKV_Timecode, timecode_us);
-		o3 = ebml_element_start(f, MKV_SimpleBlock);
-			// Track number this frame belongs to
-			ebml_write_data_size(f, track, 0);
-			
-			int16_t block_timecode = 0;
-			fwrite(&block_timecode, sizeof(block_timecode), 1, f);
-			
-			uint8_t flags = 0x80; // keyframe (1), reserved (000), not invisible (0), no lacing (00), not discardable (0)
-			fwrite(&flags, sizeof(flags), 1, f);
-			
-			fwrite(frame_data, frame_size, 1, f);
-		ebml_element_end(f, o3);
-	ebml_element_end(f, o2);
-	
-	fclose(f);
+	buffer->enqueued = time_now();
+	buffer->frame = frame_ref(frame);
+	buffer->header_size = mkv_write_cluster_header(buffer->header, track, frame->timestamp, frame->size);
+	metrics_set(queued_buffers_metric, ++buffer_count);
+	update_pool_metrics();
 	
 	// Check all clients and resume writing if necessary
 	for(list_node_p n = clients->first; n != NULL; n = n->next) {
@@ -129,10 +165,8 @@ void server_enqueue_frame(uint8_t track, uint64_t timecode_us, void* frame_data,
 		if (client->current_buffer_node == NULL) {
 			// Switch client to the new buffer it it's stalled
 			client->current_buffer_node = buffers->last;
-			if (client->ptr == NULL) {
-				client->ptr  = buffer->ptr;
-				client->size = buffer->size;
-			}
+			if (client->iov_count == 0)
+				client_set_buffer(client, buffer);
 			
 			// Enable this client in the mainloop
 			//printf("[client %d] resuming\n", client->fd);
@@ -163,48 +197,57 @@ static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_e
 	
 	client_p client = list_append_ptr(clients);
 	list_node_p client_node = clients->last;
+	update_pool_metrics();
 	
 	client->fd = client_fd;
 	client->io_event = mainloop->io_new(mainloop, client->fd, PA_IO_EVENT_OUTPUT, on_client_writable, client_node);
 	
-	client->ptr = header.ptr;
-	client->size = header.size;
+	client->iov[0] = (struct iovec){ header_ptr, header_size };
+	client->iov_count = 1;
 	client->current_buffer_node = NULL;
 	client->disconnect_at_node = NULL;
 	
+	metrics_set(clients_metric, list_count(clients));
 	printf("[client %d] connected\n", client->fd);
 }
 
 static void on_client_writable(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
 	client_p client = list_value_ptr(userdata);
 	//printf("[client %d] writing data\n", client->fd);
+	usec_t start = time_now();
+	uint64_t trace_start = trace_begin();
 	
 	while (true) {
 		ssize_t bytes_written = 0;
-		while (client->size > 0) {
-			bytes_written = write(client->fd, client->ptr, client->size);
+		while (client->iov_count > 0) {
+			bytes_written = writev(client->fd, client->iov, client->iov_count);
 			if (bytes_written < 0) {
 				if (errno == EWOULDBLOCK) {
 					// Very common case, do nothing
 				} else if (errno == EPIPE) {
 					on_client_disconnect(mainloop, userdata);
 				} else {
-					perror("write");
+					perror("writev");
 				}
 				break;
 			}
 			
-			client->ptr  += bytes_written;
-			client->size -= bytes_written;
+			client_consume(client, bytes_written);
+			metrics_add(bytes_written_metric, bytes_written);
 		}
 		
 		if (bytes_written >= 0) {
 			// Buffer finished, switch to next one
-			client->ptr = NULL;
 			
 			if (client->current_buffer_node != NULL) {
 				list_node_p finished_buffer_node = client->current_buffer_node;
 				client->current_buffer_node = client->current_buffer_node->next;
+				
+				buffer_p finished_buffer = list_value_ptr(finished_buffer_node);
+				metrics_record(client_lag_metric, time_now() - finished_buffer->enqueued);
+				// The last client to write the buffer completes the frame
+				if (finished_buffer->frame->capture_time != 0 && finished_buffer->refcount == 1)
+					metrics_record(latency_metric, time_monotonic() - finished_buffer->frame->capture_time);
 				buffer_node_unref(finished_buffer_node);
 			}
 			
@@ -219,9 +262,7 @@ static void on_client_writable(pa_mainloop_api *mainloop, pa_io_event *e, int fd
 			if (client->current_buffer_node != NULL) {
 				// There is a next buffer ready. Switch this client to it.
 				//printf("[client %d] switching to next buffer\n", client->fd);
-				buffer_p next_buffer = list_value_ptr(client->current_buffer_node);
-				client->ptr  = next_buffer->ptr;
-				client->size = next_buffer->size;
+				client_set_buffer(client, list_value_ptr(client->current_buffer_node));
 			} else {
 				// No next buffer, the client is stalled now. Disable it from the
 				// mainloop since we don't have any data to write. We'll resume when
@@ -235,6 +276,9 @@ static void on_client_writable(pa_mainloop_api *mainloop, pa_io_event *e, int fd
 			break;
 		}
 	}
+	
+	metrics_record(client_write_metric, time_now() - start);
+	trace_end("client_write", trace_start);
 }
 
 static void on_client_disconnect(pa_mainloop_api *mainloop, list_node_p client_node) {
@@ -255,6 +299,9 @@ static void on_client_disconnect(pa_mainloop_api *mainloop, list_node_p client_n
 	}
 	
 	list_remove(clients, client_node);
+	
+	metrics_add(disconnects_metric, 1);
+	metrics_set(clients_metric, list_count(clients));
 }
 
 
@@ -263,8 +310,14 @@ static void on_client_disconnect(pa_mainloop_api *mainloop, list_node_p client_n
 // Utility functions
 //
 
+static uint8_t* write_be(uint8_t* ptr, uint64_t value, size_t bytes) {
+	for(size_t i = 0; i < bytes; i++)
+		ptr[i] = value >> ((bytes - 1 - i) * 8);
+	return ptr + bytes;
+}
+
 static void mkv_build_header(uint16_t width, uint16_t height, uint32_t sample_rate, uint8_t channels, uint8_t bits_per_sample) {
-	FILE* f = open_memstream((char**)&header.ptr, &header.size);
+	FILE* f = open_memstream(&header_ptr, &header_size);
 	
 	off_t o1, o2, o3, o4;
 	
@@ -327,13 +380,73 @@ static void mkv_build_header(uint16_t width, uint16_t height, uint32_t sample_ra
 	fclose(f);
 }
 
+/**
+ * Writes the Cluster, Timecode and SimpleBlock element headers for a frame of
+ * `frame_size` bytes. The frame data has to follow directly after the returned
+ * number of bytes (at most MKV_CLUSTER_HEADER_SIZE). Sizes are always written with
+ * 8 byte long vints, so they can be written before the frame is copied.
+ */
+static size_t mkv_write_cluster_header(uint8_t* ptr, uint8_t track, uint64_t timecode_us, size_t frame_size) {
+	uint8_t* p = ptr;
+	uint64_t block_size = 1 + 2 + 1 + frame_size;
+	uint64_t cluster_size = 1 + 1 + 8 + 1 + 8 + block_size;
+	
+	// Cluster
+	p = write_be(p, MKV_Cluster, 4);
+	p = write_be(p, 0x0100000000000000 | cluster_size, 8);
+		// Timecode
+		p = write_be(p, MKV_Timecode, 1);
+		p = write_be(p, 0x88, 1);
+		p = write_be(p, timecode_us, 8);
+		// SimpleBlock
+		p = write_be(p, MKV_SimpleBlock, 1);
+		p = write_be(p, 0x0100000000000000 | block_size, 8);
+			// Track number this frame belongs to as 1 byte vint and the block timecode
+			p = write_be(p, 0x80 | track, 1);
+			p = write_be(p, 0, 2);
+			// keyframe (1), reserved (000), not invisible (0), no lacing (00), not discardable (0)
+			p = write_be(p, 0x80, 1);
+	
+	return p - ptr;
+}
+
+static void update_pool_metrics() {
+	metrics_set(pool_hits_metric,   buffer_node_pool->hits   + client_node_pool->hits);
+	metrics_set(pool_misses_metric, buffer_node_pool->misses + client_node_pool->misses);
+}
+
+static void client_set_buffer(client_p client, buffer_p buffer) {
+	client->iov[0] = (struct iovec){ buffer->header, buffer->header_size };
+	client->iov[1] = (struct iovec){ buffer->frame->ptr, buffer->frame->size };
+	client->iov_count = 2;
+}
+
+/**
+ * Advances the iovecs of the client by `bytes` written bytes. Finished iovecs are
+ * removed (including empty ones), `iov_count` is 0 when everything was written.
+ */
+static void client_consume(client_p client, size_t bytes) {
+	while ( client->iov_count > 0 && (bytes > 0 || client->iov[0].iov_len == 0) ) {
+		size_t consumed = (bytes < client->iov[0].iov_len) ? bytes : client->iov[0].iov_len;
+		client->iov[0].iov_base = (uint8_t*)client->iov[0].iov_base + consumed;
+		client->iov[0].iov_len -= consumed;
+		bytes -= consumed;
+		
+		if (client->iov[0].iov_len == 0) {
+			client->iov[0] = client->iov[1];
+			client->iov_count--;
+		}
+	}
+}
+
 static void buffer_node_unref(list_node_p buffer_node) {
 	buffer_p buffer = list_value_ptr(buffer_node);
 	buffer->refcount--;
 	
 	if (buffer->refcount == 0) {
-		free(buffer->ptr);
+		frame_unref(buffer->frame);
 		list_remove(buffers, buffer_node);
+		metrics_set(queued_buffers_metric, --buffer_count);
 		//printf("[server] freeing buffer\n");
 	}
 }
\ No newline at end of file
@@ -4,7 +4,12 @@
 #include <stdbool.h>
 #include <pulse/pulseaudio.h>
 
+#include "frame.h"
+
 bool server_start(const char* socket_path, uint16_t width, uint16_t height, uint32_t sample_rate, uint8_t channels, uint8_t bits_per_sample, pa_mainloop_api* mainloop);
 void server_stop();
-void server_enqueue_frame(uint8_t track, uint64_t timecode_us, void* frame_data, size_t frame_size);
+// The server takes its own reference of the frame and drops it when all clients wrote it. The
+// timestamp of the frame is used as timecode, the capture time to measure the latency until the
+// last client wrote the frame.
+void server_enqueue_frame(uint8_t track, frame_p frame);
 void server_flush_and_disconnect_clients();
\ No newline at end of file
@@ -0,0 +1,8 @@
+#version 130
+
+uniform sampler2DRect tex;
+varying vec2 tex_coords;
+
+void main(){
+	gl_FragColor = texture2DRect(tex, tex_coords);
+}
\ No newline at end of file
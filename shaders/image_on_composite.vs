@@ -0,0 +1,14 @@
+#version 130
+
+// Draws a whole image into `rect` (left, top, right and bottom edge in normalized device
+// coordinates). pos_and_tex.xy is the corner of a unit quad, tex_size the image size.
+attribute vec4 pos_and_tex;
+uniform   vec4 rect;
+uniform   vec2 tex_size;
+varying   vec2 tex_coords;
+
+void main(){
+	gl_Position.xy = mix(rect.xy, rect.zw, pos_and_tex.xy);
+	gl_Position.zw = vec2(0, 1);
+	tex_coords.xy = pos_and_tex.xy * tex_size;
+}
\ No newline at end of file
@@ -1,11 +1,17 @@
-#version 120
+#version 130
 
+// One instance per glyph: pos_and_tex is the top left corner of the glyph on the screen
+// and in the texture, instance_data.xy its size on the screen and instance_data.zw in the
+// texture (they differ for scaled text). Each instance is drawn as a triangle strip of 4
+// vertices, gl_VertexID tells which corner we are.
 attribute vec4 pos_and_tex;
+attribute vec4 instance_data;
 varying   vec2 tex_coords;
 uniform   mat3 screen_to_normal;
 
 void main(){
-	gl_Position.xy = (screen_to_normal * vec3(pos_and_tex.xy, 1)).xy;
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	gl_Position.xy = (screen_to_normal * vec3(pos_and_tex.xy + corner * instance_data.xy, 1)).xy;
 	gl_Position.zw = vec2(0, 1);
-	tex_coords.xy = pos_and_tex.zw;
+	tex_coords.xy = pos_and_tex.zw + corner * instance_data.zw;
 }
\ No newline at end of file
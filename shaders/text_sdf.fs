@@ -0,0 +1,33 @@
+#version 120
+
+// Draws glyphs of signed distance field fonts (see text_renderer_sdf_font_new()). 0.5 is
+// on the outline of the glyph and one pixel of the field is 0.5 / spread. outline_width
+// and shadow_offset are in those pixels and together have to stay below the spread.
+uniform sampler2DRect tex;
+uniform float spread = 6.0;
+uniform vec4  color = vec4(0, 1, 0, 1);
+uniform float outline_width = 0.0;
+uniform vec4  outline_color = vec4(0, 0, 0, 1);
+uniform vec2  shadow_offset = vec2(0, 0);
+uniform vec4  shadow_color = vec4(0, 0, 0, 0);
+varying vec2 tex_coords;
+
+void main(){
+	float dist = texture2DRect(tex, tex_coords).r;
+	// Half a screen pixel in distance units, keeps the edges sharp at any size
+	float aa = max(fwidth(dist) * 0.5, 0.001);
+	
+	float edge = 0.5 - outline_width * 0.5 / spread;
+	float fill = smoothstep(0.5 - aa, 0.5 + aa, dist);
+	float outline = smoothstep(edge - aa, edge + aa, dist);
+	vec4 text_color = (outline_width > 0.0) ? mix(outline_color, color, fill) : color;
+	float text_alpha = text_color.a * outline;
+	
+	float shadow_dist = texture2DRect(tex, tex_coords - shadow_offset).r;
+	float shadow_alpha = shadow_color.a * smoothstep(edge - aa, edge + aa, shadow_dist);
+	
+	// Text over its shadow
+	float alpha = text_alpha + shadow_alpha * (1.0 - text_alpha);
+	vec3 rgb = (text_color.rgb * text_alpha + shadow_color.rgb * shadow_alpha * (1.0 - text_alpha)) / max(alpha, 0.001);
+	gl_FragColor = vec4(rgb, alpha);
+}
\ No newline at end of file
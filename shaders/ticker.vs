@@ -0,0 +1,20 @@
+#version 130
+
+// Like text.vs but for the ring of glyphs of a ticker (see ticker.h). All glyphs are moved
+// left by `scroll` and clipped to the lane between lane.x and lane.y (screen x positions).
+attribute vec4 pos_and_tex;
+attribute vec4 instance_data;
+varying   vec2 tex_coords;
+uniform   mat3 screen_to_normal;
+uniform   float scroll;
+uniform   vec2 lane;
+
+void main(){
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 pos = pos_and_tex.xy + corner * instance_data.xy - vec2(scroll, 0);
+	gl_Position.xy = (screen_to_normal * vec3(pos, 1)).xy;
+	gl_Position.zw = vec2(0, 1);
+	gl_ClipDistance[0] = pos.x - lane.x;
+	gl_ClipDistance[1] = lane.y - pos.x;
+	tex_coords.xy = pos_and_tex.zw + corner * instance_data.zw;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 130
+
+/**
+
+Blends the scene we transition to over the current scene.
+
+fade:   Opacity of the new scene, used for crossfades (1 for wipes).
+wipe_x: The new scene is only shown left of this x coordinate (in pixels). The
+        edge is smoothed over 8 pixels. Set it beyond the right border for
+        crossfades.
+
+*/
+
+uniform sampler2DRect tex;
+uniform float fade;
+uniform float wipe_x;
+varying vec2 tex_coords;
+
+void main(){
+	float wipe = clamp((wipe_x - tex_coords.x) / 8.0 + 0.5, 0.0, 1.0);
+	gl_FragColor = vec4(texture2DRect(tex, tex_coords).rgb, fade * wipe);
+}
\ No newline at end of file
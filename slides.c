@@ -0,0 +1,464 @@
+// For accept4(), asprintf(), strdup() and versionsort()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "drawable.h"
+#include "stb_image.h"
+#include "yuyv.h"
+#include "slides.h"
+
+
+static void     prefetch(slides_p slides);
+static bool     in_window(slides_p slides, size_t index);
+static void     wake_up(slides_p slides);
+static uint8_t* load_slide(const char* path, size_t width, size_t height);
+static void*    worker_main(void* arg);
+static int      is_image(const struct dirent* entry);
+
+static void run_command(slides_p slides, const char* command);
+static void close_client(slides_client_p client);
+
+static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void on_client_data(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+
+
+/**
+ * Creates a deck of all PNG and JPEG files in `directory`, shown as an input of `width`
+ * times `height` pixels (`width` has to be even for YUYV). Starts decoding the first
+ * slides right away.
+ * 
+ * Returns `NULL` if the directory can't be read or contains no images.
+ */
+slides_p slides_new(const char* directory, size_t width, size_t height) {
+	struct dirent** entries = NULL;
+	int entry_count = scandir(directory, &entries, is_image, versionsort);
+	if (entry_count == -1) {
+		fprintf(stderr, "[slides] %s: %s\n", directory, strerror(errno));
+		return NULL;
+	} else if (entry_count == 0) {
+		fprintf(stderr, "[slides] %s: no PNG or JPEG files\n", directory);
+		free(entries);
+		return NULL;
+	}
+	
+	slides_p slides = malloc(sizeof(slides_t));
+	memset(slides, 0, sizeof(slides_t));
+	
+	slides->width = width;
+	slides->height = height;
+	slides->paths = array_of(char*);
+	slides->slides = array_of(slides_slide_t);
+	for(int i = 0; i < entry_count; i++) {
+		char* path = NULL;
+		asprintf(&path, "%s/%s", directory, entries[i]->d_name);
+		array_append(slides->paths, char*, path);
+		array_append(slides->slides, slides_slide_t, ((slides_slide_t){ SLIDES_EMPTY, 0 }));
+		free(entries[i]);
+	}
+	free(entries);
+	
+	slides->current = 0;
+	slides->shown = (size_t)-1;
+	slides->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (slides->fd == -1)
+		perror("[slides] eventfd");
+	
+	slides->jobs = array_of(size_t);
+	slides->decoded = array_of(slides_image_t);
+	slides->workers_quit = false;
+	pthread_mutex_init(&slides->lock, NULL);
+	pthread_cond_init(&slides->jobs_added, NULL);
+	for(size_t i = 0; i < SLIDES_WORKERS; i++) {
+		int err = pthread_create(&slides->workers[i], NULL, worker_main, slides);
+		if (err != 0)
+			fprintf(stderr, "slides_new(): pthread_create() failed: %s\n", strerror(err));
+	}
+	
+	slides->socket_fd = -1;
+	slides->clients = array_of(slides_client_p);
+	
+	printf("[slides] %s: %zu slides\n", directory, slides->paths->length);
+	prefetch(slides);
+	return slides;
+}
+
+/**
+ * Stops the workers (slides they didn't start to decode yet are skipped), destroys all
+ * textures and closes the socket.
+ */
+void slides_destroy(slides_p slides) {
+	pthread_mutex_lock(&slides->lock);
+		slides->workers_quit = true;
+		pthread_cond_broadcast(&slides->jobs_added);
+	pthread_mutex_unlock(&slides->lock);
+	for(size_t i = 0; i < SLIDES_WORKERS; i++)
+		pthread_join(slides->workers[i], NULL);
+	
+	for(size_t i = 0; i < slides->decoded->length; i++)
+		free( array_elem(slides->decoded, slides_image_t, i).pixels );
+	array_destroy(slides->decoded);
+	array_destroy(slides->jobs);
+	
+	while (slides->clients->length > 0)
+		close_client(array_elem(slides->clients, slides_client_p, 0));
+	array_destroy(slides->clients);
+	
+	if (slides->socket_fd != -1) {
+		slides->mainloop->io_free(slides->accept_event);
+		close(slides->socket_fd);
+		unlink(slides->socket_path);
+		free(slides->socket_path);
+	}
+	
+	for(size_t i = 0; i < slides->slides->length; i++) {
+		slides_slide_p slide = array_elem_ptr(slides->slides, i);
+		if (slide->texture)
+			texture_destroy(slide->texture);
+		free( array_elem(slides->paths, char*, i) );
+	}
+	array_destroy(slides->slides);
+	array_destroy(slides->paths);
+	
+	if (slides->fd != -1)
+		close(slides->fd);
+	pthread_cond_destroy(&slides->jobs_added);
+	pthread_mutex_destroy(&slides->lock);
+	free(slides);
+}
+
+/**
+ * Creates a local socket at `socket_path`. Clients can write commands into it to change
+ * slides, see run_command().
+ */
+bool slides_listen(slides_p slides, const char* socket_path, pa_mainloop_api* mainloop) {
+	slides->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (slides->socket_fd == -1)
+		return perror("[slides] socket"), false;
+	
+	unlink(socket_path);
+	
+	struct sockaddr_un addr = { AF_UNIX, "" };
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+	if ( bind(slides->socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ) {
+		perror("[slides] bind");
+		goto failed;
+	}
+	
+	if ( listen(slides->socket_fd, 3) == -1 ) {
+		perror("[slides] listen");
+		goto failed;
+	}
+	
+	slides->socket_path = strdup(socket_path);
+	slides->mainloop = mainloop;
+	slides->accept_event = mainloop->io_new(mainloop, slides->socket_fd, PA_IO_EVENT_INPUT, on_accept, slides);
+	
+	return true;
+	
+	failed:
+		close(slides->socket_fd);
+		slides->socket_fd = -1;
+	return false;
+}
+
+/**
+ * Makes slide `index` the current one (clamped to the deck) and decodes the slides
+ * around it. The next slides_update() shows it, or the one after the slide is decoded
+ * if it wasn't prefetched.
+ */
+void slides_show(slides_p slides, ssize_t index) {
+	if (index < 0)
+		index = 0;
+	if ((size_t)index >= slides->slides->length)
+		index = slides->slides->length - 1;
+	if ((size_t)index == slides->current)
+		return;
+	
+	slides->current = index;
+	prefetch(slides);
+	wake_up(slides);
+}
+
+/**
+ * Uploads the slides the workers decoded, drops the textures of slides that left the
+ * prefetch window and copies the current slide into `texture` (with its top left corner
+ * at `x`, `y`) if it changed and is ready. Returns `true` if `texture` was changed.
+ */
+bool slides_update(slides_p slides, GLuint texture, size_t x, size_t y) {
+	uint64_t counter = 0;
+	if ( read(slides->fd, &counter, sizeof(counter)) == -1 && errno != EAGAIN )
+		perror("[slides] read");
+	
+	pthread_mutex_lock(&slides->lock);
+		array_p decoded = slides->decoded;
+		slides->decoded = array_of(slides_image_t);
+	pthread_mutex_unlock(&slides->lock);
+	
+	for(size_t i = 0; i < decoded->length; i++) {
+		slides_image_p image = array_elem_ptr(decoded, i);
+		slides_slide_p slide = array_elem_ptr(slides->slides, image->index);
+		
+		// Slides that left the window while they were decoded are not needed any more
+		if (slide->state == SLIDES_DECODING && in_window(slides, image->index)) {
+			slide->texture = texture_new(slides->width, slides->height, GL_RG8);
+			texture_update_part(slide->texture, GL_RG, image->pixels, 0, 0, slides->width, slides->height, slides->width);
+			slide->state = SLIDES_READY;
+		} else if (slide->state == SLIDES_DECODING) {
+			slide->state = SLIDES_EMPTY;
+		}
+		free(image->pixels);
+	}
+	array_destroy(decoded);
+	
+	for(size_t i = 0; i < slides->slides->length; i++) {
+		slides_slide_p slide = array_elem_ptr(slides->slides, i);
+		if (slide->state == SLIDES_READY && !in_window(slides, i)) {
+			texture_destroy(slide->texture);
+			slide->texture = 0;
+			slide->state = SLIDES_EMPTY;
+		}
+	}
+	
+	slides_slide_p current = array_elem_ptr(slides->slides, slides->current);
+	if (slides->shown == slides->current || current->state != SLIDES_READY)
+		return false;
+	
+	// Copy on the GPU, we might be called while rendering into a framebuffer so restore it
+	// afterwards
+	GLint draw_framebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+	
+	fbo_p slide_fbo = fbo_new(current->texture);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, slide_fbo->fbo);
+	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
+	glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, y, 0, 0, slides->width, slides->height);
+	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	fbo_destroy(slide_fbo);
+	
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+	
+	slides->shown = slides->current;
+	return true;
+}
+
+
+//
+// Internal functions
+//
+
+/**
+ * Replaces the pending jobs with the slides of the window around the current slide that
+ * aren't decoded yet. The current slide comes first, then the following and previous
+ * ones alternating so stepping forward is covered first.
+ */
+static void prefetch(slides_p slides) {
+	pthread_mutex_lock(&slides->lock);
+		for(size_t i = 0; i < slides->jobs->length; i++) {
+			slides_slide_p slide = array_elem_ptr(slides->slides, array_elem(slides->jobs, size_t, i));
+			slide->state = SLIDES_EMPTY;
+		}
+		array_resize(slides->jobs, 0);
+		
+		for(ssize_t distance = 0; distance <= SLIDES_PREFETCH; distance++) {
+			ssize_t indices[2] = { slides->current + distance, slides->current - distance };
+			for(size_t i = 0; i < (distance == 0 ? 1 : 2); i++) {
+				if (indices[i] < 0 || (size_t)indices[i] >= slides->slides->length)
+					continue;
+				
+				slides_slide_p slide = array_elem_ptr(slides->slides, indices[i]);
+				if (slide->state != SLIDES_EMPTY)
+					continue;
+				
+				slide->state = SLIDES_DECODING;
+				array_append(slides->jobs, size_t, indices[i]);
+			}
+		}
+		pthread_cond_broadcast(&slides->jobs_added);
+	pthread_mutex_unlock(&slides->lock);
+}
+
+static bool in_window(slides_p slides, size_t index) {
+	return index + SLIDES_PREFETCH >= slides->current && index <= slides->current + SLIDES_PREFETCH;
+}
+
+// Makes `fd` readable so the mainloop calls slides_update()
+static void wake_up(slides_p slides) {
+	uint64_t one = 1;
+	if ( write(slides->fd, &one, sizeof(one)) == -1 )
+		perror("[slides] write");
+}
+
+/**
+ * Maps the file at `path` and decodes it into YUYV pixels of the input size. Slides that
+ * can't be read or decoded become black so the deck keeps its numbering.
+ */
+static uint8_t* load_slide(const char* path, size_t width, size_t height) {
+	uint8_t* yuyv = malloc(width * height * 2);
+	uint8_t* rgb = NULL;
+	int rgb_w = 0, rgb_h = 0, components = 0;
+	
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "[slides] %s: %s\n", path, strerror(errno));
+		goto convert;
+	}
+	
+	struct stat file_stat;
+	if ( fstat(fd, &file_stat) == -1 || file_stat.st_size == 0 ) {
+		fprintf(stderr, "[slides] %s: can't read file\n", path);
+		close(fd);
+		goto convert;
+	}
+	
+	void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "[slides] %s: mmap: %s\n", path, strerror(errno));
+		goto convert;
+	}
+	
+	rgb = stbi_load_from_memory(data, file_stat.st_size, &rgb_w, &rgb_h, &components, 3);
+	if (rgb == NULL)
+		fprintf(stderr, "[slides] %s: %s\n", path, stbi_failure_reason());
+	munmap(data, file_stat.st_size);
+	
+	convert:
+		yuyv_from_rgb(rgb, rgb_w, rgb_h, yuyv, width, height);
+		stbi_image_free(rgb);
+	return yuyv;
+}
+
+/**
+ * Decodes one slide after another. Several workers share the jobs, the decoded pixels are
+ * handed over to the frame loop, only it has the OpenGL context to upload them.
+ */
+static void* worker_main(void* arg) {
+	slides_p slides = arg;
+	
+	pthread_mutex_lock(&slides->lock);
+	while (true) {
+		while (slides->jobs->length == 0 && !slides->workers_quit)
+			pthread_cond_wait(&slides->jobs_added, &slides->lock);
+		if (slides->workers_quit)
+			break;
+		
+		size_t index = array_elem(slides->jobs, size_t, 0);
+		array_remove(slides->jobs, 0);
+		const char* path = array_elem(slides->paths, char*, index);
+		
+		pthread_mutex_unlock(&slides->lock);
+			uint8_t* pixels = load_slide(path, slides->width, slides->height);
+		pthread_mutex_lock(&slides->lock);
+		
+		array_append(slides->decoded, slides_image_t, ((slides_image_t){ index, pixels }));
+		wake_up(slides);
+	}
+	pthread_mutex_unlock(&slides->lock);
+	
+	return NULL;
+}
+
+static int is_image(const struct dirent* entry) {
+	const char* extension = strrchr(entry->d_name, '.');
+	if (extension == NULL || entry->d_name[0] == '.')
+		return 0;
+	return strcasecmp(extension, ".png") == 0 || strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0;
+}
+
+
+//
+// Control socket
+//
+
+/**
+ * Commands are "next", "prev", "first", "last" or a slide number (starting at 1).
+ */
+static void run_command(slides_p slides, const char* command) {
+	char* end = NULL;
+	long number = strtol(command, &end, 10);
+	
+	if ( strcmp(command, "next") == 0 )
+		slides_show(slides, slides->current + 1);
+	else if ( strcmp(command, "prev") == 0 )
+		slides_show(slides, (ssize_t)slides->current - 1);
+	else if ( strcmp(command, "first") == 0 )
+		slides_show(slides, 0);
+	else if ( strcmp(command, "last") == 0 )
+		slides_show(slides, slides->slides->length - 1);
+	else if (end != command && *end == '\0' && number >= 1)
+		slides_show(slides, number - 1);
+	else if (command[0] != '\0')
+		fprintf(stderr, "[slides] unknown command: %s\n", command);
+}
+
+static void close_client(slides_client_p client) {
+	slides_p slides = client->slides;
+	slides->mainloop->io_free(client->event);
+	close(client->fd);
+	for(size_t i = 0; i < slides->clients->length; i++) {
+		if (array_elem(slides->clients, slides_client_p, i) == client) {
+			array_remove(slides->clients, i);
+			break;
+		}
+	}
+	free(client);
+}
+
+static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	slides_p slides = userdata;
+	int client_fd = accept4(slides->socket_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd == -1) {
+		perror("[slides] accept4");
+		return;
+	}
+	
+	slides_client_p client = malloc(sizeof(slides_client_t));
+	memset(client, 0, sizeof(slides_client_t));
+	client->slides = slides;
+	client->fd = client_fd;
+	client->event = mainloop->io_new(mainloop, client_fd, PA_IO_EVENT_INPUT | PA_IO_EVENT_HANGUP, on_client_data, client);
+	array_append(slides->clients, slides_client_p, client);
+}
+
+static void on_client_data(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	slides_client_p client = userdata;
+	
+	char buffer[4096];
+	ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+	if (bytes_read <= 0) {
+		if (bytes_read < 0)
+			perror("[slides] read");
+		close_client(client);
+		return;
+	}
+	
+	for(ssize_t i = 0; i < bytes_read; i++) {
+		char c = buffer[i];
+		if (c == '\n') {
+			// Also accept \r\n line breaks
+			if (client->line_size > 0 && client->line[client->line_size - 1] == '\r')
+				client->line_size--;
+			client->line[client->line_size] = '\0';
+			run_command(client->slides, client->line);
+			client->line_size = 0;
+		} else if (client->line_size < sizeof(client->line) - 1) {
+			// Overlong lines are cut off, they're no valid command anyway
+			client->line[client->line_size++] = c;
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <pulse/pulseaudio.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "array.h"
+
+
+/**
+
+Plays a directory of images (exported slides) as a video input. The images are sorted
+by name with numbers compared by value, so "slide2.png" comes before "slide10.png".
+
+A small pool of workers reads the files via mmap, decodes them with stb_image, scales
+them into the input size (black bars keep the aspect ratio) and converts them to YUYV.
+The slides around the current one are decoded ahead and kept as textures on the GPU.
+Advancing a slide then only copies a texture into the input texture, which shows up in
+the next output frame.
+
+Everything that changes the input is done by slides_update(). `fd` becomes readable when
+it has something to do, so the mainloop calls it like it reads camera frames.
+
+Basic API usage:
+
+slides_p slides = slides_new("talk/", 1280, 720);
+slides_listen(slides, "hdswitch-slides0.sock", mainloop);
+
+// When `slides->fd` is readable, returns true if the input texture changed
+if ( slides_update(slides, input_tex, tex_x, tex_y) )
+	...
+
+slides_show(slides, slides->current + 1);
+slides_destroy(slides);
+
+Changing slides via the socket, one command per line ("next", "prev", "first", "last" or
+the slide number starting at 1):
+
+echo next | socat - UNIX-CONNECT:hdswitch-slides0.sock
+
+*/
+
+// Slides decoded ahead before and after the current one
+#define SLIDES_PREFETCH  3
+#define SLIDES_WORKERS   2
+
+#define SLIDES_EMPTY     0
+#define SLIDES_DECODING  1
+#define SLIDES_READY     2
+
+typedef struct {
+	uint8_t state;
+	// GL_RG8 texture with the YUYV pixels of the slide, 0 unless the slide is ready
+	GLuint texture;
+} slides_slide_t, *slides_slide_p;
+
+typedef struct {
+	size_t   index;
+	// YUYV pixels in the size of the input, owned by whoever holds the image
+	uint8_t* pixels;
+} slides_image_t, *slides_image_p;
+
+typedef struct slides_s slides_t, *slides_p;
+
+// A connected client, keeps the start of a command split across two reads
+typedef struct {
+	slides_p     slides;
+	int          fd;
+	pa_io_event* event;
+	char         line[64];
+	size_t       line_size;
+} slides_client_t, *slides_client_p;
+
+struct slides_s {
+	size_t width, height;
+	// Paths of the slide images (char*) and their state (slides_slide_t)
+	array_p paths, slides;
+	// Slide that should be shown and the one that was last copied into the input texture
+	size_t current, shown;
+	// eventfd, readable when slides_update() has something to do
+	int fd;
+	
+	// Protects `jobs` (slide indices to decode), `decoded` and `workers_quit`
+	pthread_mutex_t lock;
+	pthread_cond_t jobs_added;
+	array_p jobs, decoded;
+	bool workers_quit;
+	pthread_t workers[SLIDES_WORKERS];
+	
+	// Local socket for clients to change slides, -1 without slides_listen()
+	int socket_fd;
+	char* socket_path;
+	pa_mainloop_api* mainloop;
+	pa_io_event* accept_event;
+	array_p clients;
+};
+
+slides_p slides_new(const char* directory, size_t width, size_t height);
+void     slides_destroy(slides_p slides);
+bool     slides_listen(slides_p slides, const char* socket_path, pa_mainloop_api* mainloop);
+void     slides_show(slides_p slides, ssize_t index);
+bool     slides_update(slides_p slides, GLuint texture, size_t x, size_t y);
@@ -225,7 +225,8 @@ static int      stbi_gif_info(stbi *s, int *x, int *y, int *comp);
 
 
 // this is not threadsafe
-static const char *failure_reason;
+// Thread local so several threads can decode at once (slide and image cache workers)
+static __thread const char *failure_reason;
 
 const char *stbi_failure_reason(void)
 {
@@ -1978,7 +1979,7 @@ static int parse_zlib_header(zbuf *a)
 }
 
 // @TODO: should statically initialize these for optimal thread safety
-static uint8 default_length[288], default_distance[32];
+static __thread uint8 default_length[288], default_distance[32];
 static void init_defaults(void)
 {
    int i;   // use <= to match clearly with spec
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "testing.h"
+#include "../hash.h"
+
+
+void test_put_get_remove() {
+	hash_p hash = hash_of(int);
+	
+	hash_put(hash, 7, int, 70);
+	hash_put(hash, -3, int, -30);
+	hash_put(hash, 0, int, 0);
+	check(hash->length == 3);
+	check_int(hash_get(hash, 7, int), 70);
+	check_int(hash_get(hash, -3, int), -30);
+	check(hash_contains(hash, 0));
+	check(!hash_contains(hash, 8));
+	check_null(hash_get_ptr(hash, 8));
+	
+	// Putting an existing key returns the same value
+	hash_put(hash, 7, int, 71);
+	check(hash->length == 3);
+	check_int(hash_get(hash, 7, int), 71);
+	
+	hash_remove(hash, 7);
+	check(hash->length == 2);
+	check(!hash_contains(hash, 7));
+	check_int(hash_get(hash, -3, int), -30);
+	
+	// Removing a missing key does nothing
+	hash_remove(hash, 7);
+	check(hash->length == 2);
+	
+	hash_destroy(hash);
+}
+
+void test_many_elements() {
+	hash_p hash = hash_of(int);
+	
+	// Enough elements for several resizes and for groups to fill up completely
+	for(int i = 0; i < 100000; i++)
+		hash_put(hash, i * 17, int, i);
+	check(hash->length == 100000);
+	check( (hash->capacity & (hash->capacity - 1)) == 0 );
+	
+	for(int i = 0; i < 100000; i++) {
+		int* value = hash_get_ptr(hash, i * 17);
+		check_not_null(value);
+		check_int(*value, i);
+		check(!hash_contains(hash, i * 17 + 1));
+	}
+	
+	// Remove every other element, the rest has to stay reachable
+	for(int i = 0; i < 100000; i += 2)
+		hash_remove(hash, i * 17);
+	check(hash->length == 50000);
+	for(int i = 0; i < 100000; i++)
+		check( hash_contains(hash, i * 17) == (i % 2 == 1) );
+	
+	// Inserting again reuses deleted slots
+	for(int i = 0; i < 100000; i += 2)
+		hash_put(hash, i * 17, int, -i);
+	check(hash->length == 100000);
+	for(int i = 0; i < 100000; i++)
+		check_int(hash_get(hash, i * 17, int), (i % 2 == 1) ? i : -i);
+	
+	hash_destroy(hash);
+}
+
+void test_churn() {
+	// Insert and remove over and over with a small number of live elements. This
+	// leaves tombstones behind that have to be cleaned up without growing the table.
+	hash_p hash = hash_of(int);
+	for(int i = 0; i < 100000; i++) {
+		hash_put(hash, i, int, i);
+		if (i >= 10)
+			hash_remove(hash, i - 10);
+	}
+	check(hash->length == 10);
+	check(hash->capacity <= 64);
+	for(int i = 100000 - 10; i < 100000; i++)
+		check_int(hash_get(hash, i, int), i);
+	
+	hash_destroy(hash);
+}
+
+void test_iteration() {
+	hash_p hash = hash_of(int);
+	for(int i = 0; i < 1000; i++)
+		hash_put(hash, i, int, i * 2);
+	
+	size_t count = 0;
+	int64_t key_sum = 0;
+	for(hash_elem_t e = hash_start(hash); e != NULL; e = hash_next(hash, e)) {
+		check_int(hash_value(e, int), (int)hash_key(e) * 2);
+		key_sum += hash_key(e);
+		count++;
+	}
+	check(count == 1000);
+	check(key_sum == 999 * 1000 / 2);
+	
+	// Removing elements while iterating is fine
+	for(hash_elem_t e = hash_start(hash); e != NULL; e = hash_next(hash, e)) {
+		if (hash_key(e) % 3 == 0)
+			hash_remove_elem(hash, e);
+		else
+			hash_remove(hash, hash_key(e));
+	}
+	check(hash->length == 0);
+	check_null(hash_start(hash));
+	
+	hash_destroy(hash);
+}
+
+void test_resize() {
+	hash_p hash = hash_with(1000, int);
+	check(hash->capacity >= 1000);
+	for(int i = 0; i < 500; i++)
+		hash_put(hash, i, int, i);
+	for(int i = 0; i < 490; i++)
+		hash_remove(hash, i);
+	
+	hash_resize(hash, 0);
+	check(hash->capacity == 16);
+	for(int i = 490; i < 500; i++)
+		check_int(hash_get(hash, i, int), i);
+	
+	hash_destroy(hash);
+}
+
+void test_dict() {
+	dict_p dict = dict_of(int);
+	
+	char keys[1000][16];
+	for(int i = 0; i < 1000; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key %d", i);
+		dict_put(dict, keys[i], int, i);
+	}
+	check(dict->length == 1000);
+	
+	// Lookups compare the strings, not the pointers
+	char key[16];
+	for(int i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "key %d", i);
+		check_int(dict_get(dict, key, int), i);
+	}
+	check(!dict_contains(dict, "key 1000"));
+	
+	dict_remove(dict, "key 42");
+	check(!dict_contains(dict, "key 42"));
+	check(dict->length == 999);
+	
+	size_t count = 0;
+	for(dict_elem_t e = dict_start(dict); e != NULL; e = dict_next(dict, e)) {
+		check( strcmp(dict_key(e), "key 42") != 0 );
+		count++;
+	}
+	check(count == 999);
+	
+	dict_destroy(dict);
+}
+
+
+int main(){
+	run(test_put_get_remove);
+	run(test_many_elements);
+	run(test_churn);
+	run(test_iteration);
+	run(test_resize);
+	run(test_dict);
+	
+	return show_report();
+}
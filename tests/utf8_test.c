@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "testing.h"
 #include "../utf8.h"
 
@@ -154,10 +155,108 @@ void test_sized_iteration() {
 	}
 }
 
+void test_bulk_decode() {
+	struct { char* utf8; size_t size; uint32_t* utf32; size_t errors; } test_cases[] = {
+		// Empty buffer
+		{ "", 0, (uint32_t[]){ 0 }, 0 },
+		
+		// ASCII shorter than a group
+		{
+			              "Hello World!\n", 13,
+			(uint32_t[]){ 'H', 'e', 'l', 'l', 'o', ' ', 'W', 'o', 'r', 'l', 'd', '!', '\n', 0 }, 0
+		},
+		
+		// ASCII longer than a group with a multi-byte code point in the second group
+		{
+			              "0123456789abcdefghö", 20,
+			(uint32_t[]){ '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 0x00F6, 0 }, 0
+		},
+		
+		// Zero terminator within a group, the bytes behind it are ignored
+		{
+			(char[])    { 'a', 'b', 'c', 0, 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p' }, 17,
+			(uint32_t[]){ 'a', 'b', 'c', 0 }, 0
+		},
+		
+		// Size ends within the group of a longer string
+		{
+			              "0123456789abcdefghijklmnopqrstuvwxyz", 17,
+			(uint32_t[]){ '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 0 }, 0
+		},
+		
+		// An encoded replacement character is no error, an incomplete code point is
+		{
+			(char[])    { 0xEF, 0xBF, 0xBD,   0xC3, 'a', 0 }, 5,
+			(uint32_t[]){           0xFFFD, 0xFFFD, 'a', 0 }, 1
+		}
+	};
+	
+	size_t test_case_count = sizeof(test_cases) /  sizeof(test_cases[0]);
+	for (size_t i = 0; i < test_case_count; i++) {
+		uint32_t code_points[64];
+		size_t errors = 0;
+		size_t count = utf8_decode(test_cases[i].utf8, test_cases[i].size, code_points, &errors);
+		
+		size_t expected_count = 0;
+		while (test_cases[i].utf32[expected_count] != 0)
+			expected_count++;
+		
+		check_msg(count == expected_count, "got %zu code points, expected %zu, test case %zu", count, expected_count, i);
+		check_msg(errors == test_cases[i].errors, "got %zu errors, expected %zu, test case %zu", errors, test_cases[i].errors, i);
+		for(size_t j = 0; j < count && j < expected_count; j++)
+			check_msg(code_points[j] == test_cases[i].utf32[j], "got 0x%04X, expected 0x%04X, test case %zu, code point index %zu",
+				code_points[j], test_cases[i].utf32[j], i, j);
+	}
+}
+
+/**
+ * Decodes random buffers with utf8_decode() and utf8_next() and compares the results. The
+ * bytes are mostly ASCII with some lead bytes, intermediate bytes and zeros mixed in, so
+ * the ASCII groups are interrupted at all kinds of positions.
+ */
+void test_bulk_decode_equivalence() {
+	srand(1);
+	uint32_t decoded[256];
+	size_t mismatches = 0;
+	
+	for(size_t round = 0; round < 20000; round++) {
+		size_t size = rand() % 256;
+		// Exactly `size` bytes, so reads behind the buffer show up in address sanitizer builds
+		uint8_t* buffer = malloc(size);
+		for(size_t i = 0; i < size; i++) {
+			int kind = rand() % 100;
+			if (kind < 70)
+				buffer[i] = 1 + rand() % 127;
+			else if (kind < 80)
+				buffer[i] = 0x80 | (rand() % 64);
+			else if (kind < 99)
+				buffer[i] = 0xC0 | (rand() % 64);
+			else
+				buffer[i] = 0;
+		}
+		size_t count = utf8_decode((char*)buffer, size, decoded, NULL);
+		size_t index = 0;
+		bool equal = true;
+		for(utf8_iterator_t it = utf8_first_size((char*)buffer, size); it.code_point != 0; it = utf8_next(it)) {
+			if (index >= count || decoded[index] != it.code_point)
+				equal = false;
+			index++;
+		}
+		
+		if (!equal || index != count)
+			mismatches++;
+		free(buffer);
+	}
+	
+	check_msg(mismatches == 0, "%zu of 20000 random buffers decoded differently", mismatches);
+}
+
 
 int main(){
 	run(test_zero_terminated_iteration);
 	run(test_sized_iteration);
+	run(test_bulk_decode);
+	run(test_bulk_decode_equivalence);
 	
 	return show_report();
 }
\ No newline at end of file
@@ -1,8 +1,27 @@
+// For strdup()
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
 #include "drawable.h"
 #include "text_renderer.h"
 #include "utf8.h"
 
-static text_renderer_cell_p find_free_cell_or_revoke_unused_cell(text_renderer_p renderer, text_renderer_font_p font, uint32_t glyph_width, uint32_t glyph_height, uint32_t texture_width, uint32_t texture_height, size_t* line_idx, size_t* cell_idx);
+#include FT_MODULE_H
+
+static const text_renderer_cell_t* lookup_glyph(text_renderer_p renderer, int32_t font_handle, text_renderer_font_p font, uint32_t code_point, uint32_t* line_idx);
+static int32_t kerning(text_renderer_font_p font, uint32_t left_glyph_index, uint32_t right_glyph_index);
+static void upload_staged_glyphs(text_renderer_p renderer);
+static text_renderer_cell_p place_glyph(text_renderer_p renderer, int32_t font_handle, uint32_t code_point, uint32_t glyph_width, uint32_t glyph_height, size_t* line_idx, size_t* cell_idx);
+static bool   add_page(text_renderer_p renderer);
+static void   evict_line(text_renderer_p renderer, size_t line_idx);
+static GLuint atlas_texture_new(uint32_t width, uint32_t height);
+
+static void  queue_job(text_renderer_p renderer, text_renderer_job_t job);
+static void* worker_main(void* arg);
+static void  worker_run_job(text_renderer_p renderer, text_renderer_job_p job);
+static void  worker_kerning(text_renderer_worker_font_p font, text_renderer_staged_glyph_p glyph);
 
 void text_renderer_new(text_renderer_p renderer, size_t texture_width, size_t texture_height) {
 	FT_Error error = FT_Init_FreeType(&renderer->freetype);
@@ -11,45 +30,115 @@ void text_renderer_new(text_renderer_p renderer, size_t texture_width, size_t te
 		return;
 	}
 	
-	renderer->texture = texture_new(texture_width, texture_height, GL_R8);
+	// The worker rasterizes with its own library and faces, FreeType objects must not be
+	// used by two threads at once
+	error = FT_Init_FreeType(&renderer->worker_freetype);
+	if (error) {
+		printf("FT_Init_FreeType error\n");
+		return;
+	}
 	
-	size_t black_data_size = texture_width * texture_height;
-	void* black_data = malloc(black_data_size);
-	memset(black_data, 0, black_data_size);
-	texture_update(renderer->texture, GL_RED, black_data);
-	free(black_data);
+	// Distance fields reach this far beyond the outline (the default is 2 pixels). The bsdf
+	// renderer is used for bitmap glyphs.
+	FT_Int spread = TEXT_RENDERER_SDF_SPREAD;
+	FT_Property_Set(renderer->worker_freetype, "sdf", "spread", &spread);
+	FT_Property_Set(renderer->worker_freetype, "bsdf", "spread", &spread);
 	
-	glBindTexture(GL_TEXTURE_RECTANGLE, renderer->texture);
-	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_RECTANGLE, 0);	
+	// The texture and size are the first page, more pages are added when it's full
+	renderer->texture = atlas_texture_new(texture_width, texture_height);
+	renderer->page_width = texture_width;
+	renderer->page_height = texture_height;
+	renderer->page_count = 1;
 	
 	renderer->fonts = hash_of(text_renderer_font_t);
 	renderer->lines = array_of(text_renderer_line_t);
+	renderer->open_lines = hash_of(size_t);
+	renderer->lines_end_y = 0;
+	
+	renderer->frame = 0;
+	renderer->generation = 0;
+	renderer->hits = 0;
+	renderer->misses = 0;
+	renderer->evictions = 0;
+	
+	renderer->jobs = array_of(text_renderer_job_t);
+	renderer->staged = array_of(text_renderer_staged_glyph_t);
+	renderer->uploads = array_of(text_renderer_staged_glyph_t);
+	renderer->worker_fonts = hash_of(text_renderer_worker_font_t);
+	renderer->worker_busy = false;
+	renderer->worker_quit = false;
+	pthread_mutex_init(&renderer->lock, NULL);
+	pthread_cond_init(&renderer->jobs_added, NULL);
+	pthread_cond_init(&renderer->worker_idle, NULL);
+	
+	int err = pthread_create(&renderer->worker, NULL, worker_main, renderer);
+	if (err != 0)
+		fprintf(stderr, "text_renderer_new(): pthread_create() failed: %s\n", strerror(err));
 }
 
 void text_renderer_destroy(text_renderer_p renderer) {
+	// Fonts are closed by the worker so destroy them before stopping it
+	for(hash_elem_t e = hash_start(renderer->fonts); e != NULL; e = hash_next(renderer->fonts, e))
+		text_renderer_font_destroy(renderer, hash_key(e));
+	hash_destroy(renderer->fonts);
+	
+	pthread_mutex_lock(&renderer->lock);
+		renderer->worker_quit = true;
+		pthread_cond_signal(&renderer->jobs_added);
+	pthread_mutex_unlock(&renderer->lock);
+	pthread_join(renderer->worker, NULL);
+	
+	for(size_t i = 0; i < renderer->staged->length; i++) {
+		free( array_elem(renderer->staged, text_renderer_staged_glyph_t, i).bitmap );
+		free( array_elem(renderer->staged, text_renderer_staged_glyph_t, i).kerning );
+	}
+	array_destroy(renderer->staged);
+	array_destroy(renderer->uploads);
+	array_destroy(renderer->jobs);
+	hash_destroy(renderer->worker_fonts);
+	pthread_cond_destroy(&renderer->worker_idle);
+	pthread_cond_destroy(&renderer->jobs_added);
+	pthread_mutex_destroy(&renderer->lock);
+	
 	texture_destroy(renderer->texture);
 	
 	for(size_t i = 0; i < renderer->lines->length; i++)
 		array_destroy( array_elem(renderer->lines, text_renderer_line_t, i).cells );
 	array_destroy(renderer->lines);
+	hash_destroy(renderer->open_lines);
 	
-	for(hash_elem_t e = hash_start(renderer->fonts); e != NULL; e = hash_next(renderer->fonts, e))
-		text_renderer_font_destroy(renderer, hash_key(e));
-	hash_destroy(renderer->fonts);
-	
-	FT_Error error = FT_Done_FreeType(renderer->freetype);
+	FT_Error error = FT_Done_FreeType(renderer->worker_freetype);
+	if (error)
+		printf("FT_Done_FreeType error\n");
+	error = FT_Done_FreeType(renderer->freetype);
 	if (error)
 		printf("FT_Done_FreeType error\n");
 }
 
-int32_t text_renderer_font_new(text_renderer_p renderer, const char* font_path, size_t font_size) {
+/**
+ * Starts a new frame and uploads all glyphs the worker finished since the last frame.
+ * Lines of the texture used in the current frame are never evicted, only those not
+ * used since the last call.
+ */
+void text_renderer_next_frame(text_renderer_p renderer) {
+	renderer->frame++;
+	upload_staged_glyphs(renderer);
+}
+
+/**
+ * Uploads the glyphs the worker finished without starting a new frame. When several
+ * loops draw with the same renderer only one of them advances the frames, the others
+ * use this function.
+ */
+void text_renderer_upload(text_renderer_p renderer) {
+	upload_staged_glyphs(renderer);
+}
+
+static int32_t font_new(text_renderer_p renderer, const char* font_path, size_t font_size, bool sdf) {
 	int32_t handle = renderer->fonts->length;
 	text_renderer_font_p font = hash_put_ptr(renderer->fonts, handle);
 	
+	// This face is only used for metrics and kerning, the worker opens its own one
 	FT_Error error = FT_New_Face(renderer->freetype, font_path, 0, &font->face);
 	if (error) {
 		printf("FT_New_Face error\n");
@@ -62,7 +151,23 @@ int32_t text_renderer_font_new(text_renderer_p renderer, const char* font_path,
 		goto failed_set_pixel_size;
 	}
 	
+	font->sdf = sdf;
+	font->size = font_size;
 	font->cell_refs = hash_of(text_renderer_cell_ref_t);
+	font->pending = hash_of(uint8_t);
+	font->prepared = NULL;
+	font->prepared_start = 0;
+	font->prepared_count = 0;
+	font->placeholder = (text_renderer_cell_t){ .hori_advance = font->face->size->metrics.x_ppem / 2, .font_handle = handle };
+	font->kerning = hash_of(int32_t);
+	
+	queue_job(renderer, (text_renderer_job_t){
+		.type = TEXT_RENDERER_JOB_FONT_NEW,
+		.font_handle = handle,
+		.font_path = strdup(font_path),
+		.font_size = font_size,
+		.sdf = sdf
+	});
 	
 	return handle;
 	
@@ -73,6 +178,18 @@ int32_t text_renderer_font_new(text_renderer_p renderer, const char* font_path,
 	return -1;
 }
 
+int32_t text_renderer_font_new(text_renderer_p renderer, const char* font_path, size_t font_size) {
+	return font_new(renderer, font_path, font_size, false);
+}
+
+/**
+ * Creates a font that stores its glyphs as signed distance fields. They are rendered once at
+ * TEXT_RENDERER_SDF_SIZE pixels and can be drawn at any size, see text_layout_set_size().
+ */
+int32_t text_renderer_sdf_font_new(text_renderer_p renderer, const char* font_path) {
+	return font_new(renderer, font_path, TEXT_RENDERER_SDF_SIZE, true);
+}
+
 void text_renderer_font_destroy(text_renderer_p renderer, int32_t font_handle) {
 	text_renderer_font_p font = hash_get_ptr(renderer->fonts, font_handle);
 	if (!font)
@@ -80,79 +197,68 @@ void text_renderer_font_destroy(text_renderer_p renderer, int32_t font_handle) {
 	
 	// TODO: mark all cells of this font as free
 	
+	queue_job(renderer, (text_renderer_job_t){ .type = TEXT_RENDERER_JOB_FONT_DESTROY, .font_handle = font_handle });
 	FT_Done_Face(font->face);
 	hash_destroy(font->cell_refs);
+	hash_destroy(font->pending);
+	hash_destroy(font->kerning);
+	free(font->prepared);
 	hash_remove(renderer->fonts, font_handle);
 }
 
 
+/**
+ * Rasterizes the glyphs of a code point range and uploads them. Unlike text rendering this
+ * waits for the worker, meant to be called once at startup for the commonly used glyphs.
+ * The cells of the range (and all ranges prepared before) are kept in a flat array so
+ * looking them up doesn't need the cell_refs hash.
+ */
 void text_renderer_prepare(text_renderer_p renderer, int32_t font_handle, uint32_t range_start, uint32_t range_end) {
 	text_renderer_font_p font = hash_get_ptr(renderer->fonts, font_handle);
-	if (!font)
+	if (!font || range_end < range_start)
 		return;
 	
-	glBindTexture(GL_TEXTURE_RECTANGLE, renderer->texture);
+	// Grow the prepared array to also cover the new range, glyphs already in the texture
+	// are copied into it
+	uint32_t start = range_start, end = range_end + 1;
+	if (font->prepared_count > 0) {
+		start = (font->prepared_start < start) ? font->prepared_start : start;
+		end = (font->prepared_start + font->prepared_count > end) ? font->prepared_start + font->prepared_count : end;
+	}
 	
-	// Lookup the size of our texture (needed by find_free_cell_or_revoke_unused_cell() for some checks)
-	GLint texture_width = 0, texture_height = 0;
-	glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_WIDTH, &texture_width);
-	glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_HEIGHT, &texture_height);
+	text_renderer_prepared_glyph_p prepared = malloc((end - start) * sizeof(text_renderer_prepared_glyph_t));
+	for(uint32_t code_point = start; code_point < end; code_point++) {
+		text_renderer_prepared_glyph_p entry = &prepared[code_point - start];
+		text_renderer_cell_ref_p cell_ref = hash_get_ptr(font->cell_refs, code_point);
+		if (cell_ref) {
+			text_renderer_line_p line = array_elem_ptr(renderer->lines, cell_ref->line_idx);
+			entry->cell = array_elem(line->cells, text_renderer_cell_t, cell_ref->cell_idx);
+			entry->line_idx = cell_ref->line_idx;
+		} else {
+			entry->line_idx = UINT32_MAX;
+		}
+	}
 	
-	GLint unpack_alignment = 0;
-	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	free(font->prepared);
+	font->prepared = prepared;
+	font->prepared_start = start;
+	font->prepared_count = end - start;
 	
+	uint32_t line_idx = 0;
 	for(uint32_t code_point = range_start; code_point <= range_end; code_point++) {
-		// Handle line break.
-		if (code_point == '\n') {
+		// Line breaks have no glyph
+		if (code_point == '\n')
 			continue;
-		}
 		
-		// Look if this glyph is present in the texture. If so this font has a cell reference
-		// for this code point.
-		text_renderer_cell_ref_p cell_ref = hash_get_ptr(font->cell_refs, code_point);
-		
-		// Glyph not rendered yet, try to render it
-		if (!cell_ref) {
-			uint32_t glyph_index = FT_Get_Char_Index(font->face, code_point);
-			if (glyph_index == 0)
-				continue;
-			
-			FT_Error error = FT_Load_Glyph(font->face, glyph_index, FT_LOAD_RENDER);
-			if (error)
-				continue;
-			
-			// Look for a free cell to store the rendered glyph
-			uint32_t gw = font->face->glyph->bitmap.width, gh = font->face->glyph->bitmap.rows;
-			size_t line_idx = 0, cell_idx = 0;
-			text_renderer_cell_p free_cell = find_free_cell_or_revoke_unused_cell(renderer, font, gw, gh, texture_width, texture_height, &line_idx, &cell_idx);
-			
-			if (free_cell == NULL)
-				continue;
-			
-			free_cell->glyph_index    = glyph_index;
-			free_cell->hori_bearing_x = font->face->glyph->metrics.horiBearingX / 64;
-			free_cell->hori_bearing_y = font->face->glyph->metrics.horiBearingY / 64;
-			free_cell->hori_advance   = font->face->glyph->metrics.horiAdvance  / 64;
-			
-			/*
-			printf("%3u %c: %2ux%2u %3u bytes, pitch %2u, pos %3u/%3u hori_bearing: %2d/%2d, adv: %2d\n",
-				code_point, code_point, gw, gh, gw*gh, font->face->glyph->bitmap.pitch,
-				free_cell->x, free_cell->y, free_cell->hori_bearing_x, free_cell->hori_bearing_y, free_cell->hori_advance);
-			*/
-			
-			glPixelStorei(GL_UNPACK_ROW_LENGTH, font->face->glyph->bitmap.pitch);
-			glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, free_cell->x, free_cell->y, gw, gh, GL_RED, GL_UNSIGNED_BYTE, font->face->glyph->bitmap.buffer);
-			
-			cell_ref = hash_put_ptr(font->cell_refs, code_point);
-			cell_ref->line_idx = line_idx;
-			cell_ref->cell_idx = cell_idx;
-		}
+		lookup_glyph(renderer, font_handle, font, code_point, &line_idx);
 	}
 	
-	glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	pthread_mutex_lock(&renderer->lock);
+		while (renderer->jobs->length > 0 || renderer->worker_busy)
+			pthread_cond_wait(&renderer->worker_idle, &renderer->lock);
+	pthread_mutex_unlock(&renderer->lock);
+	
+	upload_staged_glyphs(renderer);
 }
 
 size_t text_renderer_render(text_renderer_p renderer, int32_t font_handle, char* text, size_t x, size_t y, float* buffer_ptr, size_t buffer_size) {
@@ -164,18 +270,7 @@ size_t text_renderer_render(text_renderer_p renderer, int32_t font_handle, char*
 	// from the position. Otherwise we would render above it.
 	size_t pos_x = x, pos_y = y + (font->face->size->metrics.height / 64);
 	float* p = buffer_ptr;
-	FT_UInt glyph_index = 0, prev_glyph_index = 0;
-	
-	glBindTexture(GL_TEXTURE_RECTANGLE, renderer->texture);
-	
-	// Lookup the size of our texture (needed by find_free_cell_or_revoke_unused_cell() for some checks)
-	GLint texture_width = 0, texture_height = 0;
-	glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_WIDTH, &texture_width);
-	glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_HEIGHT, &texture_height);
-	
-	GLint unpack_alignment = 0;
-	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	FT_UInt prev_glyph_index = 0;
 	
 	for(utf8_iterator_t it = utf8_first(text); it.code_point != 0; it = utf8_next(it)) {
 		// Handle line break.
@@ -189,68 +284,28 @@ size_t text_renderer_render(text_renderer_p renderer, int32_t font_handle, char*
 			continue;
 		}
 		
-		// Look if this glyph is present in the texture. If so this font has a cell reference
-		// for this code point.
-		text_renderer_cell_ref_p cell_ref = hash_get_ptr(font->cell_refs, it.code_point);
-		
-		// Glyph not rendered yet, try to render it
-		if (!cell_ref) {
-			glyph_index = FT_Get_Char_Index(font->face, it.code_point);
-			if (glyph_index == 0)
-				goto render_error_glyph;
-			
-			FT_Error error = FT_Load_Glyph(font->face, glyph_index, FT_LOAD_RENDER);
-			if (error)
-				goto render_error_glyph;
-			
-			// Look for a free cell to store the rendered glyph
-			uint32_t gw = font->face->glyph->bitmap.width, gh = font->face->glyph->bitmap.rows;
-			size_t line_idx = 0, cell_idx = 0;
-			text_renderer_cell_p free_cell = find_free_cell_or_revoke_unused_cell(renderer, font, gw, gh, texture_width, texture_height, &line_idx, &cell_idx);
-			
-			if (free_cell == NULL)
-				goto render_error_glyph;
-			
-			free_cell->glyph_index    = glyph_index;
-			free_cell->hori_bearing_x = font->face->glyph->metrics.horiBearingX / 64;
-			free_cell->hori_bearing_y = font->face->glyph->metrics.horiBearingY / 64;
-			free_cell->hori_advance   = font->face->glyph->metrics.horiAdvance  / 64;
-			
-			/*
-			printf("%c: %2ux%2u %2u bytes, pitch %u, x: %u, y: %u hori_bearing: %2u/%2u, adv: %2u\n",
-				it.code_point, gw, gh, gw*gh, font->face->glyph->bitmap.pitch,
-				free_cell->x, free_cell->y, free_cell->hori_bearing_x, free_cell->hori_bearing_y, free_cell->hori_advance);
-			*/
-
-			glPixelStorei(GL_UNPACK_ROW_LENGTH, font->face->glyph->bitmap.pitch);
-			glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, free_cell->x, free_cell->y, gw, gh, GL_RED, GL_UNSIGNED_BYTE, font->face->glyph->bitmap.buffer);
-			
-			cell_ref = hash_put_ptr(font->cell_refs, it.code_point);
-			cell_ref->line_idx = line_idx;
-			cell_ref->cell_idx = cell_idx;
+		uint32_t line_idx = 0;
+		const text_renderer_cell_t* cell = lookup_glyph(renderer, font_handle, font, it.code_point, &line_idx);
+		if (!cell) {
+			// For now just output nothing when we fail to render a glyph.
+			// TODO: Figure out how to render a kind of error glyph.
+			prev_glyph_index = 0;
+			continue;
 		}
 		
-		// Glyph rendered successfully, do kerning and generate vertices for it
-		text_renderer_line_t line = array_elem(renderer->lines, text_renderer_line_t, cell_ref->line_idx);
-		text_renderer_cell_t cell = array_elem(line.cells, text_renderer_cell_t, cell_ref->cell_idx);
-		
-		if (cell.glyph_index && prev_glyph_index) {
-			FT_Vector delta;
-			FT_Get_Kerning(font->face, prev_glyph_index, glyph_index, FT_KERNING_DEFAULT, &delta);
-			pos_x += delta.x / 64;
-		}
+		pos_x += kerning(font, prev_glyph_index, cell->glyph_index);
 		
 		// We have the texture coordinates of the glyph, generate the vertex buffer
 		if ( (p + 6*4 - buffer_ptr) * sizeof(float) < buffer_size ) {
-			float w = cell.width, h = line.height;
+			float w = cell->width, h = cell->height;
 			
-			float cx = pos_x + cell.hori_bearing_x;
-			float cy = pos_y - cell.hori_bearing_y;
+			float cx = pos_x + cell->hori_bearing_x;
+			float cy = pos_y - cell->hori_bearing_y;
 			
-			float tl_x = cx + 0, tl_y = cy + 0,  tl_u = cell.x,     tl_v = cell.y;
-			float tr_x = cx + w, tr_y = cy + 0,  tr_u = cell.x + w, tr_v = cell.y;
-			float bl_x = cx + 0, bl_y = cy + h,  bl_u = cell.x,     bl_v = cell.y + h;
-			float br_x = cx + w, br_y = cy + h,  br_u = cell.x + w, br_v = cell.y + h;
+			float tl_x = cx + 0, tl_y = cy + 0,  tl_u = cell->x,     tl_v = cell->y;
+			float tr_x = cx + w, tr_y = cy + 0,  tr_u = cell->x + w, tr_v = cell->y;
+			float bl_x = cx + 0, bl_y = cy + h,  bl_u = cell->x,     bl_v = cell->y + h;
+			float br_x = cx + w, br_y = cy + h,  br_u = cell->x + w, br_v = cell->y + h;
 			
 			*(p++) = tl_x; *(p++) = tl_y; *(p++) = tl_u; *(p++) = tl_v;
 			*(p++) = tr_x; *(p++) = tr_y; *(p++) = tr_u; *(p++) = tr_v;
@@ -259,86 +314,737 @@ size_t text_renderer_render(text_renderer_p renderer, int32_t font_handle, char*
 			*(p++) = br_x; *(p++) = br_y; *(p++) = br_u; *(p++) = br_v;
 			*(p++) = bl_x; *(p++) = bl_y; *(p++) = bl_u; *(p++) = bl_v;
 			
-			pos_x += cell.hori_advance;
+			pos_x += cell->hori_advance;
 		}
 		
-		prev_glyph_index = glyph_index;
-		continue;
-		
-		render_error_glyph:
-			// For now just output nothing when we fail to render a glyph.
-			// TODO: Figure out how to render a kind of error glyph.
-			prev_glyph_index = glyph_index;
-			continue;
+		prev_glyph_index = cell->glyph_index;
 	}
 	
-	glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
-	
 	return (p - buffer_ptr) * sizeof(float);
 }
 
-static text_renderer_cell_p find_free_cell_or_revoke_unused_cell(text_renderer_p renderer, text_renderer_font_p font, uint32_t glyph_width, uint32_t glyph_height, uint32_t texture_width, uint32_t texture_height, size_t* line_idx, size_t* cell_idx) {
-	// Padding between the glyphs
-	const uint32_t padding = 1;
-	// Keep track of the texture coordinates so we know where our cell is on the texture
-	uint32_t x = 0, y = 0;
+//
+// Text layouts
+//
+
+static void layout_state_reserve(text_layout_state_p state, size_t text_size);
+static void layout_state_free(text_layout_state_p state);
+static void touch_glyphs(text_renderer_p renderer, text_layout_state_p state);
+
+text_layout_p text_layout_new(text_renderer_p renderer, int32_t font_handle, size_t x, size_t y) {
+	text_layout_p layout = malloc(sizeof(text_layout_t));
+	memset(layout, 0, sizeof(text_layout_t));
 	
-	// First search for a line with the matching height
-	for(size_t i = 0; i < renderer->lines->length; i++) {
-		text_renderer_line_p line = &array_data(renderer->lines, text_renderer_line_t)[i];
+	layout->renderer = renderer;
+	layout->font = font_handle;
+	layout->x = x;
+	layout->y = y;
+	layout->scale = 1;
+	layout->buffer = buffer_new(0, NULL);
+	
+	return layout;
+}
+
+void text_layout_destroy(text_layout_p layout) {
+	layout_state_free(&layout->current);
+	layout_state_free(&layout->next);
+	buffer_destroy(layout->buffer);
+	free(layout);
+}
+
+/**
+ * Lays out `text` if it's different from the last text. Each line is compared with the
+ * same line of the last text. Glyphs before the first changed byte are copied over, only
+ * the rest of the line is laid out again. Afterwards only the range of instances that
+ * changed is uploaded into the buffer. When glyphs were evicted from the texture since the
+ * last layout (the generation of the renderer changed) the whole text is laid out again.
+ * 
+ * Returns `false` if the text didn't change or the font doesn't exist.
+ */
+bool text_layout_update(text_layout_p layout, const char* text) {
+	text_renderer_p renderer = layout->renderer;
+	text_renderer_font_p font = hash_get_ptr(renderer->fonts, layout->font);
+	if (!font)
+		return false;
+	
+	text_layout_state_p prev = &layout->current, next = &layout->next;
+	bool reuse_prev = (prev->text && layout->generation == renderer->generation && prev->scale == layout->scale);
+	if (reuse_prev && strcmp(prev->text, text) == 0)
+		return false;
+	
+	// Protect the glyphs we copy from eviction while the rest is laid out
+	if (reuse_prev)
+		touch_glyphs(renderer, prev);
+	
+	size_t text_size = strlen(text) + 1;
+	layout_state_reserve(next, text_size);
+	memcpy(next->text, text, text_size);
+	next->line_count = 0;
+	next->glyph_count = 0;
+	next->scale = layout->scale;
+	
+	// Range of instances that differ from the last layout
+	size_t dirty_start = SIZE_MAX, dirty_end = 0;
+	int32_t line_height = font->face->size->metrics.height / 64;
+	float scale = layout->scale;
+	
+	for(char* line_start = next->text; line_start != NULL; ) {
+		char* line_end = strchr(line_start, '\n');
+		size_t line_length = (line_end) ? (size_t)(line_end - line_start) : strlen(line_start);
+		size_t line_idx = next->line_count++;
 		
-		if (line->height == glyph_height) {
-			// We found a line with matching height, now look if we can get our cell in there
-			x = 0;
-			for(size_t j = 0; j < line->cells->length; j++) {
-				text_renderer_cell_p current_cell = array_elem_ptr(line->cells, j);
-				x += current_cell->width + padding;
+		text_layout_line_p line = &next->lines[line_idx];
+		*line = (text_layout_line_t){
+			.start = line_start - next->text,
+			.length = line_length,
+			.first_glyph = next->glyph_count,
+			.glyph_count = 0
+		};
+		
+		// Copy all glyphs of the old line before the first changed byte
+		size_t prefix = 0, kept_glyphs = 0;
+		if (reuse_prev && line_idx < prev->line_count) {
+			text_layout_line_p prev_line = &prev->lines[line_idx];
+			char* prev_start = prev->text + prev_line->start;
+			while (prefix < line_length && prefix < prev_line->length && prev_start[prefix] == line_start[prefix])
+				prefix++;
+			// Don't start in the middle of a multi-byte code point
+			if (prefix < line_length || prefix < prev_line->length) {
+				while (prefix > 0 && (line_start[prefix] & 0xC0) == 0x80)
+					prefix--;
 			}
 			
-			if (x + glyph_width <= texture_width) {
-				// There is space left at the end of this line, add our cell here
-				text_renderer_cell_p cell = array_append_ptr(line->cells);
-				memset(cell, 0, sizeof(text_renderer_cell_t));
-				
-				cell->x = x;
-				cell->y = y;
-				cell->width = glyph_width;
-				
-				*line_idx = i;
-				*cell_idx = line->cells->length - 1;
-				return cell;
+			while (kept_glyphs < prev_line->glyph_count && prev->glyphs[prev_line->first_glyph + kept_glyphs].offset < prefix)
+				kept_glyphs++;
+			
+			memcpy(&next->glyphs[line->first_glyph], &prev->glyphs[prev_line->first_glyph], kept_glyphs * sizeof(text_layout_glyph_t));
+			memcpy(&next->instances[line->first_glyph], &prev->instances[prev_line->first_glyph], kept_glyphs * sizeof(text_layout_instance_t));
+			if (kept_glyphs > 0 && line->first_glyph != prev_line->first_glyph) {
+				dirty_start = (line->first_glyph < dirty_start) ? line->first_glyph : dirty_start;
+				dirty_end = (line->first_glyph + kept_glyphs > dirty_end) ? line->first_glyph + kept_glyphs : dirty_end;
+			}
+		}
+		line->glyph_count = kept_glyphs;
+		next->glyph_count += kept_glyphs;
+		
+		// Lay out the rest of the line, continuing after the last copied glyph
+		text_layout_glyph_p last_glyph = (kept_glyphs > 0) ? &next->glyphs[next->glyph_count - 1] : NULL;
+		int32_t pen_x = (last_glyph) ? last_glyph->pen_x : 0;
+		int32_t pen_y = line_height * (line_idx + 1);
+		uint32_t prev_glyph_index = (last_glyph) ? last_glyph->glyph_index : 0;
+		
+		if (next->glyph_count < dirty_start && prefix < line_length)
+			dirty_start = next->glyph_count;
+		
+		char* glyph_start = line_start + prefix;
+		for(utf8_iterator_t it = utf8_first_size(glyph_start, line_length - prefix); it.code_point != 0; glyph_start = it.buffer, it = utf8_next(it)) {
+			text_layout_glyph_p glyph = &next->glyphs[next->glyph_count];
+			text_layout_instance_p instance = &next->instances[next->glyph_count];
+			next->glyph_count++;
+			line->glyph_count++;
+			
+			// Glyphs that can't be rendered get an empty instance so every code point
+			// has one
+			uint32_t atlas_line = 0;
+			const text_renderer_cell_t* cell = lookup_glyph(renderer, layout->font, font, it.code_point, &atlas_line);
+			if (!cell) {
+				*glyph = (text_layout_glyph_t){ glyph_start - line_start, pen_x, 0, 0 };
+				*instance = (text_layout_instance_t){ .x = layout->x + pen_x * scale, .y = layout->y + pen_y * scale };
+				prev_glyph_index = 0;
+				continue;
 			}
 			
-			// No space at end of line, search next line
+			pen_x += kerning(font, prev_glyph_index, cell->glyph_index);
+			
+			*instance = (text_layout_instance_t){
+				.x = layout->x + (pen_x + cell->hori_bearing_x) * scale, .y = layout->y + (pen_y - cell->hori_bearing_y) * scale,
+				.u = cell->x, .v = cell->y,
+				.w = cell->width * scale, .h = cell->height * scale,
+				.tex_w = cell->width, .tex_h = cell->height
+			};
+			pen_x += cell->hori_advance;
+			*glyph = (text_layout_glyph_t){ glyph_start - line_start, pen_x, cell->glyph_index, atlas_line };
+			prev_glyph_index = cell->glyph_index;
 		}
 		
-		y += line->height + padding;
+		if (next->glyph_count > dirty_end && line->glyph_count > kept_glyphs)
+			dirty_end = next->glyph_count;
+		
+		line_start = (line_end) ? line_end + 1 : NULL;
+	}
+	
+	// Instances after the end of a shorter text are just not drawn anymore
+	if (dirty_end > next->glyph_count)
+		dirty_end = next->glyph_count;
+	
+	size_t instance_size = sizeof(text_layout_instance_t);
+	if (next->glyph_count > layout->buffer_capacity) {
+		// Grow the buffer, this uploads all instances
+		while (layout->buffer_capacity < next->glyph_count)
+			layout->buffer_capacity = (layout->buffer_capacity) ? layout->buffer_capacity * 2 : 64;
+		buffer_update(layout->buffer, layout->buffer_capacity * instance_size, NULL, GL_DYNAMIC_DRAW);
+		buffer_update_part(layout->buffer, 0, next->glyph_count * instance_size, next->instances);
+	} else if (dirty_start < dirty_end) {
+		buffer_update_part(layout->buffer, dirty_start * instance_size, (dirty_end - dirty_start) * instance_size, next->instances + dirty_start);
+	}
+	
+	text_layout_state_t finished = *next;
+	layout->next = layout->current;
+	layout->current = finished;
+	layout->generation = renderer->generation;
+	return true;
+}
+
+/**
+ * Draws the last text with `drawable`, which has to be created by drawable_new_instanced()
+ * with 4 vertices per instance (GL_TRIANGLE_STRIP) and the text shaders. Lays out the text
+ * again if some of its glyphs were evicted from the texture.
+ */
+bool text_layout_draw(text_layout_p layout, drawable_p drawable) {
+	if (layout->current.text && (layout->generation != layout->renderer->generation || layout->current.scale != layout->scale))
+		text_layout_update(layout, layout->current.text);
+	touch_glyphs(layout->renderer, &layout->current);
+	
+	drawable->vertex_buffer = layout->buffer;
+	drawable->texture = layout->renderer->texture;
+	drawable->instance_count = layout->current.glyph_count;
+	bool success = drawable_draw(drawable);
+	
+	// The buffer and texture still belong to the layout and renderer
+	drawable->vertex_buffer = 0;
+	drawable->texture = 0;
+	return success;
+}
+
+/**
+ * Draws the text with a height of `pixel_size` pixels. Only makes sense for SDF fonts, other
+ * fonts just get blurry. The text is laid out again on the next update or draw.
+ */
+void text_layout_set_size(text_layout_p layout, float pixel_size) {
+	text_renderer_font_p font = hash_get_ptr(layout->renderer->fonts, layout->font);
+	if (font)
+		layout->scale = pixel_size / font->size;
+}
+
+static void layout_state_reserve(text_layout_state_p state, size_t text_size) {
+	if (text_size <= state->capacity)
+		return;
+	
+	// A text has at most one glyph per byte and one line more than line breaks
+	state->capacity = text_size;
+	state->text      = realloc(state->text,      text_size);
+	state->lines     = realloc(state->lines,     text_size * sizeof(text_layout_line_t));
+	state->glyphs    = realloc(state->glyphs,    text_size * sizeof(text_layout_glyph_t));
+	state->instances = realloc(state->instances, text_size * sizeof(text_layout_instance_t));
+}
+
+static void layout_state_free(text_layout_state_p state) {
+	free(state->text);
+	free(state->lines);
+	free(state->glyphs);
+	free(state->instances);
+}
+
+/**
+ * Marks the texture lines of all glyphs in `state` as used in the current frame.
+ */
+static void touch_glyphs(text_renderer_p renderer, text_layout_state_p state) {
+	for(size_t i = 0; i < state->glyph_count; i++) {
+		if (state->glyphs[i].glyph_index == 0)
+			continue;
+		text_renderer_line_p line = array_elem_ptr(renderer->lines, state->glyphs[i].atlas_line);
+		line->last_used = renderer->frame;
+	}
+}
+
+
+//
+// Glyph cache
+//
+
+/**
+ * Looks up the cell of the glyph for `code_point` and the index of its line. The line of
+ * the glyph is marked as used in the current frame. Glyphs not in the texture yet are
+ * queued for the worker. Until they are uploaded by text_renderer_next_frame() an empty
+ * placeholder cell half an em wide is returned (with a glyph index of 0).
+ * 
+ * The cell is valid until the next upload. Returns `NULL` if the font has no such glyph.
+ */
+static const text_renderer_cell_t* lookup_glyph(text_renderer_p renderer, int32_t font_handle, text_renderer_font_p font, uint32_t code_point, uint32_t* line_idx) {
+	// Prepared code points are looked up directly, everything else via the cell
+	// references of the font
+	uint32_t prepared_idx = code_point - font->prepared_start;
+	if (prepared_idx < font->prepared_count && font->prepared[prepared_idx].line_idx != UINT32_MAX) {
+		text_renderer_prepared_glyph_p prepared = &font->prepared[prepared_idx];
+		renderer->hits++;
+		array_data(renderer->lines, text_renderer_line_t)[prepared->line_idx].last_used = renderer->frame;
+		*line_idx = prepared->line_idx;
+		return &prepared->cell;
+	}
+	
+	text_renderer_cell_ref_p cell_ref = hash_get_ptr(font->cell_refs, code_point);
+	if (cell_ref) {
+		renderer->hits++;
+		text_renderer_line_p line = array_elem_ptr(renderer->lines, cell_ref->line_idx);
+		line->last_used = renderer->frame;
+		*line_idx = cell_ref->line_idx;
+		return array_elem_ptr(line->cells, cell_ref->cell_idx);
 	}
 	
-	// We haven't found a matching line or every matching line was full. Anyway add a new line
-	// if there is space left at the bottom of the texture and put the cell in there.
-	if (y + glyph_height + padding <= texture_height) {
-		text_renderer_line_p line = array_append_ptr(renderer->lines);
-		line->height = glyph_height;
-		line->cells = array_of(text_renderer_cell_t);
+	// Glyph not rendered yet, let the worker render it if it doesn't already
+	uint8_t* state = hash_get_ptr(font->pending, code_point);
+	if (state && *state == TEXT_RENDERER_GLYPH_MISSING)
+		return NULL;
+	
+	if (!state) {
+		renderer->misses++;
+		hash_put(font->pending, code_point, uint8_t, TEXT_RENDERER_GLYPH_PENDING);
+		queue_job(renderer, (text_renderer_job_t){ .type = TEXT_RENDERER_JOB_GLYPH, .font_handle = font_handle, .code_point = code_point });
+	}
+	
+	*line_idx = 0;
+	return &font->placeholder;
+}
+
+/**
+ * Returns the kerning between two glyphs in pixels. Placeholders and missing glyphs
+ * (glyph index 0) are never kerned.
+ */
+static int32_t kerning(text_renderer_font_p font, uint32_t left_glyph_index, uint32_t right_glyph_index) {
+	if (left_glyph_index == 0 || right_glyph_index == 0 || font->kerning->length == 0)
+		return 0;
+	
+	int32_t* x = hash_get_ptr(font->kerning, left_glyph_index << 16 | right_glyph_index);
+	return (x) ? *x : 0;
+}
+
+/**
+ * Public versions of lookup_glyph() and kerning(). The returned cell is only valid until
+ * the next text_renderer_next_frame(), the line of the glyph is marked as used in this
+ * frame. Placeholders of glyphs the worker didn't finish yet have a glyph index of 0.
+ */
+const text_renderer_cell_t* text_renderer_lookup(text_renderer_p renderer, int32_t font_handle, uint32_t code_point, uint32_t* line_idx) {
+	text_renderer_font_p font = hash_get_ptr(renderer->fonts, font_handle);
+	if (!font)
+		return NULL;
+	return lookup_glyph(renderer, font_handle, font, code_point, line_idx);
+}
+
+int32_t text_renderer_kerning(text_renderer_p renderer, int32_t font_handle, uint32_t left_glyph_index, uint32_t right_glyph_index) {
+	text_renderer_font_p font = hash_get_ptr(renderer->fonts, font_handle);
+	return (font) ? kerning(font, left_glyph_index, right_glyph_index) : 0;
+}
+
+/**
+ * Puts the glyphs the worker finished into the texture. Since layouts might show
+ * placeholders for them the generation is incremented so they are laid out again.
+ */
+static void upload_staged_glyphs(text_renderer_p renderer) {
+	// Only hold the lock while taking the staged glyphs, the worker can continue meanwhile
+	pthread_mutex_lock(&renderer->lock);
+		array_p uploads = renderer->staged;
+		renderer->staged = renderer->uploads;
+		renderer->uploads = uploads;
+	pthread_mutex_unlock(&renderer->lock);
+	
+	if (uploads->length == 0)
+		return;
+	
+	// Glyph bitmaps are tightly packed, GL_UNPACK_ALIGNMENT is reset to its default of 4 afterwards
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	
+	for(size_t i = 0; i < uploads->length; i++) {
+		text_renderer_staged_glyph_p glyph = array_elem_ptr(uploads, i);
+		text_renderer_font_p font = hash_get_ptr(renderer->fonts, glyph->font_handle);
 		
-		text_renderer_cell_p cell = array_append_ptr(line->cells);
-		memset(cell, 0, sizeof(text_renderer_cell_t));
+		// The font might have been destroyed since the glyph was requested
+		if (!font) {
+			free(glyph->bitmap);
+			free(glyph->kerning);
+			continue;
+		}
+		
+		for(size_t j = 0; j < glyph->kerning_count; j++)
+			hash_put(font->kerning, glyph->kerning[j].pair, int32_t, glyph->kerning[j].x);
+		free(glyph->kerning);
+		
+		if (!glyph->found) {
+			hash_put(font->pending, glyph->code_point, uint8_t, TEXT_RENDERER_GLYPH_MISSING);
+			continue;
+		}
+		
+		// Look for a free cell to store the rendered glyph. If there is no space left
+		// the glyph is requested again the next time it's used.
+		hash_remove(font->pending, glyph->code_point);
+		size_t line_idx = 0, cell_idx = 0;
+		text_renderer_cell_p cell = place_glyph(renderer, glyph->font_handle, glyph->code_point, glyph->width, glyph->height, &line_idx, &cell_idx);
+		if (cell == NULL) {
+			free(glyph->bitmap);
+			continue;
+		}
+		
+		cell->glyph_index    = glyph->glyph_index;
+		cell->hori_bearing_x = glyph->hori_bearing_x;
+		cell->hori_bearing_y = glyph->hori_bearing_y;
+		cell->hori_advance   = glyph->hori_advance;
 		
-		cell->x = x;
-		cell->y = y;
-		cell->width = glyph_width;
+		// place_glyph() might have replaced the texture by a larger one, so bind it every time
+		glBindTexture(GL_TEXTURE_RECTANGLE, renderer->texture);
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, cell->x, cell->y, glyph->width, glyph->height, GL_RED, GL_UNSIGNED_BYTE, glyph->bitmap);
+		free(glyph->bitmap);
+		
+		text_renderer_cell_ref_p cell_ref = hash_put_ptr(font->cell_refs, glyph->code_point);
+		cell_ref->line_idx = line_idx;
+		cell_ref->cell_idx = cell_idx;
+		
+		if (glyph->code_point - font->prepared_start < font->prepared_count)
+			font->prepared[glyph->code_point - font->prepared_start] = (text_renderer_prepared_glyph_t){ *cell, line_idx };
+	}
+	
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	
+	array_resize(uploads, 0);
+	renderer->generation++;
+}
+
+/**
+ * Finds space for a glyph in the texture and appends a cell for it to a line. The glyph
+ * goes at the end of the open line with its height. If that line is full a new line is
+ * started below the last one, adding a new page if necessary. When all pages are full
+ * the least recently used line that is high enough is evicted and reused.
+ * 
+ * Returns the new cell or `NULL` if the glyph doesn't fit anywhere.
+ */
+static text_renderer_cell_p place_glyph(text_renderer_p renderer, int32_t font_handle, uint32_t code_point, uint32_t glyph_width, uint32_t glyph_height, size_t* line_idx, size_t* cell_idx) {
+	// Padding between the glyphs
+	const uint32_t padding = 1;
+	uint32_t line_height = (glyph_height + TEXT_RENDERER_LINE_STEP - 1) / TEXT_RENDERER_LINE_STEP * TEXT_RENDERER_LINE_STEP;
+	if (glyph_width > renderer->page_width || line_height > renderer->page_height)
+		return NULL;
+	
+	// The open line of our height still has space at its end
+	size_t* open_line_idx = hash_get_ptr(renderer->open_lines, line_height);
+	text_renderer_line_p line = (open_line_idx) ? array_elem_ptr(renderer->lines, *open_line_idx) : NULL;
+	if (line && line->end_x + glyph_width <= renderer->page_width) {
+		*line_idx = *open_line_idx;
+		goto place_in_line;
+	}
+	
+	// Start a new line after the last one. Lines don't cross page borders, if there is
+	// not enough space left on the last page start one on the next page.
+	uint32_t y = renderer->lines_end_y;
+	uint32_t page_end_y = (y / renderer->page_height + 1) * renderer->page_height;
+	if (y + line_height > page_end_y)
+		y = page_end_y;
+	
+	bool space_left = (y + line_height <= renderer->page_height * renderer->page_count);
+	if (!space_left)
+		space_left = add_page(renderer);
+	
+	if (space_left) {
+		line = array_append_ptr(renderer->lines);
+		*line = (text_renderer_line_t){
+			.y = y,
+			.height = line_height,
+			.end_x = 0,
+			.last_used = renderer->frame,
+			.cells = array_of(text_renderer_cell_t)
+		};
 		
 		*line_idx = renderer->lines->length - 1;
-		*cell_idx = 0;
+		renderer->lines_end_y = y + line_height + padding;
+		hash_put(renderer->open_lines, line_height, size_t, *line_idx);
+		goto place_in_line;
+	}
+	
+	// All pages are full, evict the least recently used line that is high enough. Uploads
+	// run right after text_renderer_next_frame() incremented `frame`, so lines used in the
+	// last frame are still visible and are kept too.
+	ssize_t lru_idx = -1;
+	for(size_t i = 0; i < renderer->lines->length; i++) {
+		text_renderer_line_p candidate = array_elem_ptr(renderer->lines, i);
+		if (candidate->height < line_height || candidate->last_used + 1 >= renderer->frame)
+			continue;
+		
+		if (lru_idx == -1 || candidate->last_used < array_elem(renderer->lines, text_renderer_line_t, lru_idx).last_used)
+			lru_idx = i;
+	}
+	
+	if (lru_idx == -1) {
+		*line_idx = (size_t)-1;
+		*cell_idx = (size_t)-1;
+		return NULL;
+	}
+	
+	evict_line(renderer, lru_idx);
+	line = array_elem_ptr(renderer->lines, lru_idx);
+	*line_idx = lru_idx;
+	hash_put(renderer->open_lines, line->height, size_t, *line_idx);
+	
+	place_in_line: {
+		text_renderer_cell_p cell = array_append_ptr(line->cells);
+		*cell = (text_renderer_cell_t){
+			.x = line->end_x,
+			.y = line->y,
+			.width = glyph_width,
+			.height = glyph_height,
+			.font_handle = font_handle,
+			.code_point = code_point
+		};
+		
+		line->end_x += glyph_width + padding;
+		line->last_used = renderer->frame;
+		*cell_idx = line->cells->length - 1;
 		return cell;
 	}
+}
+
+/**
+ * Adds a page to the texture. Since rectangle textures can't be resized the texture is
+ * replaced by a larger one and the old pages are copied over.
+ * 
+ * Returns `false` if there are already TEXT_RENDERER_MAX_PAGES pages.
+ */
+static bool add_page(text_renderer_p renderer) {
+	if (renderer->page_count >= TEXT_RENDERER_MAX_PAGES)
+		return false;
+	
+	uint32_t width = renderer->page_width, old_height = renderer->page_height * renderer->page_count;
+	GLuint texture = atlas_texture_new(width, old_height + renderer->page_height);
+	
+	// We might be called while rendering into a framebuffer, restore it afterwards
+	GLint draw_framebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+	
+	fbo_p old_pages = fbo_new(renderer->texture);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, old_pages->fbo);
+	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
+	glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, 0, 0, 0, width, old_height);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	fbo_destroy(old_pages);
+	
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+	
+	texture_destroy(renderer->texture);
+	renderer->texture = texture;
+	renderer->page_count++;
+	
+	return true;
+}
+
+/**
+ * Removes all cells of a line from the texture and their fonts. The line itself stays
+ * with its height but is empty afterwards.
+ */
+static void evict_line(text_renderer_p renderer, size_t line_idx) {
+	text_renderer_line_p line = array_elem_ptr(renderer->lines, line_idx);
+	
+	for(size_t i = 0; i < line->cells->length; i++) {
+		text_renderer_cell_p cell = array_elem_ptr(line->cells, i);
+		text_renderer_font_p font = hash_get_ptr(renderer->fonts, cell->font_handle);
+		if (!font)
+			continue;
+		
+		hash_remove(font->cell_refs, cell->code_point);
+		if (cell->code_point - font->prepared_start < font->prepared_count)
+			font->prepared[cell->code_point - font->prepared_start].line_idx = UINT32_MAX;
+	}
+	array_resize(line->cells, 0);
+	line->end_x = 0;
+	
+	// Clear the line, otherwise the linear filtering at the glyph borders might pick up
+	// parts of the old glyphs
+	void* black_data = calloc(renderer->page_width, line->height);
+	glBindTexture(GL_TEXTURE_RECTANGLE, renderer->texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, line->y, renderer->page_width, line->height, GL_RED, GL_UNSIGNED_BYTE, black_data);
+	free(black_data);
+	
+	renderer->evictions++;
+	renderer->generation++;
+}
+
+/**
+ * Creates a black texture for the glyphs.
+ */
+static GLuint atlas_texture_new(uint32_t width, uint32_t height) {
+	GLuint texture = texture_new(width, height, GL_R8);
+	
+	void* black_data = calloc(width, height);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	texture_update(texture, GL_RED, black_data);
+	free(black_data);
+	
+	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	
+	return texture;
+}
+
+
+//
+// Rasterization worker
+//
+
+static void queue_job(text_renderer_p renderer, text_renderer_job_t job) {
+	pthread_mutex_lock(&renderer->lock);
+		array_append(renderer->jobs, text_renderer_job_t, job);
+		pthread_cond_signal(&renderer->jobs_added);
+	pthread_mutex_unlock(&renderer->lock);
+}
+
+/**
+ * Takes all queued jobs at once and runs them without holding the lock. Finished glyphs
+ * are staged one by one so text_renderer_next_frame() can upload them as soon as possible.
+ */
+static void* worker_main(void* arg) {
+	text_renderer_p renderer = arg;
+	array_p jobs = array_of(text_renderer_job_t);
+	
+	pthread_mutex_lock(&renderer->lock);
+	while (true) {
+		while (renderer->jobs->length == 0 && !renderer->worker_quit) {
+			renderer->worker_busy = false;
+			pthread_cond_broadcast(&renderer->worker_idle);
+			pthread_cond_wait(&renderer->jobs_added, &renderer->lock);
+		}
+		
+		if (renderer->jobs->length == 0 && renderer->worker_quit)
+			break;
+		
+		renderer->worker_busy = true;
+		array_p taken_jobs = renderer->jobs;
+		renderer->jobs = jobs;
+		jobs = taken_jobs;
+		
+		pthread_mutex_unlock(&renderer->lock);
+			for(size_t i = 0; i < jobs->length; i++)
+				worker_run_job(renderer, array_elem_ptr(jobs, i));
+			array_resize(jobs, 0);
+		pthread_mutex_lock(&renderer->lock);
+	}
+	pthread_mutex_unlock(&renderer->lock);
 	
-	// We would like to add a new line but there is not enough free space at the bottom
-	// to the texture. For now just give up.
-	*line_idx = (size_t)-1;
-	*cell_idx = (size_t)-1;
+	array_destroy(jobs);
 	return NULL;
-}
\ No newline at end of file
+}
+
+static void worker_run_job(text_renderer_p renderer, text_renderer_job_p job) {
+	if (job->type == TEXT_RENDERER_JOB_FONT_NEW) {
+		FT_Face face = NULL;
+		FT_Error error = FT_New_Face(renderer->worker_freetype, job->font_path, 0, &face);
+		free(job->font_path);
+		if (error) {
+			printf("FT_New_Face error\n");
+			return;
+		}
+		
+		error = FT_Set_Pixel_Sizes(face, 0, job->font_size);
+		if (error) {
+			printf("FT_Set_Pixel_Size error\n");
+			FT_Done_Face(face);
+			return;
+		}
+		
+		hash_put(renderer->worker_fonts, job->font_handle, text_renderer_worker_font_t, ((text_renderer_worker_font_t){
+			.face = face,
+			.sdf = job->sdf,
+			.glyph_indices = array_of(uint32_t)
+		}));
+		return;
+	}
+	
+	text_renderer_worker_font_p font = hash_get_ptr(renderer->worker_fonts, job->font_handle);
+	if (!font)
+		return;
+	FT_Face face = font->face;
+	
+	if (job->type == TEXT_RENDERER_JOB_FONT_DESTROY) {
+		FT_Done_Face(face);
+		array_destroy(font->glyph_indices);
+		hash_remove(renderer->worker_fonts, job->font_handle);
+		return;
+	}
+	
+	// Glyphs not found in the font are staged too, so they aren't requested again
+	text_renderer_staged_glyph_t glyph = {
+		.font_handle = job->font_handle,
+		.code_point = job->code_point,
+		.found = false
+	};
+	
+	bool sdf = font->sdf;
+	glyph.glyph_index = FT_Get_Char_Index(face, job->code_point);
+	if (glyph.glyph_index != 0) {
+		// Distance fields are scaled anyway so don't hint them to the base size
+		FT_Error error = FT_Load_Glyph(face, glyph.glyph_index, (sdf) ? FT_LOAD_NO_HINTING : FT_LOAD_RENDER);
+		if (!error && sdf)
+			error = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF);
+		glyph.found = !error;
+	}
+	
+	if (glyph.found) {
+		FT_GlyphSlot slot = face->glyph;
+		glyph.width  = slot->bitmap.width;
+		glyph.height = slot->bitmap.rows;
+		glyph.hori_bearing_x = slot->metrics.horiBearingX / 64;
+		glyph.hori_bearing_y = slot->metrics.horiBearingY / 64;
+		glyph.hori_advance   = slot->metrics.horiAdvance  / 64;
+		// Distance fields extend beyond the outline, the bitmap position includes that
+		if (sdf) {
+			glyph.hori_bearing_x = slot->bitmap_left;
+			glyph.hori_bearing_y = slot->bitmap_top;
+		}
+		
+		// Copy the bitmap without the padding at the end of the rows
+		glyph.bitmap = malloc(glyph.width * glyph.height + 1);
+		for(uint32_t y = 0; y < glyph.height; y++)
+			memcpy(glyph.bitmap + y * glyph.width, slot->bitmap.buffer + y * slot->bitmap.pitch, glyph.width);
+		
+		worker_kerning(font, &glyph);
+	}
+	
+	pthread_mutex_lock(&renderer->lock);
+		array_append(renderer->staged, text_renderer_staged_glyph_t, glyph);
+	pthread_mutex_unlock(&renderer->lock);
+}
+
+/**
+ * Calculates the kerning of a new glyph with all glyphs rasterized before (in both
+ * directions) and with itself. That way every pair of glyphs the frame loop can see
+ * has its kerning in the font's table. Glyph indices are at most 16 bit (the limit of
+ * TrueType and OpenType), so a pair fits into 32 bit.
+ */
+static void worker_kerning(text_renderer_worker_font_p font, text_renderer_staged_glyph_p glyph) {
+	uint32_t* known = array_data(font->glyph_indices, uint32_t);
+	for(size_t i = 0; i < font->glyph_indices->length; i++) {
+		// Evicted glyphs are rasterized again, their kerning is already known
+		if (known[i] == glyph->glyph_index)
+			return;
+	}
+	
+	array_append(font->glyph_indices, uint32_t, glyph->glyph_index);
+	if ( !FT_HAS_KERNING(font->face) )
+		return;
+	
+	size_t count = font->glyph_indices->length;
+	known = array_data(font->glyph_indices, uint32_t);
+	glyph->kerning = malloc(count * 2 * sizeof(text_renderer_kerning_t));
+	glyph->kerning_count = 0;
+	
+	for(size_t i = 0; i < count; i++) {
+		uint32_t pairs[2][2] = { { known[i], glyph->glyph_index }, { glyph->glyph_index, known[i] } };
+		for(size_t j = 0; j < 2; j++) {
+			FT_Vector delta;
+			if ( FT_Get_Kerning(font->face, pairs[j][0], pairs[j][1], FT_KERNING_DEFAULT, &delta) != 0 || delta.x / 64 == 0 )
+				continue;
+			glyph->kerning[glyph->kerning_count++] = (text_renderer_kerning_t){ pairs[j][0] << 16 | pairs[j][1], delta.x / 64 };
+		}
+	}
+}
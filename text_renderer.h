@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <pthread.h>
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <ft2build.h>
@@ -8,6 +9,7 @@
 
 #include "hash.h"
 #include "array.h"
+#include "drawable.h"
 
 /**
  * Schema of the texture used by
@@ -19,54 +21,262 @@
  * ||| | | ||           |
  * +--------+           |
  * |                    |
- * |                    |
+ * +--------------------+  page 2
  * |                    |
  * |                    |
  * +--------------------+
  * 
  * Lines are horizontal regions in the texture where cells of the same
- * height are stored.
+ * height (rounded up to TEXT_RENDERER_LINE_STEP) are stored. Each line
+ * tracks where its free space starts and the last line of each height
+ * is the one new cells go into, so placing a glyph doesn't search.
  * A cell is a rectangle in a line that stores the pixel data of one
  * glyph. The cell structure also stores metrics so we don't have to ask
  * FreeType every time.
+ * 
+ * When all pages are full a new page is added below (the texture is
+ * replaced by a larger one). After TEXT_RENDERER_MAX_PAGES the least
+ * recently used line is emptied and reused. Only lines not used since the
+ * last text_renderer_next_frame() are evicted. Evicting increments
+ * `generation`, text layouts lay out their text again when it changed.
+ * 
+ * Glyphs are rasterized by a worker thread, the frame loop never waits for
+ * FreeType. Missing glyphs are queued as jobs and drawn as empty placeholders.
+ * The worker puts finished glyphs into `staged` and text_renderer_next_frame()
+ * uploads them all at once (which also increments `generation`).
+ */
+
+#define TEXT_RENDERER_LINE_STEP  4
+#define TEXT_RENDERER_MAX_PAGES  8
+
+/**
+ * Fonts created with text_renderer_sdf_font_new() store signed distance fields instead of
+ * coverage: 128 is the outline of the glyph, larger values are inside. The glyphs are
+ * rendered once at TEXT_RENDERER_SDF_SIZE and text layouts can draw them at any size with
+ * the shaders/text_sdf.fs shader. The field reaches TEXT_RENDERER_SDF_SPREAD pixels beyond
+ * the outline, that's the space available for outlines and shadows.
  */
+#define TEXT_RENDERER_SDF_SIZE    32
+#define TEXT_RENDERER_SDF_SPREAD  6
 
 typedef struct {
 	GLuint texture;
 	hash_p fonts;
 	FT_Library freetype;
 	array_p lines;
+	
+	// Maps line heights to the index of the line new cells of that height go into
+	hash_p open_lines;
+	uint32_t page_width, page_height, page_count;
+	// New lines start here
+	uint32_t lines_end_y;
+	
+	uint64_t frame, generation;
+	uint64_t hits, misses, evictions;
+	
+	// Protects `jobs`, `staged` and the worker flags
+	pthread_mutex_t lock;
+	pthread_cond_t jobs_added, worker_idle;
+	array_p jobs, staged;
+	bool worker_busy, worker_quit;
+	// Swapped with `staged` to upload the glyphs without holding the lock
+	array_p uploads;
+	
+	// Only used by the worker, maps font handles to the worker's own fonts
+	pthread_t worker;
+	FT_Library worker_freetype;
+	hash_p worker_fonts;
 } text_renderer_t, *text_renderer_p;
 
 void text_renderer_new(text_renderer_p renderer, size_t texture_width, size_t texture_height);
 void text_renderer_destroy(text_renderer_p renderer);
+void text_renderer_next_frame(text_renderer_p renderer);
+void text_renderer_upload(text_renderer_p renderer);
+
 
+typedef struct {
+	uint32_t x, y;
+	uint32_t width, height;
+	uint32_t glyph_index;
+	int32_t hori_bearing_x, hori_bearing_y, hori_advance;
+	// Needed to remove the cell reference of the font when the line is evicted
+	int32_t font_handle;
+	uint32_t code_point;
+} text_renderer_cell_t, *text_renderer_cell_p;
+
+typedef struct {
+	text_renderer_cell_t cell;
+	// UINT32_MAX if the glyph isn't in the texture
+	uint32_t line_idx;
+} text_renderer_prepared_glyph_t, *text_renderer_prepared_glyph_p;
 
 typedef struct {
 	FT_Face face;
+	// Signed distance field font, rendered at `size` pixels
+	bool sdf;
+	uint32_t size;
 	// Maps code points of this font to their corresponding cells. Only
 	// cells already stored in the texture are in here.
 	hash_p cell_refs;
+	// Code points queued for the worker or not in the font (TEXT_RENDERER_GLYPH_*)
+	hash_p pending;
+	
+	// Copies of the cells for the code points passed to text_renderer_prepare(), indexed
+	// by code point - prepared_start. Looked up without hashing the code point.
+	text_renderer_prepared_glyph_p prepared;
+	uint32_t prepared_start, prepared_count;
+	// Returned for glyphs the worker didn't finish yet
+	text_renderer_cell_t placeholder;
+	
+	// Kerning of glyph pairs (left glyph index << 16 | right glyph index) in pixels. Filled
+	// by the worker for all pairs of rasterized glyphs, pairs without kerning are left out.
+	hash_p kerning;
 } text_renderer_font_t, *text_renderer_font_p;
 
+#define TEXT_RENDERER_GLYPH_PENDING  1
+#define TEXT_RENDERER_GLYPH_MISSING  2
+
 typedef struct {
 	size_t line_idx, cell_idx;
 } text_renderer_cell_ref_t, *text_renderer_cell_ref_p;
 
 int32_t text_renderer_font_new(text_renderer_p renderer, const char* font_path, size_t font_size);
+int32_t text_renderer_sdf_font_new(text_renderer_p renderer, const char* font_path);
 void    text_renderer_font_destroy(text_renderer_p renderer, int32_t font_handle);
 
 void   text_renderer_prepare(text_renderer_p renderer, int32_t font_handle, uint32_t range_start, uint32_t range_end);
 size_t text_renderer_render(text_renderer_p renderer, int32_t font_handle, char* text, size_t x, size_t y, float* buffer_ptr, size_t buffer_size);
 
+// For code that lays out glyphs on its own (like the ticker). The glyph of a code point the
+// worker didn't rasterize yet has glyph index 0, NULL means the font has no glyph for it.
+const text_renderer_cell_t* text_renderer_lookup(text_renderer_p renderer, int32_t font_handle, uint32_t code_point, uint32_t* line_idx);
+int32_t                     text_renderer_kerning(text_renderer_p renderer, int32_t font_handle, uint32_t left_glyph_index, uint32_t right_glyph_index);
+
 typedef struct {
-	uint32_t height;
+	uint32_t y, height;
+	// x position of the free space after the last cell
+	uint32_t end_x;
+	// Frame the line was last used in, for LRU eviction
+	uint64_t last_used;
 	array_p cells;
 } text_renderer_line_t, *text_renderer_line_p;
 
+#define TEXT_RENDERER_JOB_GLYPH         1
+#define TEXT_RENDERER_JOB_FONT_NEW      2
+#define TEXT_RENDERER_JOB_FONT_DESTROY  3
+
 typedef struct {
-	uint32_t x, y;
-	uint32_t width;
+	uint8_t type;
+	int32_t font_handle;
+	uint32_t code_point;
+	// Only for TEXT_RENDERER_JOB_FONT_NEW, the worker frees the path
+	char* font_path;
+	uint32_t font_size;
+	bool sdf;
+} text_renderer_job_t, *text_renderer_job_p;
+
+typedef struct {
+	uint32_t pair;
+	int32_t x;
+} text_renderer_kerning_t, *text_renderer_kerning_p;
+
+typedef struct {
+	int32_t font_handle;
+	uint32_t code_point;
+	// `false` if the font has no glyph for the code point, there is no bitmap then
+	bool found;
 	uint32_t glyph_index;
 	int32_t hori_bearing_x, hori_bearing_y, hori_advance;
-} text_renderer_cell_t, *text_renderer_cell_p;
\ No newline at end of file
+	// Tightly packed, freed after the upload
+	uint32_t width, height;
+	uint8_t* bitmap;
+	// Kerning of the glyph with all glyphs rasterized before, freed after the upload
+	text_renderer_kerning_p kerning;
+	size_t kerning_count;
+} text_renderer_staged_glyph_t, *text_renderer_staged_glyph_p;
+
+typedef struct {
+	FT_Face face;
+	bool sdf;
+	// Indices of all glyphs rasterized so far, the kerning of new glyphs is calculated
+	// against them
+	array_p glyph_indices;
+} text_renderer_worker_font_t, *text_renderer_worker_font_p;
+
+
+/**
+ * A text layout keeps the glyphs of a text as instances in a GPU buffer (one quad per
+ * glyph). When the text changes only the changed parts of each line are laid out again
+ * and only the changed instances are uploaded. Setting the same text again just costs
+ * a strcmp(). Meant for texts drawn every frame that rarely change completely, like
+ * labels or the status text.
+ * 
+ * drawable_p text = drawable_new_instanced(GL_TRIANGLE_STRIP, 4, "shaders/text.vs", "shaders/text.fs");
+ * text_layout_p status = text_layout_new(&renderer, font, 10, 10);
+ * 
+ * text_layout_update(status, "Hello\nWorld!");
+ * text_layout_draw(status, text);
+ * 
+ * text_layout_destroy(status);
+ * 
+ * Layouts of SDF fonts can be scaled with text_layout_set_size(). Draw them with the
+ * "shaders/text_sdf.fs" fragment shader instead.
+ */
+
+typedef struct {
+	// Passed as `pos_and_tex`: top left corner of the glyph on the screen and in the texture
+	float x, y, u, v;
+	// Passed as `instance_data`: size of the glyph on the screen and in the texture
+	float w, h, tex_w, tex_h;
+} text_layout_instance_t, *text_layout_instance_p;
+
+typedef struct {
+	// Byte offset of the code point in its line, pen position after the glyph (relative
+	// to the start of the line, in font pixels) and the glyph index for kerning with the
+	// next glyph
+	uint32_t offset;
+	int32_t  pen_x;
+	uint32_t glyph_index;
+	// Line of the glyph in the texture, marked as used whenever the layout is drawn
+	uint32_t atlas_line;
+} text_layout_glyph_t, *text_layout_glyph_p;
+
+typedef struct {
+	// Byte range of the line in the text and its range of glyphs (and instances)
+	size_t start, length;
+	size_t first_glyph, glyph_count;
+} text_layout_line_t, *text_layout_line_p;
+
+typedef struct {
+	char* text;
+	text_layout_line_p lines;
+	text_layout_glyph_p glyphs;
+	text_layout_instance_p instances;
+	size_t line_count, glyph_count;
+	// Scale the instances were laid out with
+	float scale;
+	// All buffers are large enough for a text of this many bytes
+	size_t capacity;
+} text_layout_state_t, *text_layout_state_p;
+
+typedef struct {
+	text_renderer_p renderer;
+	int32_t font;
+	size_t x, y;
+	// Font pixels are multiplied by this, 1 unless changed with text_layout_set_size()
+	float scale;
+	
+	// The next layout is built from the current one and then both are swapped
+	text_layout_state_t current, next;
+	// Generation of the renderer the layout was built with
+	uint64_t generation;
+	
+	GLuint buffer;
+	size_t buffer_capacity;
+} text_layout_t, *text_layout_p;
+
+text_layout_p text_layout_new(text_renderer_p renderer, int32_t font_handle, size_t x, size_t y);
+void          text_layout_destroy(text_layout_p layout);
+bool          text_layout_update(text_layout_p layout, const char* text);
+bool          text_layout_draw(text_layout_p layout, drawable_p drawable);
+void          text_layout_set_size(text_layout_p layout, float pixel_size);
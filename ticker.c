@@ -0,0 +1,402 @@
+// For accept4() and strdup()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "utf8.h"
+#include "ticker.h"
+
+
+// Text is laid out this far beyond the right edge of the lane (in lanes) so a few frames
+// of scrolling or a glyph the worker still rasterizes don't leave a gap
+#define TICKER_LOOKAHEAD  0.5
+// Instances are rebased after scrolling that many pixels, floats are exact to 1/256
+// pixel up to there
+#define TICKER_REBASE_DISTANCE  65536
+
+static void lay_out_queue(ticker_p ticker);
+static void lay_out_ring(ticker_p ticker);
+static text_layout_instance_t glyph_instance(ticker_p ticker, const text_renderer_cell_t* cell, double pen_x);
+static void upload_instances(ticker_p ticker, size_t first, size_t count);
+static void close_client(ticker_client_p client);
+
+static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void on_client_data(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+
+
+/**
+ * Creates a lane `width` pixels wide with its top left corner at `x`, `y`. The text is
+ * `pixel_size` pixels high (only sharp for SDF fonts when it differs from the font size)
+ * and scrolls `speed` pixels per second.
+ * 
+ * Returns `NULL` if the font doesn't exist.
+ */
+ticker_p ticker_new(text_renderer_p renderer, int32_t font_handle, float x, float y, float width, float pixel_size, float speed) {
+	text_renderer_font_p font = hash_get_ptr(renderer->fonts, font_handle);
+	if (!font) {
+		fprintf(stderr, "[ticker] there is no font %d\n", font_handle);
+		return NULL;
+	}
+	
+	ticker_p ticker = malloc(sizeof(ticker_t));
+	memset(ticker, 0, sizeof(ticker_t));
+	
+	ticker->renderer = renderer;
+	ticker->font = font_handle;
+	ticker->scale = pixel_size / font->size;
+	ticker->x = x;
+	ticker->y = y;
+	ticker->width = width;
+	ticker->baseline = y + font->face->size->metrics.ascender / 64.0f * ticker->scale;
+	ticker->speed = speed;
+	ticker->gap = 2 * pixel_size;
+	
+	ticker->queue = array_of(uint32_t);
+	ticker->last_time = -1;
+	ticker->generation = renderer->generation;
+	ticker->buffer = buffer_new(0, NULL);
+	buffer_update(ticker->buffer, TICKER_MAX_GLYPHS * sizeof(text_layout_instance_t), NULL, GL_DYNAMIC_DRAW);
+	
+	ticker->socket_fd = -1;
+	ticker->clients = array_of(ticker_client_p);
+	
+	return ticker;
+}
+
+/**
+ * Disconnects all clients, closes the socket and frees the ticker.
+ */
+void ticker_destroy(ticker_p ticker) {
+	while (ticker->clients->length > 0)
+		close_client(array_elem(ticker->clients, ticker_client_p, 0));
+	array_destroy(ticker->clients);
+	
+	if (ticker->socket_fd != -1) {
+		ticker->mainloop->io_free(ticker->accept_event);
+		close(ticker->socket_fd);
+		unlink(ticker->socket_path);
+		free(ticker->socket_path);
+	}
+	
+	buffer_destroy(ticker->buffer);
+	array_destroy(ticker->queue);
+	free(ticker);
+}
+
+/**
+ * Listens on a unix socket at `socket_path`. Everything clients write into it is appended
+ * to the ticker. Clients can stay connected and send more text later.
+ */
+bool ticker_listen(ticker_p ticker, const char* socket_path, pa_mainloop_api* mainloop) {
+	ticker->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (ticker->socket_fd == -1)
+		return perror("[ticker] socket"), false;
+	
+	unlink(socket_path);
+	
+	struct sockaddr_un addr = { AF_UNIX, "" };
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+	if ( bind(ticker->socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ) {
+		perror("[ticker] bind");
+		goto failed;
+	}
+	
+	if ( listen(ticker->socket_fd, 3) == -1 ) {
+		perror("[ticker] listen");
+		goto failed;
+	}
+	
+	ticker->socket_path = strdup(socket_path);
+	ticker->mainloop = mainloop;
+	ticker->accept_event = mainloop->io_new(mainloop, ticker->socket_fd, PA_IO_EVENT_INPUT, on_accept, ticker);
+	
+	return true;
+	
+	failed:
+		close(ticker->socket_fd);
+		ticker->socket_fd = -1;
+	return false;
+}
+
+/**
+ * Appends `size` bytes of UTF-8 text (or up to a zero terminator). Line breaks become
+ * gaps two text heights wide, other control characters are ignored. The text is laid
+ * out when it's about to scroll in, so appending only decodes it.
+ */
+void ticker_append(ticker_p ticker, const char* text, size_t size) {
+	// Move the waiting code points to the front once the consumed ones outnumber them,
+	// so that costs at most as much as laying them out
+	array_p queue = ticker->queue;
+	size_t waiting = queue->length - ticker->queue_start;
+	if (ticker->queue_start > 0 && ticker->queue_start >= waiting) {
+		uint32_t* code_points = array_data(queue, uint32_t);
+		memmove(code_points, code_points + ticker->queue_start, waiting * sizeof(uint32_t));
+		array_resize(queue, waiting);
+		ticker->queue_start = 0;
+	}
+	
+	size_t length = queue->length;
+	array_resize(queue, length + size);
+	size_t decoded = utf8_decode(text, size, array_data(queue, uint32_t) + length, NULL);
+	array_resize(queue, length + decoded);
+}
+
+/**
+ * Scrolls the lane to `time` (in µs, any clock) and draws it with `drawable`, which
+ * has to be created by drawable_new_instanced() with 4 vertices per instance
+ * (GL_TRIANGLE_STRIP) and the "shaders/ticker.vs" vertex shader. Glyphs outside of the
+ * lane are clipped with clip distances.
+ */
+bool ticker_draw(ticker_p ticker, drawable_p drawable, int64_t time) {
+	if (ticker->last_time >= 0)
+		ticker->scroll += ticker->speed * (time - ticker->last_time) / 1000000.0;
+	ticker->last_time = time;
+	
+	// Drop glyphs that scrolled out on the left
+	float scroll = ticker->scroll - ticker->base;
+	while (ticker->count > 0) {
+		text_layout_instance_p instance = &ticker->instances[ticker->head];
+		if (instance->x + instance->w - scroll > ticker->x)
+			break;
+		ticker->head = (ticker->head + 1) % TICKER_MAX_GLYPHS;
+		ticker->count--;
+	}
+	
+	// Rebasing and evicted glyphs both change instances all over the ring
+	text_renderer_p renderer = ticker->renderer;
+	if (ticker->scroll - ticker->base > TICKER_REBASE_DISTANCE) {
+		ticker->base = floor(ticker->scroll);
+		lay_out_ring(ticker);
+	} else if (ticker->generation != renderer->generation) {
+		lay_out_ring(ticker);
+	}
+	
+	lay_out_queue(ticker);
+	
+	// Keep the glyphs of the lane in the texture
+	for(size_t i = 0; i < ticker->count; i++) {
+		ticker_glyph_p glyph = &ticker->glyphs[(ticker->head + i) % TICKER_MAX_GLYPHS];
+		if (glyph->glyph_index == 0)
+			continue;
+		text_renderer_line_p line = array_elem_ptr(renderer->lines, glyph->atlas_line);
+		line->last_used = renderer->frame;
+	}
+	
+	if (ticker->count == 0)
+		return true;
+	
+	drawable->vertex_buffer = ticker->buffer;
+	drawable->texture = renderer->texture;
+	drawable_uniform_1f(drawable, "scroll", ticker->scroll - ticker->base);
+	drawable_uniform_2f(drawable, "lane", ticker->x, ticker->x + ticker->width);
+	
+	// The ring might wrap around, then the glyphs at the start of the buffer come last
+	bool success = true;
+	glEnable(GL_CLIP_DISTANCE0);
+	glEnable(GL_CLIP_DISTANCE1);
+		size_t tail_count = TICKER_MAX_GLYPHS - ticker->head;
+		drawable->first_instance = ticker->head;
+		drawable->instance_count = (ticker->count < tail_count) ? ticker->count : tail_count;
+		success = drawable_draw(drawable);
+		
+		if (success && ticker->count > tail_count) {
+			drawable->first_instance = 0;
+			drawable->instance_count = ticker->count - tail_count;
+			success = drawable_draw(drawable);
+		}
+	glDisable(GL_CLIP_DISTANCE0);
+	glDisable(GL_CLIP_DISTANCE1);
+	
+	// The buffer and texture still belong to the ticker and renderer
+	drawable->first_instance = 0;
+	drawable->vertex_buffer = 0;
+	drawable->texture = 0;
+	return success;
+}
+
+
+//
+// Layout
+//
+
+/**
+ * Lays out waiting code points until the text reaches TICKER_LOOKAHEAD lanes beyond the
+ * right edge of the lane. Stops at glyphs the worker didn't rasterize yet, they're
+ * tried again in the next frame.
+ */
+static void lay_out_queue(ticker_p ticker) {
+	text_renderer_p renderer = ticker->renderer;
+	uint32_t* code_points = array_data(ticker->queue, uint32_t);
+	double right_edge = ticker->scroll + ticker->width;
+	size_t first = (ticker->head + ticker->count) % TICKER_MAX_GLYPHS, count = 0;
+	
+	while (ticker->queue_start < ticker->queue->length && ticker->count < TICKER_MAX_GLYPHS) {
+		// Text that arrives after the lane ran empty starts at the right edge instead of
+		// popping up in the middle of the lane
+		if (ticker->pen_x < right_edge) {
+			ticker->pen_x = right_edge;
+			ticker->prev_glyph_index = 0;
+		}
+		if (ticker->pen_x > right_edge + ticker->width * TICKER_LOOKAHEAD)
+			break;
+		
+		uint32_t code_point = code_points[ticker->queue_start];
+		if (code_point < ' ') {
+			if (code_point == '\n')
+				ticker->pen_x += ticker->gap;
+			ticker->prev_glyph_index = 0;
+			ticker->queue_start++;
+			continue;
+		}
+		
+		uint32_t atlas_line = 0;
+		const text_renderer_cell_t* cell = text_renderer_lookup(renderer, ticker->font, code_point, &atlas_line);
+		if (!cell) {
+			ticker->queue_start++;
+			continue;
+		} else if (cell->glyph_index == 0) {
+			break;
+		}
+		
+		ticker->pen_x += text_renderer_kerning(renderer, ticker->font, ticker->prev_glyph_index, cell->glyph_index) * ticker->scale;
+		
+		size_t idx = (ticker->head + ticker->count) % TICKER_MAX_GLYPHS;
+		ticker->glyphs[idx] = (ticker_glyph_t){ ticker->pen_x, code_point, cell->glyph_index, atlas_line };
+		ticker->instances[idx] = glyph_instance(ticker, cell, ticker->pen_x);
+		ticker->count++;
+		count++;
+		
+		ticker->pen_x += cell->hori_advance * ticker->scale;
+		ticker->prev_glyph_index = cell->glyph_index;
+		ticker->queue_start++;
+	}
+	
+	upload_instances(ticker, first, count);
+}
+
+/**
+ * Looks up the glyphs of the whole ring again and rebuilds their instances at the same
+ * pen positions. Glyphs evicted from the texture are empty until the worker rasterized
+ * them again (which changes the generation and brings us back here).
+ */
+static void lay_out_ring(ticker_p ticker) {
+	for(size_t i = 0; i < ticker->count; i++) {
+		size_t idx = (ticker->head + i) % TICKER_MAX_GLYPHS;
+		ticker_glyph_p glyph = &ticker->glyphs[idx];
+		
+		uint32_t atlas_line = 0;
+		const text_renderer_cell_t* cell = text_renderer_lookup(ticker->renderer, ticker->font, glyph->code_point, &atlas_line);
+		if (cell && cell->glyph_index != 0) {
+			glyph->glyph_index = cell->glyph_index;
+			glyph->atlas_line = atlas_line;
+			ticker->instances[idx] = glyph_instance(ticker, cell, glyph->pen_x);
+		} else {
+			glyph->glyph_index = 0;
+			ticker->instances[idx] = (text_layout_instance_t){ .x = ticker->x + (float)(glyph->pen_x - ticker->base), .y = ticker->baseline };
+		}
+	}
+	
+	upload_instances(ticker, ticker->head, ticker->count);
+	ticker->generation = ticker->renderer->generation;
+}
+
+static text_layout_instance_t glyph_instance(ticker_p ticker, const text_renderer_cell_t* cell, double pen_x) {
+	float scale = ticker->scale;
+	return (text_layout_instance_t){
+		.x = ticker->x + (float)(pen_x - ticker->base) + cell->hori_bearing_x * scale, .y = ticker->baseline - cell->hori_bearing_y * scale,
+		.u = cell->x, .v = cell->y,
+		.w = cell->width * scale, .h = cell->height * scale,
+		.tex_w = cell->width, .tex_h = cell->height
+	};
+}
+
+/**
+ * Uploads `count` instances of the ring starting at `first`, in two parts if they
+ * wrap around the end of the buffer.
+ */
+static void upload_instances(ticker_p ticker, size_t first, size_t count) {
+	size_t instance_size = sizeof(text_layout_instance_t);
+	size_t tail_count = TICKER_MAX_GLYPHS - first;
+	if (count > tail_count) {
+		buffer_update_part(ticker->buffer, first * instance_size, tail_count * instance_size, ticker->instances + first);
+		buffer_update_part(ticker->buffer, 0, (count - tail_count) * instance_size, ticker->instances);
+	} else if (count > 0) {
+		buffer_update_part(ticker->buffer, first * instance_size, count * instance_size, ticker->instances + first);
+	}
+}
+
+
+//
+// Event handlers
+//
+
+static void on_accept(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	ticker_p ticker = userdata;
+	int client_fd = accept4(ticker->socket_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd == -1) {
+		perror("[ticker] accept4");
+		return;
+	}
+	
+	ticker_client_p client = malloc(sizeof(ticker_client_t));
+	memset(client, 0, sizeof(ticker_client_t));
+	client->ticker = ticker;
+	client->fd = client_fd;
+	client->event = mainloop->io_new(mainloop, client_fd, PA_IO_EVENT_INPUT | PA_IO_EVENT_HANGUP, on_client_data, client);
+	array_append(ticker->clients, ticker_client_p, client);
+}
+
+/**
+ * Appends everything the client sent. A code point split between two reads is kept
+ * and completed by the next read.
+ */
+static void on_client_data(pa_mainloop_api *mainloop, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+	ticker_client_p client = userdata;
+	
+	char buffer[4096];
+	memcpy(buffer, client->partial, client->partial_size);
+	ssize_t bytes_read = read(fd, buffer + client->partial_size, sizeof(buffer) - client->partial_size);
+	if (bytes_read <= 0) {
+		if (bytes_read < 0)
+			perror("[ticker] read");
+		close_client(client);
+		return;
+	}
+	
+	// Look for the start of an incomplete code point in the last 3 bytes
+	size_t size = client->partial_size + bytes_read, complete = size;
+	for(size_t back = 1; back <= 3 && back <= size; back++) {
+		uint8_t byte = buffer[size - back];
+		if ((byte & 0xC0) == 0x80)
+			continue;
+		
+		size_t length = (byte >= 0xF0) ? 4 : (byte >= 0xE0) ? 3 : (byte >= 0xC0) ? 2 : 1;
+		if (length > back)
+			complete = size - back;
+		break;
+	}
+	
+	ticker_append(client->ticker, buffer, complete);
+	client->partial_size = size - complete;
+	memcpy(client->partial, buffer + complete, client->partial_size);
+}
+
+static void close_client(ticker_client_p client) {
+	ticker_p ticker = client->ticker;
+	ticker->mainloop->io_free(client->event);
+	close(client->fd);
+	for(size_t i = 0; i < ticker->clients->length; i++) {
+		if (array_elem(ticker->clients, ticker_client_p, i) == client) {
+			array_remove(ticker->clients, i);
+			break;
+		}
+	}
+	free(client);
+}
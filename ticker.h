@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pulse/pulseaudio.h>
+
+#include "array.h"
+#include "text_renderer.h"
+
+
+/**
+
+A lane of text that scrolls from right to left with a constant speed, like a news
+ticker or live captions. Text is appended at the end (usually by clients of a local
+socket) and enters the lane at its right edge.
+
+Glyphs are laid out once, right before they scroll in, and kept in a ring of instances
+in a GPU buffer. Scrolling only changes a uniform and glyphs that left the lane are
+dropped from the ring. A frame costs the same no matter how much text already scrolled
+past or is still waiting.
+
+Basic API usage:
+
+drawable_p text = drawable_new_instanced(GL_TRIANGLE_STRIP, 4, "shaders/ticker.vs", "shaders/text_sdf.fs");
+int32_t font = text_renderer_sdf_font_new(&renderer, "DroidSans.ttf");
+
+ticker_p ticker = ticker_new(&renderer, font, 0, 660, 1280, 40, 120);
+ticker_listen(ticker, "hdswitch-ticker.sock", mainloop);
+
+ticker_append(ticker, "Breaking news", 13);
+ticker_draw(ticker, text, time_now());
+
+ticker_destroy(ticker);
+
+Appending text via the socket (line breaks become gaps):
+
+echo "Breaking news" | socat - UNIX-CONNECT:hdswitch-ticker.sock
+
+*/
+
+// Glyphs in the ring, more than fit into a lane the width of a 1080p frame even with
+// small fonts. When the ring is full new text waits until old glyphs scrolled out.
+#define TICKER_MAX_GLYPHS  1024
+
+typedef struct {
+	// Pen position of the glyph (after kerning) in lane pixels since the ticker was created
+	double   pen_x;
+	uint32_t code_point;
+	// 0 while the glyph is drawn as an empty instance (it was evicted from the texture)
+	uint32_t glyph_index;
+	uint32_t atlas_line;
+} ticker_glyph_t, *ticker_glyph_p;
+
+typedef struct ticker_s ticker_t, *ticker_p;
+
+// A connected client, keeps the start of a code point split across two reads
+typedef struct {
+	ticker_p     ticker;
+	int          fd;
+	pa_io_event* event;
+	char         partial[4];
+	size_t       partial_size;
+} ticker_client_t, *ticker_client_p;
+
+struct ticker_s {
+	text_renderer_p renderer;
+	int32_t font;
+	// Lane on the screen and the baseline of the text. Font pixels are multiplied by
+	// `scale`, `speed` is in screen pixels per second and `gap` is the space line breaks
+	// turn into.
+	float x, y, width, baseline;
+	float scale, speed, gap;
+	
+	// Code points appended but not laid out yet, starting at `queue_start`
+	array_p queue;
+	size_t queue_start;
+	
+	// Ring of laid out glyphs and their instances (also in `buffer`), the oldest one
+	// is at `head`
+	ticker_glyph_t glyphs[TICKER_MAX_GLYPHS];
+	text_layout_instance_t instances[TICKER_MAX_GLYPHS];
+	size_t head, count;
+	GLuint buffer;
+	
+	// Lane position at the left edge of the lane and where the next glyph goes. The
+	// instances are relative to `base`, it's moved along once in a while so the floats
+	// stay precise.
+	double scroll, pen_x, base;
+	uint32_t prev_glyph_index;
+	int64_t last_time;
+	// Generation of the renderer the glyphs were looked up with
+	uint64_t generation;
+	
+	// Local socket for clients to write text into, -1 without ticker_listen()
+	int socket_fd;
+	char* socket_path;
+	pa_mainloop_api* mainloop;
+	pa_io_event* accept_event;
+	array_p clients;
+};
+
+ticker_p ticker_new(text_renderer_p renderer, int32_t font_handle, float x, float y, float width, float pixel_size, float speed);
+void     ticker_destroy(ticker_p ticker);
+bool     ticker_listen(ticker_p ticker, const char* socket_path, pa_mainloop_api* mainloop);
+void     ticker_append(ticker_p ticker, const char* text, size_t size);
+bool     ticker_draw(ticker_p ticker, drawable_p drawable, int64_t time);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/time.h>
+#include <time.h>
 #include <stddef.h>
 #include <stdint.h>
 //typedef struct timeval timeval_t, *timeval_p;
@@ -24,6 +25,16 @@ static inline usec_t time_now() {
 	return timeval_to_usec(now);
 }
 
+/**
+ * Returns the CLOCK_MONOTONIC time in µs. That's the clock V4L2 drivers use for their
+ * capture timestamps. Needs _POSIX_C_SOURCE 199309L or _GNU_SOURCE.
+ */
+static inline usec_t time_monotonic() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
 static inline double time_mark_ms(usec_p mark) {
 	usec_t now = time_now();
 	double elapsed = (now - *mark) / 1000.0;
@@ -0,0 +1,143 @@
+// For syscall()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+
+typedef struct {
+	const char* name;
+	uint64_t start, duration;
+} span_t, *span_p;
+
+// Only the owning thread writes spans into a ring. `head` is the number of spans ever
+// written, the span at `head % TRACE_RING_SIZE` is the next one to be overwritten.
+typedef struct ring_s ring_t, *ring_p;
+struct ring_s {
+	ring_p      next;
+	pid_t       tid;
+	const char* thread_name;
+	uint64_t    head;
+	span_t      spans[TRACE_RING_SIZE];
+};
+
+// All rings ever created, new ones are pushed to the front with a compare and swap
+static ring_p rings = NULL;
+static __thread ring_p local_ring = NULL;
+
+
+static ring_p ring_for_this_thread() {
+	if (local_ring != NULL)
+		return local_ring;
+	
+	local_ring = calloc(1, sizeof(ring_t));
+	local_ring->tid = syscall(SYS_gettid);
+	
+	ring_p head = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	do {
+		local_ring->next = head;
+	} while ( !__atomic_compare_exchange_n(&rings, &head, local_ring, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) );
+	
+	return local_ring;
+}
+
+/**
+ * Names the calling thread in the trace. `name` isn't copied, use a string literal.
+ */
+void trace_thread_name(const char* name) {
+	ring_for_this_thread()->thread_name = name;
+}
+
+uint64_t trace_begin() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Records a span from `start` (as returned by trace_begin()) until now. `name` isn't
+ * copied, use a string literal.
+ */
+void trace_end(const char* name, uint64_t start) {
+	uint64_t end = trace_begin();
+	ring_p ring = ring_for_this_thread();
+	
+	span_p span = &ring->spans[ring->head % TRACE_RING_SIZE];
+	span->name = name;
+	span->start = start;
+	span->duration = end - start;
+	
+	// Publish the span after it's written so trace_flush() never reads a half written one
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes the spans of all threads into a Chrome trace JSON file. Other threads can
+ * continue to record while this runs. Spans they overwrite during the flush are left
+ * out instead of being written half updated.
+ * 
+ * Returns `false` if the file couldn't be written.
+ */
+bool trace_flush(const char* path) {
+	FILE* f = fopen(path, "w");
+	if (f == NULL)
+		return perror("[trace] fopen"), false;
+	
+	pid_t pid = getpid();
+	const char* separator = "";
+	size_t span_count = 0;
+	
+	fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for(ring_p ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+		if (ring->thread_name) {
+			fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				separator, pid, ring->tid, ring->thread_name);
+			separator = ",";
+		}
+		
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+		
+		for(uint64_t i = first; i < head; i++) {
+			span_t span = ring->spans[i % TRACE_RING_SIZE];
+			
+			// Skip the span if the thread might have overwritten it while we copied it. The
+			// thread could be writing span `current_head` right now, which replaces span
+			// `current_head - TRACE_RING_SIZE`.
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			uint64_t current_head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+			if (current_head >= TRACE_RING_SIZE && i <= current_head - TRACE_RING_SIZE)
+				continue;
+			
+			fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3lf, \"dur\": %.3lf}",
+				separator, span.name, pid, ring->tid, span.start / 1000.0, span.duration / 1000.0);
+			separator = ",";
+			span_count++;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	
+	if ( fclose(f) != 0 )
+		return perror("[trace] fclose"), false;
+	
+	printf("[trace] wrote %zu spans to %s\n", span_count, path);
+	return true;
+}
+
+/**
+ * Frees the rings of all threads. Only call this after all other threads that
+ * recorded spans are done.
+ */
+void trace_cleanup() {
+	for(ring_p ring = rings, next = NULL; ring != NULL; ring = next) {
+		next = ring->next;
+		free(ring);
+	}
+	rings = NULL;
+	local_ring = NULL;
+}
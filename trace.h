@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+
+Records spans (name, start and duration) into a per-thread ring buffer and writes
+them as a Chrome trace JSON file on demand. Open the file in chrome://tracing or
+ui.perfetto.dev to see what happened in the last few seconds before a hitch.
+
+Timestamps are CLOCK_MONOTONIC nanoseconds (vDSO, no syscall). Every thread gets
+its own ring of TRACE_RING_SIZE spans on first use so recording needs no locks.
+Older spans are overwritten, a flush always contains the most recent ones.
+
+Basic API usage:
+
+trace_thread_name("mainloop");
+
+uint64_t start = trace_begin();
+	...
+trace_end("compose", start);
+
+trace_flush("hdswitch-trace.json");
+trace_cleanup();
+
+*/
+
+#define TRACE_RING_SIZE 16384
+
+void     trace_thread_name(const char* name);
+uint64_t trace_begin();
+void     trace_end(const char* name, uint64_t start);
+
+bool     trace_flush(const char* path);
+void     trace_cleanup();
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include "utf8.h"
 
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
 
 utf8_iterator_t utf8_first_size(char* buffer, size_t size) {
 	return utf8_next((utf8_iterator_t){
@@ -36,9 +41,11 @@ utf8_iterator_t utf8_next(utf8_iterator_t it) {
 	// all bits (~).
 	// __builtin_clz() works on 32 bit ints, but we only want the leading one bits of our
 	// 8 bit byte. Therefore put the byte at the highest order bits of the int (<< 24).
-	int leading_ones = __builtin_clz(~byte << 24);
+	// The lower bits are ones after flipping so 0xFF gives 8 instead of an undefined result.
+	int leading_ones = __builtin_clz(~((uint32_t)byte << 24));
 	
-	if (leading_ones != 1) {
+	// 0xFE and 0xFF never start a code point, handle them like intermediate bytes
+	if (leading_ones != 1 && leading_ones < 7) {
 		// Store the data bits of the first byte in the code point
 		int data_bits_in_first_byte = 8 - 1 - leading_ones;
 		it.code_point = byte & ~(0xFFFFFFFF << data_bits_in_first_byte);
@@ -77,13 +84,95 @@ utf8_iterator_t utf8_next(utf8_iterator_t it) {
 			it.buffer = it.end;
 		}
 	} else {
-		// Error, we're at an intermediate byte.
+		// Error, we're at an intermediate byte (or 0xFE or 0xFF).
 		// Skip all intermediate bytes (or to the end of the buffer) and return the replacement
 		// character.
-		while ( (*(it.buffer) & 0xC0) == 0x80 && it.buffer < it.end )
+		while ( it.buffer < it.end && (*(it.buffer) & 0xC0) == 0x80 )
 			it.buffer++;
 		it.code_point = 0xFFFD;
 	}
 	
 	return it;
+}
+
+
+//
+// Bulk decoding. The SSE2 version looks at 16 bytes at once and converts all ASCII
+// characters at the start of them. The fallback does the same one byte at a time.
+//
+
+#if defined(__SSE2__)
+
+	// Stores all 16 bytes as code points but returns only how many of them are ASCII
+	// characters before the first non-ASCII byte or zero terminator.
+	static size_t decode_ascii_group(const uint8_t* bytes, uint32_t* code_points) {
+		__m128i group = _mm_loadu_si128((const __m128i*)bytes);
+		__m128i zero = _mm_setzero_si128();
+		uint32_t stop_mask = _mm_movemask_epi8(group) | _mm_movemask_epi8(_mm_cmpeq_epi8(group, zero));
+		
+		__m128i low = _mm_unpacklo_epi8(group, zero), high = _mm_unpackhi_epi8(group, zero);
+		_mm_storeu_si128((__m128i*)(code_points +  0), _mm_unpacklo_epi16(low,  zero));
+		_mm_storeu_si128((__m128i*)(code_points +  4), _mm_unpackhi_epi16(low,  zero));
+		_mm_storeu_si128((__m128i*)(code_points +  8), _mm_unpacklo_epi16(high, zero));
+		_mm_storeu_si128((__m128i*)(code_points + 12), _mm_unpackhi_epi16(high, zero));
+		
+		return (stop_mask == 0) ? 16 : (size_t)__builtin_ctz(stop_mask);
+	}
+
+#else
+
+	static size_t decode_ascii_group(const uint8_t* bytes, uint32_t* code_points) {
+		size_t i = 0;
+		while (i < 16 && bytes[i] != 0 && bytes[i] < 0x80) {
+			code_points[i] = bytes[i];
+			i++;
+		}
+		return i;
+	}
+
+#endif
+
+size_t utf8_decode(const char* buffer, size_t size, uint32_t* code_points, size_t* errors) {
+	const uint8_t* pos = (const uint8_t*)buffer;
+	const uint8_t* end = pos + size;
+	uint32_t* out = code_points;
+	size_t error_count = 0;
+	
+	while (pos < end) {
+		// There is never more than one code point per byte, so `out` has room for all 16
+		// code points whenever there are 16 bytes left
+		while (end - pos >= 16) {
+			size_t ascii_chars = decode_ascii_group(pos, out);
+			pos += ascii_chars;
+			out += ascii_chars;
+			if (ascii_chars < 16)
+				break;
+		}
+		
+		if (pos == end || *pos == 0)
+			break;
+		if (*pos < 0x80) {
+			*(out++) = *(pos++);
+			continue;
+		}
+		
+		// Multi-byte code points and all the error handling are left to utf8_next()
+		utf8_iterator_t it = utf8_next((utf8_iterator_t){ .buffer = (char*)pos, .end = (char*)end, .code_point = 0 });
+		// An overlong encoded zero ends the iteration, too
+		if (it.code_point == 0)
+			break;
+		if (it.code_point == 0xFFFD) {
+			// An encoded U+FFFD in the text isn't an error
+			bool encoded = (it.buffer - (char*)pos == 3 && pos[0] == 0xEF && pos[1] == 0xBF && pos[2] == 0xBD);
+			if (!encoded)
+				error_count++;
+		}
+		
+		*(out++) = it.code_point;
+		pos = (const uint8_t*)it.buffer;
+	}
+	
+	if (errors)
+		*errors = error_count;
+	return out - code_points;
 }
\ No newline at end of file
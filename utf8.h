@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
 
 
@@ -13,4 +14,11 @@ typedef struct {
 
 utf8_iterator_t utf8_first_size(char* buffer, size_t size);
 utf8_iterator_t utf8_first(char* buffer);
-utf8_iterator_t utf8_next(utf8_iterator_t it);
\ No newline at end of file
+utf8_iterator_t utf8_next(utf8_iterator_t it);
+
+// Decodes `size` bytes (or up to a zero terminator) into `code_points`, which needs room
+// for `size` code points. Gives the same code points as iterating with utf8_first_size()
+// and utf8_next(), but runs of ASCII characters are converted 16 at a time. Returns the
+// number of code points and stores the number of invalid sequences (decoded as U+FFFD)
+// in `errors` if it's not NULL.
+size_t utf8_decode(const char* buffer, size_t size, uint32_t* code_points, size_t* errors);
\ No newline at end of file
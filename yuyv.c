@@ -0,0 +1,71 @@
+#include <stdlib.h>
+
+#include "yuyv.h"
+
+
+/**
+ * Scales the RGB image into `width` times `height` pixels, keeps the aspect ratio and
+ * fills the rest with black. Each output pixel is the average of the source pixels it
+ * covers (at least one) so downscaled text stays readable. The colors are converted to
+ * BT.601 limited range YUYV, the format the cameras deliver. A `NULL` image becomes
+ * completely black.
+ */
+void yuyv_from_rgb(const uint8_t* rgb, size_t src_w, size_t src_h, uint8_t* yuyv, size_t width, size_t height) {
+	for(size_t i = 0; i < width * height; i++) {
+		yuyv[i*2 + 0] = 16;
+		yuyv[i*2 + 1] = 128;
+	}
+	if (rgb == NULL)
+		return;
+	
+	// Area the image covers, the left edge on an even pixel so chroma pairs stay within it
+	size_t dst_w = width, dst_h = height;
+	if (src_w * height > width * src_h)
+		dst_h = src_h * width / src_w;
+	else
+		dst_w = src_w * height / src_h;
+	size_t dst_x = (width - dst_w) / 2 & ~(size_t)1, dst_y = (height - dst_h) / 2;
+	
+	uint8_t* row_rgb = malloc(dst_w * 3);
+	for(size_t y = 0; y < dst_h; y++) {
+		size_t y1 = y * src_h / dst_h, y2 = (y + 1) * src_h / dst_h;
+		if (y2 <= y1)
+			y2 = y1 + 1;
+		
+		for(size_t x = 0; x < dst_w; x++) {
+			size_t x1 = x * src_w / dst_w, x2 = (x + 1) * src_w / dst_w;
+			if (x2 <= x1)
+				x2 = x1 + 1;
+			
+			uint32_t sum[3] = { 0, 0, 0 };
+			for(size_t sy = y1; sy < y2; sy++) {
+				const uint8_t* src = rgb + (sy * src_w + x1) * 3;
+				for(size_t sx = x1; sx < x2; sx++, src += 3) {
+					sum[0] += src[0];
+					sum[1] += src[1];
+					sum[2] += src[2];
+				}
+			}
+			
+			uint32_t count = (x2 - x1) * (y2 - y1);
+			for(size_t c = 0; c < 3; c++)
+				row_rgb[x*3 + c] = (sum[c] + count / 2) / count;
+		}
+		
+		uint8_t* out = yuyv + ((dst_y + y) * width + dst_x) * 2;
+		for(size_t x = 0; x < dst_w; x += 2) {
+			const uint8_t* p1 = row_rgb + x * 3;
+			// The last pixel of an odd width shares its chroma with itself
+			const uint8_t* p2 = (x + 1 < dst_w) ? p1 + 3 : p1;
+			int r = (p1[0] + p2[0]) / 2, g = (p1[1] + p2[1]) / 2, b = (p1[2] + p2[2]) / 2;
+			
+			out[x*2 + 0] = ((66 * p1[0] + 129 * p1[1] + 25 * p1[2] + 128) >> 8) + 16;
+			out[x*2 + 1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+			if (x + 1 < dst_w) {
+				out[x*2 + 2] = ((66 * p2[0] + 129 * p2[1] + 25 * p2[2] + 128) >> 8) + 16;
+				out[x*2 + 3] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+			}
+		}
+	}
+	free(row_rgb);
+}
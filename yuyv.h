@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Scales an RGB image (e.g. from stb_image) into `width` times `height` YUYV pixels with
+// black bars to keep the aspect ratio. YUYV is BT.601 limited range like the cameras
+// deliver it. A `NULL` image gives a black frame.
+void yuyv_from_rgb(const uint8_t* rgb, size_t src_w, size_t src_h, uint8_t* yuyv, size_t width, size_t height);